@@ -0,0 +1,364 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+//
+// sharded-cache
+// =============
+//
+// End to end benchmark of rendezvous-hasher.h: an in-process key
+// value cache split in shards, each one a thread serving requests
+// from its own queue, with closed loop clients routing every request
+// through a RendezvousHasher.
+//
+// Usage:
+//
+//   sharded-cache [-s shards] [-c clients] [-k keys] [-m slots]
+//                 [-d seconds]
+//
+//   -s  initial number of shards (default: 4)
+//   -c  number of client threads (default: 8)
+//   -k  number of distinct keys (default: 100000)
+//   -m  cache slots per shard (default: 65536)
+//   -d  duration of each phase in seconds (default: 2)
+//
+// The benchmark runs three phases: a steady one, one after adding a
+// shard and one after removing a shard, reporting the throughput and
+// the hit rate of each. A miss is filled by the client with a set
+// request, as if the value was read from a backing store, so the hit
+// rate drops when keys move to another shard and then recovers.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#include "../rendezvous-hasher.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define QUEUE_SIZE 256
+#define MAX_SHARDS 64
+
+typedef enum { OP_GET, OP_SET, OP_STOP } Op;
+
+typedef struct {
+  // Request
+  Op op;
+  unsigned int key;
+  unsigned int value;
+
+  // Reply
+  int hit;
+  unsigned int reply;
+  int done;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Request;
+
+typedef struct {
+  Request *items[QUEUE_SIZE];
+  size_t head;
+  size_t len;
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+} Queue;
+
+typedef struct {
+  unsigned int id;
+  Queue queue;
+  pthread_t thread;
+  // Direct mapped cache, key + 1 so that 0 is an empty slot
+  unsigned int *keys;
+  unsigned int *values;
+  size_t mask;
+} Shard;
+
+typedef struct {
+  unsigned int seed;
+  unsigned long long ops;
+  unsigned long long hits;
+  Request request;
+  pthread_t thread;
+} Client;
+
+static struct {
+  size_t clients;
+  size_t keys;
+  size_t slots;
+  double duration;
+
+  RendezvousHasher rh;
+  pthread_rwlock_t rh_lock;
+  Shard *shards[MAX_SHARDS];
+  volatile int running;
+} bench;
+
+static void die(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// Queue
+//
+
+static void queue_init(Queue *q)
+{
+  q->head = 0;
+  q->len = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->not_empty, NULL);
+  pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_push(Queue *q, Request *r)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->len == QUEUE_SIZE) pthread_cond_wait(&q->not_full, &q->lock);
+  q->items[(q->head + q->len++) % QUEUE_SIZE] = r;
+  pthread_cond_signal(&q->not_empty);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static Request *queue_pop(Queue *q)
+{
+  pthread_mutex_lock(&q->lock);
+  while (q->len == 0) pthread_cond_wait(&q->not_empty, &q->lock);
+  Request *r = q->items[q->head];
+  q->head = (q->head + 1) % QUEUE_SIZE;
+  q->len--;
+  pthread_cond_signal(&q->not_full);
+  pthread_mutex_unlock(&q->lock);
+  return r;
+}
+
+//
+// Shards
+//
+
+static void *shard_main(void *arg)
+{
+  Shard *shard = arg;
+  for (;;)
+  {
+    Request *r = queue_pop(&shard->queue);
+    if (r->op == OP_STOP) return NULL;
+
+    size_t slot = rendezvous_hasher_hash_uint32(r->key) & shard->mask;
+    if (r->op == OP_GET)
+    {
+      r->hit = shard->keys[slot] == r->key + 1;
+      r->reply = shard->values[slot];
+    }
+    else
+    {
+      shard->keys[slot] = r->key + 1;
+      shard->values[slot] = r->value;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->done = 1;
+    pthread_cond_signal(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+static void shard_start(unsigned int id)
+{
+  Shard *shard = calloc(1, sizeof(Shard));
+  if (!shard) die("calloc");
+  shard->id = id;
+  shard->mask = bench.slots - 1;
+  shard->keys = calloc(bench.slots, sizeof(unsigned int));
+  shard->values = calloc(bench.slots, sizeof(unsigned int));
+  if (!shard->keys || !shard->values) die("calloc");
+  queue_init(&shard->queue);
+  if (pthread_create(&shard->thread, NULL, shard_main, shard) != 0)
+    die("pthread_create");
+
+  bench.shards[id] = shard;
+  pthread_rwlock_wrlock(&bench.rh_lock);
+  rendezvous_add_node(&bench.rh, id);
+  pthread_rwlock_unlock(&bench.rh_lock);
+}
+
+static void shard_stop(unsigned int id)
+{
+  Shard *shard = bench.shards[id];
+
+  // Once the node is gone no client can route to the shard, the
+  // requests already queued are served before the stop
+  pthread_rwlock_wrlock(&bench.rh_lock);
+  rendezvous_remove_node(&bench.rh, id);
+  pthread_rwlock_unlock(&bench.rh_lock);
+
+  Request stop = { .op = OP_STOP };
+  queue_push(&shard->queue, &stop);
+  pthread_join(shard->thread, NULL);
+
+  bench.shards[id] = NULL;
+  free(shard->keys);
+  free(shard->values);
+  free(shard);
+}
+
+//
+// Clients
+//
+
+static void client_call(Client *c, Op op, unsigned int key, unsigned int value)
+{
+  Request *r = &c->request;
+  r->op = op;
+  r->key = key;
+  r->value = value;
+  r->done = 0;
+
+  // The lookup and the push happen under the read lock, so that a
+  // removed shard never gets new requests
+  RendezvousHasherId node_id = 0;
+  pthread_rwlock_rdlock(&bench.rh_lock);
+  rendezvous_get_node_for(&bench.rh, key, &node_id);
+  queue_push(&bench.shards[node_id]->queue, r);
+  pthread_rwlock_unlock(&bench.rh_lock);
+
+  pthread_mutex_lock(&r->lock);
+  while (!r->done) pthread_cond_wait(&r->cond, &r->lock);
+  pthread_mutex_unlock(&r->lock);
+}
+
+static void *client_main(void *arg)
+{
+  Client *c = arg;
+  while (bench.running)
+  {
+    c->seed = c->seed * 1103515245u + 12345u;
+    unsigned int key = (c->seed >> 8) % bench.keys;
+
+    client_call(c, OP_GET, key, 0);
+    c->ops++;
+    if (c->request.hit)
+    {
+      if (c->request.reply != key * 2654435761u)
+      {
+        fprintf(stderr, "sharded-cache: wrong value for key %u\n", key);
+        exit(1);
+      }
+      c->hits++;
+    }
+    else
+    {
+      client_call(c, OP_SET, key, key * 2654435761u);
+    }
+  }
+  return NULL;
+}
+
+static void run_phase(const char *name, Client *clients)
+{
+  for (size_t i = 0; i < bench.clients; ++i)
+  {
+    clients[i].ops = 0;
+    clients[i].hits = 0;
+  }
+
+  bench.running = 1;
+  double start = now();
+  for (size_t i = 0; i < bench.clients; ++i)
+    if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0)
+      die("pthread_create");
+
+  struct timespec ts = { (time_t) bench.duration,
+                         (long) ((bench.duration - (time_t) bench.duration) * 1e9) };
+  nanosleep(&ts, NULL);
+  bench.running = 0;
+  for (size_t i = 0; i < bench.clients; ++i)
+    pthread_join(clients[i].thread, NULL);
+  double elapsed = now() - start;
+
+  unsigned long long ops = 0, hits = 0;
+  for (size_t i = 0; i < bench.clients; ++i)
+  {
+    ops += clients[i].ops;
+    hits += clients[i].hits;
+  }
+  printf("%-24s %3zu shards %12.0f gets/s   hit rate %6.2f%%\n", name,
+         rendezvous_node_count(&bench.rh), ops / elapsed,
+         ops ? 100.0 * hits / ops : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+  size_t shards = 4;
+  bench.clients = 8;
+  bench.keys = 100000;
+  bench.slots = 65536;
+  bench.duration = 2;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:c:k:m:d:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's': shards = strtoul(optarg, NULL, 10); break;
+    case 'c': bench.clients = strtoul(optarg, NULL, 10); break;
+    case 'k': bench.keys = strtoul(optarg, NULL, 10); break;
+    case 'm': bench.slots = strtoul(optarg, NULL, 10); break;
+    case 'd': bench.duration = strtod(optarg, NULL); break;
+    default:
+      fprintf(stderr, "usage: sharded-cache [-s shards] [-c clients]"
+                      " [-k keys] [-m slots] [-d seconds]\n");
+      return 2;
+    }
+  }
+  if (shards < 2 || shards >= MAX_SHARDS || bench.clients == 0
+      || bench.keys == 0 || bench.slots == 0
+      || (bench.slots & (bench.slots - 1)) != 0)
+  {
+    fprintf(stderr, "sharded-cache: need 2 <= shards < %d, clients > 0,"
+                    " keys > 0 and slots a power of two\n", MAX_SHARDS);
+    return 2;
+  }
+
+  rendezvous_init(&bench.rh);
+  pthread_rwlock_init(&bench.rh_lock, NULL);
+  for (unsigned int i = 0; i < shards; ++i) shard_start(i);
+
+  Client *clients = calloc(bench.clients, sizeof(Client));
+  if (!clients) die("calloc");
+  for (size_t i = 0; i < bench.clients; ++i)
+  {
+    clients[i].seed = (unsigned int) i * 7919u + 1;
+    pthread_mutex_init(&clients[i].request.lock, NULL);
+    pthread_cond_init(&clients[i].request.cond, NULL);
+  }
+
+  run_phase("warmup", clients);
+  run_phase("steady", clients);
+  shard_start((unsigned int) shards);
+  run_phase("after adding a shard", clients);
+  run_phase("recovered", clients);
+  shard_stop(0);
+  run_phase("after removing a shard", clients);
+  run_phase("recovered", clients);
+
+  for (unsigned int i = 0; i < MAX_SHARDS; ++i)
+    if (bench.shards[i]) shard_stop(i);
+  free(clients);
+  rendezvous_free(&bench.rh);
+  return 0;
+}
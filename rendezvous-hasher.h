@@ -55,6 +55,17 @@
 //
 // before including the header.
 //
+// Optional modules are enabled the same way, by defining before the
+// include:
+//
+//    #define RENDEZVOUS_HASHER_REPLICAS    // Per-core replicated hashers
+//    #define RENDEZVOUS_HASHER_NUMA        // NUMA placement, Linux only
+//    #define RENDEZVOUS_HASHER_HUGE_PAGES  // Huge pages, Linux only
+//    #define RENDEZVOUS_HASHER_USDT        // Probes, needs sys/sdt.h
+//    #define RENDEZVOUS_HASHER_JOURNAL     // Membership journal, POSIX
+//    #define RENDEZVOUS_HASHER_RELOAD      // Reload from a file, Linux only
+//    #define RENDEZVOUS_HASHER_SHARED      // Shared memory tables, Linux only
+//
 // You can tune the library by #defining certain values. See the
 // "Config" comments under "Configuration" below.
 //
@@ -75,6 +86,14 @@
 //    RendezvousHasherHash chosen_node_id; // This will be set below
 //    rendezvous_get_node_for(&rh, item_id, &chosen_node_id);
 //
+// Clones share the node storage with the original hasher until one
+// of them is modified, so they are cheap to create for "what if"
+// analysis:
+//
+//    RendezvousHasher what_if;
+//    rendezvous_clone(&what_if, &rh);
+//    rendezvous_remove_node(&what_if, node1_id);
+//
 // Remember to free all allocated memory.
 //
 //    rendezvous_free(&rh);
@@ -99,6 +118,62 @@
 #define RENDEZVOUS_HASHER_MAJOR 0
 #define RENDEZVOUS_HASHER_MINOR 1
 
+#include <stddef.h>
+
+#if defined(RENDEZVOUS_HASHER_IMPLEMENTATION) \
+  && !defined(RENDEZVOUS_HASHER_NO_SIMD)      \
+  && defined(__GNUC__)                         \
+  && (defined(__x86_64__) || defined(__i386__))
+  #define RENDEZVOUS_HASHER_X86_SIMD
+  #include <immintrin.h>
+#endif
+
+// Hashers with their own allocator, see rendezvous_init_options
+#if defined(RENDEZVOUS_HASHER_NUMA) || defined(RENDEZVOUS_HASHER_HUGE_PAGES)
+  #define RENDEZVOUS__ARENA
+#endif
+
+// The NUMA and huge pages modules need _GNU_SOURCE to be defined
+// before the first include of a system header
+#if defined(RENDEZVOUS_HASHER_IMPLEMENTATION) && defined(RENDEZVOUS__ARENA)
+  #include <sched.h>
+  #include <stdio.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+// The reload module needs _GNU_SOURCE, like the NUMA module
+#if defined(RENDEZVOUS_HASHER_IMPLEMENTATION) && defined(RENDEZVOUS_HASHER_RELOAD)
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <stdint.h>
+  #include <sys/inotify.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// The journal module needs _POSIX_C_SOURCE 200809L, or _GNU_SOURCE,
+// to be defined before the first include of a system header
+#if defined(RENDEZVOUS_HASHER_IMPLEMENTATION) && defined(RENDEZVOUS_HASHER_JOURNAL)
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <stdio.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <time.h>
+  #include <unistd.h>
+#endif
+
+// The shared module needs _GNU_SOURCE, for memfd_create
+#if defined(RENDEZVOUS_HASHER_IMPLEMENTATION) && defined(RENDEZVOUS_HASHER_SHARED)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -108,13 +183,18 @@ extern "C" {
 //
 
 // Config: the type of the identifier of a node / item
-// Constraint: The id type must support the "+" and "==" operations
+// Constraint: The id type must support the "==" and ">" operations,
+// and the operations used by RENDEZVOUS_HASHER_COMBINE ("+" by
+// default)
 #ifndef RENDEZVOUS_HASHER_ID_T
+  #define RENDEZVOUS__DEFAULT_ID_T
   #define RENDEZVOUS_HASHER_ID_T unsigned int
 #endif
   
 // Config: the type of an hash returned by the hash function
+// Constraint: The hash type must support the ">" and "==" operators
 #ifndef RENDEZVOUS_HASHER_HASH_T
+  #define RENDEZVOUS__DEFAULT_HASH_T
   #define RENDEZVOUS_HASHER_HASHES
   #define RENDEZVOUS_HASHER_HASH_T unsigned int
 #endif
@@ -124,12 +204,58 @@ extern "C" {
 //
 //  RENDEZVOUS_HASHER_HASH_T my_hash(RENDEZVOUS_HASHER_ID_T id)
 //
-// Constraint: The hash type must support the ">" operator
+// Note: tools/hash-quality (make quality) checks the configured hash
+// and combine. The default hash and combine fail it: they are slightly
+// biased for sequential node ids with items strided by powers of two,
+// and fail avalanche. They are kept so that items do not change node
+// across versions, define RENDEZVOUS_HASHER_HASH_FMIX32 for a built-in
+// hash that passes
 #ifndef RENDEZVOUS_HASHER_HASH
   #define RENDEZVOUS_HASHER_HASHES
-  #define RENDEZVOUS_HASHER_HASH rendezvous_hasher_hash_uint32
+  #ifdef RENDEZVOUS_HASHER_HASH_FMIX32
+    #define RENDEZVOUS_HASHER_HASH rendezvous_hasher_hash_fmix32
+  #else
+    #define RENDEZVOUS_HASHER_HASH rendezvous_hasher_hash_uint32
+  #endif
+  // The batch hash works on arrays of unsigned int, other id or hash
+  // types are hashed one at a time
+  #if defined(RENDEZVOUS__DEFAULT_ID_T) && defined(RENDEZVOUS__DEFAULT_HASH_T)
+    #ifdef RENDEZVOUS_HASHER_HASH_FMIX32
+      #define RENDEZVOUS_HASHER_HASH_N rendezvous_hasher_hash_fmix32_n
+    #else
+      #define RENDEZVOUS_HASHER_HASH_N rendezvous_hasher_hash_uint32_n
+    #endif
+  #endif
+#endif
+
+// Config: use the built-in rendezvous_hasher_hash_fmix32, the
+// finalizer of MurmurHash3, instead of the default hash. It passes
+// tools/hash-quality with the default combine, but most items get a
+// different node than with the default hash
+//
+//  #define RENDEZVOUS_HASHER_HASH_FMIX32
+
+// Config: how the ids of a node and of an item are combined before
+// being hashed to get the score of the node for the item
+// Constraint: must be an expression of type RENDEZVOUS_HASHER_ID_T
+#ifndef RENDEZVOUS_HASHER_COMBINE
+  #define RENDEZVOUS_HASHER_COMBINE(node_id, item_id) ((node_id) + (item_id))
 #endif
 
+// Config: array version of the hash function, optional
+// Note: must have the signature
+//
+//  void my_hash_n(const RENDEZVOUS_HASHER_ID_T *in,
+//                 RENDEZVOUS_HASHER_HASH_T *out, size_t n)
+//
+// Constraint: out[i] must be equal to RENDEZVOUS_HASHER_HASH(in[i])
+
+// Config: disable the SIMD implementations of the built-in hashes
+// Note: by default SSE2, AVX2 or AVX-512 are picked at runtime on x86
+// with GCC and Clang
+//
+//  #define RENDEZVOUS_HASHER_NO_SIMD
+
 // Config: the memory allocator
 // Note: should be called like malloc(3)
 #ifndef RENDEZVOUS_HASHER_MALLOC
@@ -144,6 +270,85 @@ extern "C" {
   #define RENDEZVOUS_HASHER_FREE free
 #endif
 
+// Config: number of nodes in a chunk of the node table
+// Note: chunks are the unit shared between clones, see
+// rendezvous_clone
+#ifndef RENDEZVOUS_HASHER_CHUNK_SIZE
+  #define RENDEZVOUS_HASHER_CHUNK_SIZE 64
+#endif
+
+// Config: size of a cache line, used to keep data written by
+// different cores apart
+#ifndef RENDEZVOUS_HASHER_CACHE_LINE
+  #define RENDEZVOUS_HASHER_CACHE_LINE 64
+#endif
+
+// Config: size of the L1 data cache. Batch lookups process items in
+// groups whose state fits in half of it, and stream the node table
+// once per group instead of once per item
+#ifndef RENDEZVOUS_HASHER_L1_CACHE_SIZE
+  #define RENDEZVOUS_HASHER_L1_CACHE_SIZE 32768
+#endif
+
+// Config: how many chunks ahead of the current one batch lookups
+// prefetch, on compilers that support __builtin_prefetch
+#ifndef RENDEZVOUS_HASHER_PREFETCH_DISTANCE
+  #define RENDEZVOUS_HASHER_PREFETCH_DISTANCE 2
+#endif
+
+// Config: number of membership updates that can wait for a replica
+// to apply them, must be a power of two (RENDEZVOUS_HASHER_REPLICAS)
+#ifndef RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE
+  #define RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE 256
+#endif
+
+// Config: size of the memory blocks mapped for the chunks of a hasher
+// with its own allocator, a multiple of the page size
+// (RENDEZVOUS_HASHER_NUMA)
+#ifndef RENDEZVOUS_HASHER_ARENA_SLAB_SIZE
+  #define RENDEZVOUS_HASHER_ARENA_SLAB_SIZE 65536
+#endif
+
+// Config: size of a huge page, the memory blocks of a hasher with
+// RENDEZVOUS_HASHER_OPTION_HUGE_PAGES are this large
+// (RENDEZVOUS_HASHER_HUGE_PAGES)
+#ifndef RENDEZVOUS_HASHER_HUGE_PAGE_SIZE
+  #define RENDEZVOUS_HASHER_HUGE_PAGE_SIZE (2u << 20)
+#endif
+
+// Config: type of the positions in the map from node ids to their
+// place in the node table, used to remove nodes in O(1). With
+// `unsigned short` the map takes half the memory, hashers of 65535
+// nodes or more then fall back to a scan of the table
+#ifndef RENDEZVOUS_HASHER_POSITION_T
+  #define RENDEZVOUS_HASHER_POSITION_T unsigned int
+#endif
+
+// Config: default number of buckets of RENDEZVOUS_HASHER_ENGINE_ANCHOR,
+// the most nodes the hasher can have before its table is rebuilt
+#ifndef RENDEZVOUS_HASHER_ANCHOR_CAPACITY
+  #define RENDEZVOUS_HASHER_ANCHOR_CAPACITY 1024
+#endif
+
+// Config: default size of the lookup table of
+// RENDEZVOUS_HASHER_ENGINE_MAGLEV, a prime larger than the number of
+// nodes (about 100 times larger for a 1% imbalance)
+#ifndef RENDEZVOUS_HASHER_MAGLEV_TABLE_SIZE
+  #define RENDEZVOUS_HASHER_MAGLEV_TABLE_SIZE 65537
+#endif
+
+// Config: largest number of nodes a hot key is spread over, see
+// RendezvousHasherHotKeys
+#ifndef RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX
+  #define RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX 8
+#endif
+
+// Config: largest number of items a rule of a RendezvousHasherCrush
+// holds at once, see rendezvous_crush_select
+#ifndef RENDEZVOUS_HASHER_CRUSH_MAX_SELECT
+  #define RENDEZVOUS_HASHER_CRUSH_MAX_SELECT 16
+#endif
+
 // Config: Prefix for all functions
 // For function inlining, set this to `static inline` and then define
 // the implementation in all the files
@@ -158,22 +363,330 @@ extern "C" {
 #define RENDEZVOUS_HASHER_OK                   0
 #define RENDEZVOUS_HASHER_ERROR_IS_NULL       -1
 #define RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL -2
+#define RENDEZVOUS_HASHER_ERROR_EMPTY         -3
+#define RENDEZVOUS_HASHER_ERROR_ALLOC         -4
+#define RENDEZVOUS_HASHER_ERROR_INVALID       -5
+#define RENDEZVOUS_HASHER_ERROR_BUSY          -6
+#define RENDEZVOUS_HASHER_ERROR_UNSUPPORTED   -7
+#define RENDEZVOUS_HASHER_ERROR_IO            -8
+#define RENDEZVOUS_HASHER_ERROR_UNSYNCED      -9
+
+// Canonical order of the candidates for an item: the node with the
+// highest score wins, ties are won by the highest node id. Every
+// lookup uses this order, so the result does not depend on the order
+// in which nodes were added
+#define RENDEZVOUS_HASHER_BEATS(hash, id, best_hash, best_id) \
+  ((hash) > (best_hash) || ((hash) == (best_hash) && (id) > (best_id)))
 
 typedef RENDEZVOUS_HASHER_HASH_T RendezvousHasherHash;
 typedef RENDEZVOUS_HASHER_ID_T RendezvousHasherId;
+typedef RENDEZVOUS_HASHER_POSITION_T RendezvousHasherPosition;
 
-struct RendezvousHasherNodeList;
-typedef struct RendezvousHasherNodeList RendezvousHasherNodeList;
+// Allocator of the node table of a hasher created with options, it
+// is shared by the clones of the hasher
+typedef struct RendezvousHasherArena RendezvousHasherArena;
 
-struct RendezvousHasherNodeList {
-  RendezvousHasherNodeList* next;
-  RendezvousHasherId id;
-};
+// State of the engines other than HRW
+typedef struct RendezvousHasherEngineState RendezvousHasherEngineState;
 
+// Algorithm used to map items to nodes, see rendezvous_init_options
+#define RENDEZVOUS_HASHER_ENGINE_HRW    0 // Highest random weight, O(n)
+#define RENDEZVOUS_HASHER_ENGINE_JUMP   1 // Jump consistent hash, O(log n)
+#define RENDEZVOUS_HASHER_ENGINE_ANCHOR 2 // AnchorHash, O(1) expected
+#define RENDEZVOUS_HASHER_ENGINE_MAGLEV 3 // Maglev lookup table, O(1)
+
+// A fixed size block of the node table. Chunks are immutable while
+// shared by more than one hasher, they are copied on the first write
 typedef struct {
-  RendezvousHasherNodeList *nodes;
+  RendezvousHasherArena *arena; // NULL if from RENDEZVOUS_HASHER_MALLOC
+  unsigned int refs;
+  RendezvousHasherId ids[RENDEZVOUS_HASHER_CHUNK_SIZE];
+  // log2 of the weights in Q24, RENDEZVOUS_HASHER_CHUNK_SIZE of them.
+  // Allocated for weighted hashers only, see RENDEZVOUS_HASHER_CHUNK_BYTES
+  int log2_weights[];
+} RendezvousHasherChunk;
+
+// Bytes of a chunk of a hasher, [weighted] or not
+#define RENDEZVOUS_HASHER_CHUNK_BYTES(weighted) \
+  (sizeof(RendezvousHasherChunk)                \
+   + ((weighted) ? RENDEZVOUS_HASHER_CHUNK_SIZE * sizeof(int) : 0))
+
+// Nodes are packed: every chunk is full except the last one
+typedef struct RendezvousHasher {
+  RendezvousHasherChunk **chunks;
+  size_t chunk_count;
+  size_t chunk_capacity;
+  size_t node_count;
+  unsigned long version;        // Incremented by every change to the
+                                // nodes or their weights
+  RendezvousHasherArena *arena; // NULL if from RENDEZVOUS_HASHER_MALLOC
+  int weighted;                 // RENDEZVOUS_HASHER_OPTION_WEIGHTED
+  int engine;                   // RENDEZVOUS_HASHER_ENGINE_*
+  RendezvousHasherEngineState *engine_state; // NULL for HRW and jump
+  // Open addressing map from the ids to their positions in the table,
+  // built on the first removal from a hasher larger than a chunk.
+  // Only membership changes read it, lookups never do
+  RendezvousHasherPosition *id_map;
+  size_t id_map_capacity;       // A power of two, 0 without a map
+  // Lookup specialized for the current number of nodes, rebound by
+  // every change to the nodes. NULL when there are no nodes
+  RendezvousHasherId (*lookup)(const struct RendezvousHasher *rh,
+                               RendezvousHasherId item_id);
 } RendezvousHasher;
 
+// Place the node table on the NUMA node [numa_node]
+// (RENDEZVOUS_HASHER_NUMA)
+#define RENDEZVOUS_HASHER_OPTION_NUMA       (1u << 0)
+// Back the node table with huge pages: hugetlbfs pages if any are
+// reserved, transparent huge pages otherwise. See rendezvous_page_size
+// (RENDEZVOUS_HASHER_HUGE_PAGES)
+#define RENDEZVOUS_HASHER_OPTION_HUGE_PAGES (1u << 1)
+// Give each node a weight, a node gets a share of the items
+// proportional to its weight. The scores are computed with integer
+// operations only, so they are the same on every platform, but they
+// differ from the scores of an unweighted hasher
+// Constraint: the hash must return uniform 32 bit values, and
+// RENDEZVOUS_HASHER_HASH_T must hold them
+#define RENDEZVOUS_HASHER_OPTION_WEIGHTED   (1u << 2)
+
+// Options of rendezvous_init_options, zero for the defaults
+typedef struct {
+  unsigned int flags; // RENDEZVOUS_HASHER_OPTION_*
+  int numa_node;
+  int engine;         // RENDEZVOUS_HASHER_ENGINE_*
+  size_t engine_size; // AnchorHash: buckets, Maglev: lookup table size
+} RendezvousHasherOptions;
+
+#define RENDEZVOUS_HASHER_CHANGE_ADD    0
+#define RENDEZVOUS_HASHER_CHANGE_REMOVE 1
+
+// A proposed change to the nodes of a hasher
+typedef struct {
+  int op; // RENDEZVOUS_HASHER_CHANGE_*
+  RendezvousHasherId id;
+} RendezvousHasherChange;
+
+// Load of a node before and after a change, as a fraction of the
+// sampled items, with the half width of the confidence interval of
+// the shift (after - before)
+typedef struct {
+  RendezvousHasherId id;
+  double before;
+  double after;
+  double shift_half_width;
+} RendezvousHasherNodeLoad;
+
+typedef struct {
+  // Input, zero for the defaults
+  const RendezvousHasherId *keys; // Sample these instead of random ids
+  size_t key_count;
+  double target_half_width;       // Stop once the interval of [moved]
+                                  // is this narrow, 0 to never stop
+  double z;                       // Interval width in standard
+                                  // deviations, 1.96 (95%) by default
+
+  // Output
+  size_t samples;                 // Items actually sampled
+  double moved;                   // Fraction of items that move
+  double moved_low;               // Confidence interval of [moved]
+  double moved_high;
+  RendezvousHasherNodeLoad *loads; // Nodes before and after the
+  size_t load_count;               // change, sorted by id
+} RendezvousHasherEstimate;
+
+// Called by a RendezvousHasherIndex when [item_id] moves from node
+// [from] to node [to]
+typedef void (*RendezvousHasherMoveFn)(RendezvousHasherId item_id,
+                                       RendezvousHasherId from,
+                                       RendezvousHasherId to,
+                                       void *user);
+
+typedef struct {
+  RendezvousHasherId item_id;
+  RendezvousHasherId owner;
+  RendezvousHasherHash score; // Score of [owner] for [item_id]
+  size_t prev;                // Items of the same owner, (size_t) -1
+  size_t next;                // at the ends of the list
+} RendezvousHasherIndexEntry;
+
+// A node that owns items, and the first of them
+typedef struct {
+  RendezvousHasherId id;
+  size_t head;                // (size_t) -1 if the slot is empty
+} RendezvousHasherIndexOwner;
+
+// Reverse index of registered items, with their current owner. Nodes
+// added or removed through the index only rescore what they can
+// change: a new node is scored against each item, the items of a
+// removed node are looked up again
+//
+// Items are found by id through an open addressing map, and the items
+// of each owner are linked in a list: unregistering an item is O(1),
+// removing a node is O(items it owned)
+typedef struct {
+  RendezvousHasher *rh;
+  RendezvousHasherIndexEntry *items;
+  size_t count;
+  size_t capacity;
+  size_t *item_map;           // Item slot + 1, 0 if empty
+  size_t item_map_capacity;
+  RendezvousHasherIndexOwner *owners; // Open addressing, by id
+  size_t owner_count;
+  size_t owner_capacity;
+  RendezvousHasherMoveFn on_move;
+  void *user;
+} RendezvousHasherIndex;
+
+// Returns the failure domain of node [id], for example its rack
+typedef unsigned int (*RendezvousHasherDomainFn)(RendezvousHasherId id,
+                                                 void *user);
+
+// How to place the shards of an item, for example the k + m shards
+// of an erasure coded stripe, on distinct nodes
+typedef struct {
+  size_t shards;
+  // Optional, spread the shards over the failure domains: no domain
+  // gets more than ceil(shards / domains) shards, as long as there
+  // are enough nodes to do so
+  RendezvousHasherDomainFn domain_of;
+  void *user;
+} RendezvousHasherPlacement;
+
+// Bounds and gains of a RendezvousHasherController, zero for the
+// defaults
+typedef struct {
+  unsigned int base_weight; // Weight of the nodes the controller has not
+                            // adjusted yet, 1000 by default
+  unsigned int min_weight;  // base_weight / 10 by default
+  unsigned int max_weight;  // base_weight * 10 by default
+  double gain;              // Fraction of the load error corrected per
+                            // step, in (0, 1], 0.5 by default
+  double max_moved;         // Fraction of the items a step can move,
+                            // 0.05 by default
+} RendezvousHasherControllerConfig;
+
+typedef struct {
+  RendezvousHasherId id;
+  double weight;            // Real valued, rounded for the hasher
+  double load;              // Sum of the samples since the last step
+  size_t samples;
+} RendezvousHasherControllerNode;
+
+// Feedback controller of the weights of a weighted hasher: the load
+// reported for each node drives its weight toward the mean load
+typedef struct {
+  RendezvousHasher *rh;
+  RendezvousHasherControllerConfig config;
+  RendezvousHasherControllerNode *nodes; // Sorted by id
+  size_t node_count;
+  size_t node_capacity;
+} RendezvousHasherController;
+
+// Options of a RendezvousHasherHotKeys, zero for the defaults
+typedef struct {
+  size_t counters;            // Keys tracked by the sketch, 64 by default
+  unsigned int sample_period; // Lookups per sample on average, 16 by
+                              // default, 1 samples every lookup
+  double threshold;           // Fraction of the sampled lookups that
+                              // makes a key hot, 0.01 by default
+  size_t fan_out;             // Nodes a hot key is spread over, 3 by
+                              // default, up to
+                              // RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX
+  unsigned long decay_period; // Samples after which all the counts are
+                              // halved, 65536 by default
+} RendezvousHasherHotKeysConfig;
+
+// Space-saving counter: [item_id] was seen between count - error and
+// count times
+typedef struct {
+  RendezvousHasherId item_id;
+  unsigned long count;
+  unsigned long error;
+  size_t hot;                 // Slot + 1 in the hot keys, 0 if cold
+} RendezvousHasherHotCounter;
+
+typedef struct {
+  RendezvousHasherId item_id;
+  unsigned long version;      // Of the hasher when [nodes] was filled
+  size_t next;                // Rotation over [nodes]
+  size_t node_count;          // 0 until [nodes] is filled
+  RendezvousHasherId nodes[RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX];
+} RendezvousHasherHotKey;
+
+// Heavy hitter detector in front of a hasher. A sample of the lookups
+// feeds a space-saving sketch, the keys above the threshold are hot:
+// their lookups rotate over their top fan_out nodes, while the other
+// keys keep going to their single node. Lookups change the detector,
+// so each thread needs its own or a lock around it
+typedef struct {
+  RendezvousHasher *rh;
+  RendezvousHasherHotKeysConfig config;
+  RendezvousHasherHotCounter *counters; // Min heap on the count
+  size_t counter_count;
+  size_t *index;              // Counter + 1 of each key, 0 if empty
+  size_t index_capacity;
+  RendezvousHasherHotKey *hot;
+  size_t hot_count;
+  unsigned long sampled;      // Samples since the last decay, halved
+  unsigned long countdown;    // Lookups to the next sample
+  unsigned long long rng;
+} RendezvousHasherHotKeys;
+
+// Type of the leaves of a RendezvousHasherCrush, the nodes items are
+// placed on. Buckets have any other type, for example 1 for hosts, 2
+// for racks and 3 for datacenters
+#define RENDEZVOUS_HASHER_CRUSH_LEAF 0
+
+// A leaf or a bucket of a RendezvousHasherCrush, as it was added
+typedef struct {
+  RendezvousHasherId id;
+  RendezvousHasherId parent;
+  int root;                   // 1 if [parent] is unused
+  unsigned int type;
+  unsigned int weight;        // Leaves only, a bucket weighs as much as
+                              // its children together
+} RendezvousHasherCrushNode;
+
+// Hierarchy of weighted buckets, as in CRUSH. Every level is a
+// straw2 draw, that is the weighted score of the hasher over the
+// children of a bucket, so a weight change only moves items in and
+// out of the buckets on the path of the changed leaf
+//
+// rendezvous_crush_build flattens the tree in breadth first order:
+// the children of a bucket are contiguous, and a descent reads one
+// range of [ids] and [log2_weights] per level
+typedef struct {
+  RendezvousHasherCrushNode *nodes; // In the order they were added
+  size_t node_count;
+  size_t node_capacity;
+  size_t size;                // Of the flat tree, 0 until it is built
+  size_t root_count;          // The roots come first
+  RendezvousHasherId *ids;
+  int *log2_weights;
+  unsigned long long *weights;
+  unsigned int *types;
+  RendezvousHasherPosition *parents;
+  RendezvousHasherPosition *first_child;
+  RendezvousHasherPosition *child_count;
+  RendezvousHasherPosition *by_id; // Positions sorted by id
+} RendezvousHasherCrush;
+
+#define RENDEZVOUS_HASHER_CRUSH_TAKE        0 // Start from bucket [id]
+#define RENDEZVOUS_HASHER_CRUSH_CHOOSE      1 // Pick [count] distinct
+                                              // items of [type] under
+                                              // each current bucket
+#define RENDEZVOUS_HASHER_CRUSH_CHOOSE_LEAF 2 // Like CHOOSE, then a leaf
+                                              // under each of them
+#define RENDEZVOUS_HASHER_CRUSH_EMIT        3 // Output the current items
+
+// A step of a placement rule, see rendezvous_crush_parse
+typedef struct {
+  int op;
+  RendezvousHasherId id;
+  size_t count;
+  unsigned int type;
+} RendezvousHasherCrushStep;
+
 //
 // Function definitions
 //
@@ -181,158 +694,6554 @@ typedef struct {
 // Initializes the Rendezvous Hasher
 RENDEZVOUS_HASHER_DEF int
 rendezvous_init(RendezvousHasher *rh);
+// Initializes the Rendezvous Hasher with [options], which can be
+// NULL. Returns RENDEZVOUS_HASHER_ERROR_UNSUPPORTED if an option needs
+// a module that is not enabled
+//
+// With an engine other than RENDEZVOUS_HASHER_ENGINE_HRW the add,
+// remove and lookup functions keep working, with the movement of
+// that engine:
+//   - jump: removing a node other than the last one added moves the
+//     items of the last one too
+//   - AnchorHash: minimal movement up to engine_size nodes, past it
+//     the buckets double and the items are remapped
+//   - Maglev: the table is rebuilt on every change, a little more
+//     than the minimal movement, at most engine_size - 1 nodes
+// The functions that need HRW scores (weights, top nodes, placement,
+// indexes and hot keys) return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED
+RENDEZVOUS_HASHER_DEF int
+rendezvous_init_options(RendezvousHasher *rh,
+                        const RendezvousHasherOptions *options);
 // Free all allocated memory in the Rendezvous Hasher
 RENDEZVOUS_HASHER_DEF int
 rendezvous_free(RendezvousHasher *rh);
 
+// Initialize [dst] as a copy of [src], sharing the node storage of
+// [src] until either one is modified. O(n / CHUNK_SIZE) time
+// Note: the shared chunks are reference counted without atomics,
+// hashers sharing storage must not be modified concurrently
+RENDEZVOUS_HASHER_DEF int
+rendezvous_clone(RendezvousHasher *dst,
+                 const RendezvousHasher *src);
+
+// Number of nodes in [rh]
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_node_count(const RendezvousHasher *rh);
+
+// Id of the node at [index] in [rh], with index lower than
+// rendezvous_node_count. The order of the nodes is not specified
+RENDEZVOUS_HASHER_DEF RendezvousHasherId
+rendezvous_node_at(const RendezvousHasher *rh,
+                   size_t index);
+
 // Add a node with [id] to the list of nodes of [rh]. O(1) time
 RENDEZVOUS_HASHER_DEF int
 rendezvous_add_node(RendezvousHasher *rh,
                     RendezvousHasherId id);
 
-// Remove node with [id] to the list of nodes of [rh]. O(n) time
+// Remove node with [id] to the list of nodes of [rh]. O(1) expected
+// time, O(n) for the first removal
 RENDEZVOUS_HASHER_DEF int
 rendezvous_remove_node(RendezvousHasher *rh,
                        RendezvousHasherId id);
 
-// Get the [node_id] assigned for [item_id] in [rg]
+// Make room for [node_count] nodes in [rh], so that adding them does
+// not grow the node table or the id map again
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reserve(RendezvousHasher *rh,
+                   size_t node_count);
+
+// Give back the memory [rh] does not need for its current nodes. The
+// nodes are re-packed in id order in chunks not shared with clones,
+// and the id map is rebuilt in the same pass. O(n log n) time
+// Note: the other engines keep the order, jump depends on it
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shrink_to_fit(RendezvousHasher *rh);
+
+// Bytes allocated by [rh], chunks shared with clones included
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_memory_size(const RendezvousHasher *rh);
+
+// Set [index] to the position of a node with [id] in [rh], as used by
+// rendezvous_node_at. O(1) expected time
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if there is no such node
+RENDEZVOUS_HASHER_DEF int
+rendezvous_find_node(RendezvousHasher *rh,
+                     RendezvousHasherId id,
+                     size_t *index);
+
+// Add a node with [id] and [weight] to a weighted hasher, nodes added
+// with rendezvous_add_node have weight 1. A node with weight 0 gets
+// items only if all the nodes have weight 0. O(1) time
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [rh] is not weighted
+RENDEZVOUS_HASHER_DEF int
+rendezvous_add_weighted_node(RendezvousHasher *rh,
+                             RendezvousHasherId id,
+                             unsigned int weight);
+
+// Change the [weight] of node [id], items move only to the node if
+// its weight grows and only away from it if it shrinks. O(1) expected
+// time. A RendezvousHasherIndex over [rh] is not updated, change the
+// weight with rendezvous_index_set_weight instead
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [rh] is not weighted or
+// has no node [id], and RENDEZVOUS_HASHER_ERROR_ALLOC if a chunk
+// shared with a clone could not be copied. [rh] is not changed
+RENDEZVOUS_HASHER_DEF int
+rendezvous_set_weight(RendezvousHasher *rh,
+                      RendezvousHasherId id,
+                      unsigned int weight);
+
+// Get the [node_id] assigned for [item_id] in [rh]
+// Returns RENDEZVOUS_HASHER_ERROR_EMPTY if [rh] has no nodes
 RENDEZVOUS_HASHER_DEF int
 rendezvous_get_node_for(RendezvousHasher *rh,
                         RendezvousHasherId item_id,
                         RendezvousHasherId *node_id);
 
+// Get the nodes assigned to [count] items, [node_ids][i] is set to
+// the node of [item_ids][i]. Items are processed in groups, each chunk
+// of the node table is loaded once per group and scored against all
+// its items, with RENDEZVOUS_HASHER_HASH_N when available
+RENDEZVOUS_HASHER_DEF int
+rendezvous_get_nodes_for(RendezvousHasher *rh,
+                         const RendezvousHasherId *item_ids,
+                         RendezvousHasherId *node_ids,
+                         size_t count);
+
+// Estimate the effect of applying [changes] to [rh] by sampling up to
+// [sample_size] items, either random ids generated from [rng_seed] or
+// keys from [estimate]->keys. [rh] is not modified. See
+// RendezvousHasherEstimate for the options and the results, which
+// must be freed with rendezvous_estimate_free
+RENDEZVOUS_HASHER_DEF int
+rendezvous_estimate_change(RendezvousHasher *rh,
+                           const RendezvousHasherChange *changes,
+                           size_t change_count,
+                           size_t sample_size,
+                           unsigned long long rng_seed,
+                           RendezvousHasherEstimate *estimate);
+// Free the memory allocated by rendezvous_estimate_change
+RENDEZVOUS_HASHER_DEF int
+rendezvous_estimate_free(RendezvousHasherEstimate *estimate);
+
+// Get the [count] nodes with the highest score for [item_id], from
+// the winner down. O(n * count) time
+RENDEZVOUS_HASHER_DEF int
+rendezvous_get_top_nodes(RendezvousHasher *rh,
+                         RendezvousHasherId item_id,
+                         size_t count,
+                         RendezvousHasherId *node_ids);
+
+// Place the shards of [item_id] following [rule]: [shard_nodes][j] is
+// set to the node of shard j. Shards are given to distinct nodes in
+// score order, skipping nodes whose failure domain is full
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place(RendezvousHasher *rh,
+                 const RendezvousHasherPlacement *rule,
+                 RendezvousHasherId item_id,
+                 RendezvousHasherId *shard_nodes);
+// Place [count] items, the shards of [item_ids][i] are written to
+// [shard_nodes] starting at i * rule->shards. The failure domains are
+// computed once for the whole batch
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place_batch(RendezvousHasher *rh,
+                       const RendezvousHasherPlacement *rule,
+                       const RendezvousHasherId *item_ids,
+                       size_t count,
+                       RendezvousHasherId *shard_nodes);
+// Repair the placement [shard_nodes] of [item_id] after [lost_node]
+// is gone: only the shard of [lost_node] moves, to the best node not
+// already in the placement. Its index is stored in [shard], which can
+// be NULL. Placing the item again from scratch would pick the same
+// set of nodes (without failure domains) but could shuffle their
+// shards, so stored items should be repaired instead
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place_repair(RendezvousHasher *rh,
+                        const RendezvousHasherPlacement *rule,
+                        RendezvousHasherId item_id,
+                        RendezvousHasherId *shard_nodes,
+                        RendezvousHasherId lost_node,
+                        size_t *shard);
+
+// Initialize an index of items over the nodes of [rh]. [on_move] is
+// called with [user] for each item that changes owner, it can be NULL
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_init(RendezvousHasherIndex *index,
+                      RendezvousHasher *rh,
+                      RendezvousHasherMoveFn on_move,
+                      void *user);
+// Free the memory of [index], the hasher is not freed
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_free(RendezvousHasherIndex *index);
+
+// Register [item_id] in [index] and set its current [node_id], which
+// can be NULL. O(n) time in the number of nodes
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [item_id] is already
+// registered, [node_id] is set to its owner
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_register(RendezvousHasherIndex *index,
+                          RendezvousHasherId item_id,
+                          RendezvousHasherId *node_id);
+// Remove [item_id] from [index]. O(1) time
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_unregister(RendezvousHasherIndex *index,
+                            RendezvousHasherId item_id);
+// Set [node_id] to the owner of [item_id]. O(1) time
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if it is not registered
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_owner(RendezvousHasherIndex *index,
+                       RendezvousHasherId item_id,
+                       RendezvousHasherId *node_id);
+
+// Add node [id] to the hasher of [index] and notify the items that
+// move to it. O(n) time in the number of items, one score each
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_add_node(RendezvousHasherIndex *index,
+                          RendezvousHasherId id);
+// Change the [weight] of node [id] in the weighted hasher of [index],
+// the items that change owner are notified. O(n) time in the number
+// of items, plus a lookup for each item of the node
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if the hasher is not
+// weighted or has no node [id]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_set_weight(RendezvousHasherIndex *index,
+                            RendezvousHasherId id,
+                            unsigned int weight);
+// Remove node [id] from the hasher of [index], the items it owned are
+// looked up again and notified. O(n) time in the number of items of
+// the node. Returns RENDEZVOUS_HASHER_ERROR_EMPTY, without removing
+// the node, if items would be left without a node
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_remove_node(RendezvousHasherIndex *index,
+                             RendezvousHasherId id);
+
+// Initialize [controller] for the weighted hasher [rh] with [config],
+// which can be NULL. The nodes of [rh] should have the base weight
+// when the controller first sees them
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [rh] is not weighted or
+// the bounds do not contain the base weight
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_init(RendezvousHasherController *controller,
+                           RendezvousHasher *rh,
+                           const RendezvousHasherControllerConfig *config);
+// Free the memory of [controller], the hasher is not freed
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_free(RendezvousHasherController *controller);
+
+// Report a [load] sample of node [id], in any unit as long as it is
+// the same for all the nodes
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [id] is not in the hasher
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_report(RendezvousHasherController *controller,
+                             RendezvousHasherId id,
+                             double load);
+
+// Move the weights of the nodes with samples toward the mean load:
+// each weight is scaled by 1 + gain * (mean - load) / load, within the
+// bounds. If the new weights would move more than max_moved of the
+// items, all the changes are scaled down together. The samples are
+// then cleared. The estimated fraction of items moved is stored in
+// [moved], which can be NULL
+// Returns the first error of rendezvous_set_weight, the nodes it
+// failed for keep their weight and samples
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_step(RendezvousHasherController *controller,
+                           double *moved);
+
+// Initialize [hot] in front of [rh] with [config], which can be NULL
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID for a fan out above
+// RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX or a threshold above 1
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_init(RendezvousHasherHotKeys *hot,
+                    RendezvousHasher *rh,
+                    const RendezvousHasherHotKeysConfig *config);
+// Free the memory of [hot], the hasher is not freed
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_free(RendezvousHasherHotKeys *hot);
+
+// Like rendezvous_get_node_for, the lookup may be sampled. A hot key
+// gets the next of its top nodes, a cold key its usual node. Without
+// hot keys the cost over rendezvous_get_node_for is a decrement, a
+// sample costs O(log counters + hot keys). Not thread safe, even
+// though it only reads the hasher
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_get_node_for(RendezvousHasherHotKeys *hot,
+                            RendezvousHasherId item_id,
+                            RendezvousHasherId *node_id);
+
+// Returns 1 if [item_id] is currently hot, 0 otherwise
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_is_hot(const RendezvousHasherHotKeys *hot,
+                      RendezvousHasherId item_id);
+
+// Initialize an empty hierarchy [crush]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_init(RendezvousHasherCrush *crush);
+// Free the memory of [crush]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_free(RendezvousHasherCrush *crush);
+
+// Add a leaf or a bucket with [id] and [type] under the bucket
+// [parent], or as a root if [parent] is NULL. [weight] is used only
+// by leaves. The parent does not need to exist yet, the tree is
+// checked by rendezvous_crush_build. Bucket and leaf ids share the
+// same space
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_add(RendezvousHasherCrush *crush,
+                     const RendezvousHasherId *parent,
+                     RendezvousHasherId id,
+                     unsigned int type,
+                     unsigned int weight);
+
+// Flatten the nodes added so far, must be called after adding nodes
+// and before selecting. Returns RENDEZVOUS_HASHER_ERROR_INVALID if an
+// id is duplicated, a parent does not exist or is a leaf, or a node
+// is not reachable from a root
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_build(RendezvousHasherCrush *crush);
+
+// Change the [weight] of the leaf [id] and of the buckets above it,
+// without a build. A leaf of weight 0 is never selected
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [id] is not a leaf of
+// the built tree
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_set_weight(RendezvousHasherCrush *crush,
+                            RendezvousHasherId id,
+                            unsigned int weight);
+
+// Parse a placement rule from [text] into up to [capacity] [steps],
+// and set [step_count]. Steps are separated by ';' or new lines:
+//
+//    take <id>
+//    choose <count> type <type>
+//    chooseleaf <count> type <type>
+//    emit
+//
+// For example "take 1; chooseleaf 3 type 2; emit" places three
+// replicas in three distinct racks of type 2 under the bucket 1
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID on a syntax error or if
+// there are more than [capacity] steps
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_parse(const char *text,
+                       RendezvousHasherCrushStep *steps,
+                       size_t capacity,
+                       size_t *step_count);
+
+// Run the rule of [step_count] [steps] for [item_id], the emitted
+// ids are written to [ids] and their number to [count]. A choose step
+// may pick fewer items than asked if the tree has not enough of them
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if the tree is not built,
+// a take names no bucket, more than RENDEZVOUS_HASHER_CRUSH_MAX_SELECT
+// items are current at once, or more than [capacity] are emitted
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_select(const RendezvousHasherCrush *crush,
+                        const RendezvousHasherCrushStep *steps,
+                        size_t step_count,
+                        RendezvousHasherId item_id,
+                        RendezvousHasherId *ids,
+                        size_t capacity,
+                        size_t *count);
+
 #ifdef RENDEZVOUS_HASHER_HASHES
 
 // Hash function for unsigned int keys
 RENDEZVOUS_HASHER_DEF unsigned int
 rendezvous_hasher_hash_uint32(unsigned int a);
+// Hash [n] keys from [in] into [out], with the same results as
+// rendezvous_hasher_hash_uint32
+RENDEZVOUS_HASHER_DEF void
+rendezvous_hasher_hash_uint32_n(const unsigned int *in,
+                                unsigned int *out,
+                                size_t n);
+
+// Hash function for unsigned int keys, the finalizer of MurmurHash3.
+// Used by default with RENDEZVOUS_HASHER_HASH_FMIX32
+RENDEZVOUS_HASHER_DEF unsigned int
+rendezvous_hasher_hash_fmix32(unsigned int h);
+// Hash [n] keys from [in] into [out], with the same results as
+// rendezvous_hasher_hash_fmix32
+RENDEZVOUS_HASHER_DEF void
+rendezvous_hasher_hash_fmix32_n(const unsigned int *in,
+                                unsigned int *out,
+                                size_t n);
 
 #endif // RENDEZVOUS_HASHER_HASHES
 
-//
-// Implementation
-//
+#ifdef RENDEZVOUS_HASHER_REPLICAS
 
-#ifdef RENDEZVOUS_HASHER_IMPLEMENTATION
+// Single producer, single consumer queue of membership updates. The
+// producer and the consumer indexes live on separate cache lines
+typedef struct {
+  RendezvousHasherChange ops[RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE];
+  size_t tail; // Written by the producer
+  char pad[RENDEZVOUS_HASHER_CACHE_LINE - sizeof(size_t)];
+  size_t head; // Written by the consumer
+} RendezvousHasherReplicaQueue;
 
-RENDEZVOUS_HASHER_DEF int rendezvous_init(RendezvousHasher *rh)
-{
-  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
-  rh->nodes = NULL;
-  return RENDEZVOUS_HASHER_OK;
-}
+// The private hasher of a core, allocated by the core itself so that
+// its memory is local to the core (first touch)
+typedef struct {
+  char pad[RENDEZVOUS_HASHER_CACHE_LINE];
+  RendezvousHasher rh;
+  RendezvousHasherReplicaQueue queue;
+} RendezvousHasherReplica;
 
-RENDEZVOUS_HASHER_DEF int rendezvous_free(RendezvousHasher *rh)
-{
-  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+// A hasher replicated on [count] cores. Lookups on a core read only
+// its own replica, membership updates are broadcast to every replica
+// and applied by each core when it calls rendezvous_replicas_quiesce
+typedef struct {
+  RendezvousHasher master;
+  RendezvousHasherReplica **replicas;
+  size_t count;
+  int lock; // Serializes the producers
+} RendezvousHasherReplicas;
 
-  RendezvousHasherNodeList *it = rh->nodes;
-  while (it)
-  {
-    RendezvousHasherNodeList *next = it->next;
-    RENDEZVOUS_HASHER_FREE(it);
-    it = next;
-  }
-  rh->nodes = NULL;
-  
-  return RENDEZVOUS_HASHER_OK;
-}
+// Initialize [replicas] for [count] cores
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_init(RendezvousHasherReplicas *replicas,
+                         size_t count);
+// Free [replicas], no core may be using them
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_free(RendezvousHasherReplicas *replicas);
 
+// Create the replica of [core] with the current nodes, must be called
+// by the thread running on [core] before using it
 RENDEZVOUS_HASHER_DEF int
-rendezvous_add_node(RendezvousHasher *rh,
-                    RendezvousHasherId id)
-{
-  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+rendezvous_replicas_attach(RendezvousHasherReplicas *replicas,
+                           size_t core);
 
-  RendezvousHasherNodeList *new_node =
-    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherNodeList));
-  new_node->next = rh->nodes;
-  new_node->id = id;
-  rh->nodes = new_node;
-  
-  return RENDEZVOUS_HASHER_OK;
-}
+// Broadcast the addition of node [id] to every replica. Returns
+// RENDEZVOUS_HASHER_ERROR_BUSY, without changing anything, if the
+// queue of a replica is full
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_add_node(RendezvousHasherReplicas *replicas,
+                             RendezvousHasherId id);
+// Broadcast the removal of node [id] to every replica, see
+// rendezvous_replicas_add_node
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_remove_node(RendezvousHasherReplicas *replicas,
+                                RendezvousHasherId id);
 
+// Apply the pending updates to the replica of [core], must be called
+// by the thread running on [core] when it holds no results of
+// previous lookups it wants to stay stable
 RENDEZVOUS_HASHER_DEF int
-rendezvous_remove_node(RendezvousHasher *rh,
-                       RendezvousHasherId id)
-{
-  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
-  if (!rh->nodes) return RENDEZVOUS_HASHER_OK;
+rendezvous_replicas_quiesce(RendezvousHasherReplicas *replicas,
+                            size_t core);
 
-  RendezvousHasherNodeList *it = rh->nodes;
-  RendezvousHasherNodeList *prev = NULL;
-  _Bool found = 0;
-  while (it)
-  {
-    if (it->id == id)
-    {
-      found = 1;
-      break;
-    }
-    prev = it;
-    it = it->next;
-  }
+// Get the [node_id] assigned for [item_id] by the replica of [core]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_get_node_for(RendezvousHasherReplicas *replicas,
+                                 size_t core,
+                                 RendezvousHasherId item_id,
+                                 RendezvousHasherId *node_id);
 
-  if (found)
-  {
-    if (prev == NULL)
-    {
-      free(rh->nodes);
-      rh->nodes = NULL;
-    }
-    else
-    {
-      prev->next = it->next;
-      free(it);
-    }
-  }
-  
-  return RENDEZVOUS_HASHER_OK;
-}
+#endif // RENDEZVOUS_HASHER_REPLICAS
+
+#ifdef RENDEZVOUS__ARENA
 
+// Size of the smallest pages backing the node table of [rh], as
+// reported by the kernel, or 0 if [rh] has no nodes. Transparent huge
+// pages are only counted when they back a whole block of the table
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_page_size(const RendezvousHasher *rh);
+
+#endif // RENDEZVOUS__ARENA
+
+#ifdef RENDEZVOUS_HASHER_NUMA
+
+// One hasher per NUMA node, each with its node table in the memory of
+// its node. Membership changes are applied to every replica, lookups
+// read the replica of the NUMA node of the calling CPU. Like a
+// RendezvousHasher, changes must not run concurrently with lookups
+typedef struct {
+  RendezvousHasher **replicas; // Indexed by NUMA node, NULL for the
+  size_t count;                // nodes the process can not use
+} RendezvousHasherNuma;
+
+// Number of NUMA nodes the process can allocate memory on, counting
+// the unusable ones below the highest usable node. At least 1
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_numa_node_count(void);
+
+// Initialize [numa] with a replica on each usable NUMA node
 RENDEZVOUS_HASHER_DEF int
-rendezvous_get_node_for(RendezvousHasher *rh,
-                        RendezvousHasherId item_id,
-                        RendezvousHasherId *node_id)
-{
-  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
-  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
-  
-  RendezvousHasherNodeList *it = rh->nodes;
-  RendezvousHasherHash max_hash = 0;
-  RendezvousHasherId chosen_node_id = {0};
-  while(it)
-  {
-    RendezvousHasherId node_id = it->id;
-    RendezvousHasherId id_sum = node_id + item_id;
-    RendezvousHasherHash id_sum_hash = RENDEZVOUS_HASHER_HASH(id_sum);
-    if (id_sum_hash > max_hash)
-    {
-      max_hash = id_sum_hash;
-      chosen_node_id = node_id;
-    }
-    it = it->next;
-  }
+rendezvous_numa_init(RendezvousHasherNuma *numa);
+// Free all the replicas of [numa]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_free(RendezvousHasherNuma *numa);
 
-  *node_id = chosen_node_id;
-  return RENDEZVOUS_HASHER_OK;
-}
+// Add node [id] to every replica, or to none on error
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_add_node(RendezvousHasherNuma *numa,
+                         RendezvousHasherId id);
+// Remove node [id] from every replica
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_remove_node(RendezvousHasherNuma *numa,
+                            RendezvousHasherId id);
 
-#ifdef RENDEZVOUS_HASHER_HASHES
+// The replica local to the calling CPU. Threads pinned to a CPU can
+// keep it and skip the CPU lookup of rendezvous_numa_get_node_for
+RENDEZVOUS_HASHER_DEF RendezvousHasher *
+rendezvous_numa_local(RendezvousHasherNuma *numa);
+
+// Get the [node_id] assigned for [item_id] by the local replica
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_get_node_for(RendezvousHasherNuma *numa,
+                             RendezvousHasherId item_id,
+                             RendezvousHasherId *node_id);
+
+#endif // RENDEZVOUS_HASHER_NUMA
+
+#ifdef RENDEZVOUS_HASHER_JOURNAL
+
+// Options of a RendezvousHasherJournal, zero for the defaults
+typedef struct {
+  size_t group_size;          // Records written and synced together, 64
+                              // by default, 1 syncs every record
+  unsigned long group_delay_ms; // Age of the oldest pending record that
+                              // makes the next change sync the group,
+                              // 10 by default
+  size_t compact_records;     // Records in the journal that trigger a
+                              // compaction, 65536 by default
+} RendezvousHasherJournalConfig;
+
+// Append-only log of the membership changes of a hasher, next to a
+// snapshot of its nodes and of the state of its engine. The journal
+// is the file [path], the snapshot is [path].snap. Every record is
+// checksummed: damaged records in the last group of the journal are a
+// torn write and are dropped when it is opened again, anywhere else
+// they make the open fail
+//
+// Records are written and synced in groups. A group is synced when it
+// is full, when a change comes group_delay_ms after its first record,
+// and by rendezvous_journal_flush and rendezvous_journal_sync. A crash
+// loses at most the changes of the group that was not synced yet
+typedef struct {
+  RendezvousHasher *rh;
+  RendezvousHasherJournalConfig config;
+  char *snapshot_path;
+  char *temp_path;            // The snapshot being written
+  int fd;
+  int dir_fd;                 // Synced after a rename in it
+  unsigned long long seq;     // Of the last record
+  size_t records;             // In the journal file
+  unsigned char *group;       // Records not written yet
+  size_t pending;
+  unsigned long long since;   // Monotonic time, in ms, of the first
+                              // pending record
+} RendezvousHasherJournal;
+
+// Load the snapshot and replay the journal at [path] into the empty
+// hasher [rh], created with the same options as the one that wrote
+// them, then journal its changes. Missing files are created. [config]
+// can be NULL
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [rh] has nodes, the files
+// belong to a different kind of hasher or they are damaged, and
+// RENDEZVOUS_HASHER_ERROR_IO if they cannot be read or written
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_open(RendezvousHasherJournal *journal,
+                        RendezvousHasher *rh,
+                        const char *path,
+                        const RendezvousHasherJournalConfig *config);
+// Sync the pending records and close [journal], the hasher is not
+// freed
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_close(RendezvousHasherJournal *journal);
+
+// Change the hasher of [journal] like rendezvous_add_node,
+// rendezvous_add_weighted_node, rendezvous_remove_node and
+// rendezvous_set_weight, and record the change if it succeeds
+// Returns RENDEZVOUS_HASHER_ERROR_IO, without changing the hasher, if
+// the pending group cannot be written to make room, and
+// RENDEZVOUS_HASHER_ERROR_UNSYNCED if the change was made but the sync
+// of its group failed: the group stays pending and is written again
+// by the next sync. A failed automatic compaction is tried again on
+// the next change, rendezvous_journal_compact returns its error
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_add_node(RendezvousHasherJournal *journal,
+                            RendezvousHasherId id);
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_add_weighted_node(RendezvousHasherJournal *journal,
+                                     RendezvousHasherId id,
+                                     unsigned int weight);
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_remove_node(RendezvousHasherJournal *journal,
+                               RendezvousHasherId id);
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_set_weight(RendezvousHasherJournal *journal,
+                              RendezvousHasherId id,
+                              unsigned int weight);
+
+// Write and sync the pending records, for example when the process
+// is idle or before acknowledging a change
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_sync(RendezvousHasherJournal *journal);
+// Sync the pending records if the first of them is group_delay_ms
+// old. Without it a group waits for the next change: call it from a
+// timer or an event loop about every group_delay_ms to bound the time
+// a change stays unsynced
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_flush(RendezvousHasherJournal *journal);
+
+// Replace the snapshot with the current nodes and the state of the
+// engine, and empty the journal. The new snapshot is renamed over the
+// old one, so a crash leaves either of them with a journal that
+// completes it
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_compact(RendezvousHasherJournal *journal);
+
+#endif // RENDEZVOUS_HASHER_JOURNAL
+
+#ifdef RENDEZVOUS_HASHER_RELOAD
+
+// An immutable hasher published by a RendezvousHasherReload
+typedef struct RendezvousHasherSnapshot {
+  RendezvousHasher rh;
+  unsigned long version;
+  unsigned long retired;      // Epoch that replaced it, 0 if current
+  struct RendezvousHasherSnapshot *next; // In the retired list
+} RendezvousHasherSnapshot;
+
+// What changed between two snapshots, valid during the callback
+typedef struct {
+  RendezvousHasher *before;
+  RendezvousHasher *after;
+  unsigned long version;      // Of [after]
+  const RendezvousHasherId *added;
+  size_t added_count;
+  const RendezvousHasherId *removed;
+  size_t removed_count;
+  const RendezvousHasherId *reweighted;
+  size_t reweighted_count;
+  const size_t *moved_slots;  // Slots whose node changed, in order
+  size_t moved_slot_count;
+} RendezvousHasherReloadDiff;
+
+// Called by a RendezvousHasherReload after it published a snapshot
+typedef void (*RendezvousHasherReloadFn)(const RendezvousHasherReloadDiff *diff,
+                                         void *user);
+
+// Options of a RendezvousHasherReload, zero for the defaults
+typedef struct {
+  size_t slot_count;          // Slots checked for moves: slot s is the
+                              // item id s, for caches sharded in slots.
+                              // 0 by default, no slots
+  RendezvousHasherReloadFn on_reload; // Optional
+  void *user;
+  size_t max_readers;         // Readers registered at once, 64 by
+                              // default
+} RendezvousHasherReloadConfig;
+
+// Epoch announced by a reader, alone in its cache line
+typedef struct {
+  unsigned long epoch;        // When it took its snapshot, 0 if none
+  int used;
+  char pad[RENDEZVOUS_HASHER_CACHE_LINE - sizeof(unsigned long) - sizeof(int)];
+} RendezvousHasherReloadSlot;
+
+// Hashers built from a membership file and published to readers. The
+// file has one node per line, its id and, for weighted hashers, its
+// weight (1 if missing). Blank lines and text after a '#' are skipped
+//
+// The file is watched with inotify, through its directory so that a
+// file replaced by a rename is seen too. The thread calling
+// rendezvous_reload_poll parses it and builds the new snapshot, then
+// swaps it in: readers are never blocked, and keep the snapshot they
+// acquired until they release it
+//
+// Snapshots are reclaimed by epochs. Every publish advances the epoch,
+// and a reader announces the epoch it entered in its own slot: a
+// replaced snapshot is freed once no reader announces an older epoch
+typedef struct {
+  RendezvousHasherOptions options;
+  RendezvousHasherReloadConfig config;
+  char *path;                 // Followed by its directory
+  const char *name;           // Of the file in its directory
+  int inotify_fd;
+  RendezvousHasherSnapshot *current;
+  RendezvousHasherSnapshot *retired; // Replaced, freed when unused
+  RendezvousHasherReloadSlot *slots; // Of the readers, max_readers
+  void *slot_memory;          // [slots] before the alignment
+  unsigned long epoch;
+  unsigned long version;
+} RendezvousHasherReload;
+
+// A thread reading the snapshots of a RendezvousHasherReload. Each
+// thread has its own, so lookups write only to its slot
+typedef struct {
+  RendezvousHasherReload *reload;
+  RendezvousHasherReloadSlot *slot;
+} RendezvousHasherReloadReader;
+
+// Initialize [reload] with the file at [path], which must exist and
+// parse, and hashers created with [options]. [options] and [config]
+// can be NULL
+// Returns RENDEZVOUS_HASHER_ERROR_IO if the file cannot be read or
+// watched, and RENDEZVOUS_HASHER_ERROR_INVALID if it does not parse,
+// has an id out of the range of RendezvousHasherId or has the same id
+// twice
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_init(RendezvousHasherReload *reload,
+                       const char *path,
+                       const RendezvousHasherOptions *options,
+                       const RendezvousHasherReloadConfig *config);
+// Free [reload] and its snapshots, its readers must be freed first
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_free(RendezvousHasherReload *reload);
+
+// Register [reader] with [reload], for one thread
+// Returns RENDEZVOUS_HASHER_ERROR_BUSY if max_readers are registered
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_reader_init(RendezvousHasherReloadReader *reader,
+                              RendezvousHasherReload *reload);
+// Unregister [reader], which must not hold a snapshot
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_reader_free(RendezvousHasherReloadReader *reader);
+
+// Wait up to [timeout_ms] for the file to change (-1 for ever) and
+// reload it if it did, or if inotify dropped events. Also frees the
+// replaced snapshots that no reader can hold anymore. Must be called
+// by one thread at a time
+// Returns like rendezvous_reload_now, the current snapshot is kept
+// if the file does not parse
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_poll(RendezvousHasherReload *reload,
+                       int timeout_ms);
+
+// Read the file and publish a new snapshot if the nodes changed, for
+// example on SIGHUP. Must not run concurrently with
+// rendezvous_reload_poll
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_now(RendezvousHasherReload *reload);
+
+// The current snapshot, held by [reader] until
+// rendezvous_reload_release. Wait free, a load and a store to the
+// slot of the reader; a reader holds one snapshot at a time
+RENDEZVOUS_HASHER_DEF RendezvousHasherSnapshot *
+rendezvous_reload_acquire(RendezvousHasherReloadReader *reader);
+RENDEZVOUS_HASHER_DEF void
+rendezvous_reload_release(RendezvousHasherReloadReader *reader);
+
+// rendezvous_get_node_for on the current snapshot
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_get_node_for(RendezvousHasherReloadReader *reader,
+                               RendezvousHasherId item_id,
+                               RendezvousHasherId *node_id);
+
+// Returns 1 if [item_id] changed node in [diff], 0 otherwise
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_moved(const RendezvousHasherReloadDiff *diff,
+                        RendezvousHasherId item_id);
+
+#endif // RENDEZVOUS_HASHER_RELOAD
+
+#ifdef RENDEZVOUS_HASHER_SHARED
+
+// A segment of shared memory with the node table of a hasher, written
+// by one publisher process and read by any number of worker processes
+//
+// The segment holds two tables at fixed offsets, so it can be mapped
+// at any address. The publisher writes the table that is not current
+// and then bumps the generation of the segment, workers look up items
+// directly in the mapping: every lookup reads the current table and
+// is retried if the publisher rewrote it in the meantime. Workers
+// never block the publisher, and see a publish as soon as it is done
+//
+// Each table can also hold the node of every slot in [0, slot_count),
+// slot s being item id s, for caches sharded in slots: those lookups
+// are O(1) and work for hashers of any engine. Item lookups scan the
+// node table, they need hashers with the HRW engine
+typedef struct {
+  int fd;
+  int owned;                  // [fd] is closed by rendezvous_shared_close
+  int writable;               // Of the publisher
+  unsigned char *base;        // The mapping
+  size_t size;
+  size_t capacity;            // Nodes per table
+  size_t slot_count;
+} RendezvousHasherShared;
+
+// Create a segment for hashers of up to [capacity] nodes, with
+// [slot_count] slots (0 for none), and map it for publishing. With
+// [path] NULL the segment is an anonymous memfd, shared with workers
+// forked after this call or through its fd, otherwise it is the file
+// at [path], usually under /dev/shm, created or truncated
+// Returns RENDEZVOUS_HASHER_ERROR_IO if the segment cannot be created
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_create(RendezvousHasherShared *shared,
+                         const char *path,
+                         size_t capacity,
+                         size_t slot_count);
+// Map read only the segment of [fd], which stays owned by the caller
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if it is not a segment made
+// by rendezvous_shared_create with the same id type
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_attach(RendezvousHasherShared *shared,
+                         int fd);
+// Map read only the segment at [path]
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_open(RendezvousHasherShared *shared,
+                       const char *path);
+// Unmap [shared], the segment lives until every process closed it
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_close(RendezvousHasherShared *shared);
+
+// Write the nodes of [rh] and its slots to the segment and make them
+// current. Must be called by one thread of the publisher at a time
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [rh] has more nodes than
+// the capacity or [shared] is not writable, and
+// RENDEZVOUS_HASHER_ERROR_UNSUPPORTED if [rh] does not use the HRW
+// engine and the segment has no slots
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_publish(RendezvousHasherShared *shared,
+                          RendezvousHasher *rh);
+
+// Number of publishes so far, 0 before the first one
+RENDEZVOUS_HASHER_DEF unsigned long long
+rendezvous_shared_generation(const RendezvousHasherShared *shared);
+// Nodes of the current table
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_shared_node_count(const RendezvousHasherShared *shared);
+
+// rendezvous_get_node_for on the current table, lock free
+// Returns RENDEZVOUS_HASHER_ERROR_EMPTY if it has no nodes and
+// RENDEZVOUS_HASHER_ERROR_UNSUPPORTED if it was published from a
+// hasher with an engine other than HRW
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_get_node_for(const RendezvousHasherShared *shared,
+                               RendezvousHasherId item_id,
+                               RendezvousHasherId *node_id);
+// Node of [slot] in the current table, lock free
+// Returns RENDEZVOUS_HASHER_ERROR_INVALID if [slot] is out of range
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_get_node_for_slot(const RendezvousHasherShared *shared,
+                                    size_t slot,
+                                    RendezvousHasherId *node_id);
+
+#endif // RENDEZVOUS_HASHER_SHARED
+
+//
+// Implementation
+//
+
+#ifdef RENDEZVOUS_HASHER_IMPLEMENTATION
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void rendezvous__bind(RendezvousHasher *rh);
+static int rendezvous__engine_create(RendezvousHasher *rh,
+                                     int engine,
+                                     size_t size);
+static int rendezvous__engine_copy(RendezvousHasher *dst,
+                                   const RendezvousHasher *src);
+static void rendezvous__engine_free(RendezvousHasher *rh);
+
+// USDT probes of the "rendezvous_hasher" provider, for bpftrace or
+// perf. When RENDEZVOUS_HASHER_USDT is not defined they expand to
+// nothing, otherwise each one is a single nop until a tracer
+// attaches to it:
+//
+//  lookup_entry(rh, item_id)
+//  lookup_return(rh, item_id, node_id, nodes scanned)
+//  lookup_batch_entry(rh, count)
+//  lookup_batch_return(rh, count, nodes scanned per item)
+//
+// The nodes scanned are the nodes scored by HRW, the jumps of jump,
+// the buckets visited by AnchorHash and 1 for Maglev
+//  node_add(rh, node_id, node count after)
+//  node_remove(rh, node_id, node count after)
+//  replica_quiesce(replicas, core, updates applied)
+//  snapshot_publish(reload, version, node count, slots moved)
+//  shared_publish(shared, generation, node count, slots moved)
+//
+// See examples/lookup-latency.bt
+#ifdef RENDEZVOUS_HASHER_USDT
+  #include <sys/sdt.h>
+  #define RENDEZVOUS__PROBE2(name, a, b) \
+    DTRACE_PROBE2(rendezvous_hasher, name, a, b)
+  #define RENDEZVOUS__PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(rendezvous_hasher, name, a, b, c)
+  #define RENDEZVOUS__PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4(rendezvous_hasher, name, a, b, c, d)
+#else
+  // The arguments are not evaluated
+  #define RENDEZVOUS__PROBE2(name, a, b) \
+    ((void) sizeof(a), (void) sizeof(b))
+  #define RENDEZVOUS__PROBE3(name, a, b, c) \
+    (RENDEZVOUS__PROBE2(name, a, b), (void) sizeof(c))
+  #define RENDEZVOUS__PROBE4(name, a, b, c, d) \
+    (RENDEZVOUS__PROBE3(name, a, b, c), (void) sizeof(d))
+#endif
+
+RENDEZVOUS_HASHER_DEF int rendezvous_init(RendezvousHasher *rh)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  rh->chunks = NULL;
+  rh->chunk_count = 0;
+  rh->chunk_capacity = 0;
+  rh->node_count = 0;
+  rh->version = 0;
+  rh->arena = NULL;
+  rh->weighted = 0;
+  rh->id_map = NULL;
+  rh->id_map_capacity = 0;
+  rh->engine = RENDEZVOUS_HASHER_ENGINE_HRW;
+  rh->engine_state = NULL;
+  rh->lookup = NULL;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+#ifdef RENDEZVOUS__ARENA
+struct RendezvousHasherArena {
+  unsigned int refs; // Hashers and chunks using the arena
+  int numa_node;     // -1 for no binding
+  int huge_pages;
+  size_t slab_size;
+  size_t slot_size;  // Of a chunk, with its weights if weighted
+  size_t page_size;  // Smallest pages of the slabs, 0 without slabs
+  void *slabs;       // Mapped slabs, linked through their first word
+  void *free_chunks; // Free slots, linked through their first word
+};
+
+static int rendezvous__arena_create(RendezvousHasherArena **arena,
+                                    const RendezvousHasherOptions *options);
+static void rendezvous__arena_release(RendezvousHasherArena *arena);
+static RendezvousHasherChunk *
+rendezvous__arena_chunk_alloc(RendezvousHasherArena *arena);
+static void rendezvous__arena_chunk_free(RendezvousHasherArena *arena,
+                                         RendezvousHasherChunk *chunk);
+static void *rendezvous__arena_alloc(RendezvousHasherArena *arena,
+                                     size_t size);
+static void rendezvous__arena_free(void *p, size_t size);
+#endif // RENDEZVOUS__ARENA
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_init_options(RendezvousHasher *rh,
+                        const RendezvousHasherOptions *options)
+{
+  int err = rendezvous_init(rh);
+  if (err != RENDEZVOUS_HASHER_OK || !options) return err;
+
+  if (options->engine < RENDEZVOUS_HASHER_ENGINE_HRW
+      || options->engine > RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  rh->weighted = (options->flags & RENDEZVOUS_HASHER_OPTION_WEIGHTED) != 0;
+  if (rh->weighted && options->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+
+  if (options->flags & (RENDEZVOUS_HASHER_OPTION_NUMA
+                        | RENDEZVOUS_HASHER_OPTION_HUGE_PAGES))
+  {
+#ifdef RENDEZVOUS__ARENA
+    err = rendezvous__arena_create(&rh->arena, options);
+    if (err != RENDEZVOUS_HASHER_OK) return err;
+#else
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+#endif
+  }
+
+  err = rendezvous__engine_create(rh, options->engine, options->engine_size);
+  if (err != RENDEZVOUS_HASHER_OK) rendezvous_free(rh);
+  return err;
+}
+
+static RendezvousHasherChunk *rendezvous__chunk_alloc(RendezvousHasher *rh)
+{
+  RendezvousHasherChunk *chunk;
+#ifdef RENDEZVOUS__ARENA
+  if (rh->arena)
+    chunk = rendezvous__arena_chunk_alloc(rh->arena);
+  else
+#endif
+    chunk = (RendezvousHasherChunk *)
+      RENDEZVOUS_HASHER_MALLOC(RENDEZVOUS_HASHER_CHUNK_BYTES(rh->weighted));
+  if (!chunk) return NULL;
+  chunk->arena = rh->arena;
+  chunk->refs = 1;
+  return chunk;
+}
+
+static void rendezvous__chunk_release(RendezvousHasherChunk *chunk)
+{
+  if (--chunk->refs != 0) return;
+#ifdef RENDEZVOUS__ARENA
+  if (chunk->arena)
+  {
+    rendezvous__arena_chunk_free(chunk->arena, chunk);
+    return;
+  }
+#endif
+  RENDEZVOUS_HASHER_FREE(chunk);
+}
+
+// Array of [capacity] chunk pointers, from the allocator of [rh]
+static RendezvousHasherChunk **
+rendezvous__chunks_alloc(RendezvousHasher *rh, size_t capacity)
+{
+  size_t size = capacity * sizeof(RendezvousHasherChunk *);
+#ifdef RENDEZVOUS__ARENA
+  if (rh->arena)
+    return (RendezvousHasherChunk **) rendezvous__arena_alloc(rh->arena, size);
+#else
+  (void) rh;
+#endif
+  return (RendezvousHasherChunk **) RENDEZVOUS_HASHER_MALLOC(size);
+}
+
+// Free an array of [capacity] chunk pointers from rendezvous__chunks_alloc
+static void rendezvous__chunks_release(RendezvousHasher *rh,
+                                       RendezvousHasherChunk **chunks,
+                                       size_t capacity)
+{
+  if (!chunks) return;
+#ifdef RENDEZVOUS__ARENA
+  if (rh->arena)
+  {
+    rendezvous__arena_free(chunks, capacity * sizeof(RendezvousHasherChunk *));
+    return;
+  }
+#else
+  (void) rh;
+  (void) capacity;
+#endif
+  RENDEZVOUS_HASHER_FREE(chunks);
+}
+
+static void rendezvous__chunks_free(RendezvousHasher *rh)
+{
+  rendezvous__chunks_release(rh, rh->chunks, rh->chunk_capacity);
+}
+
+RENDEZVOUS_HASHER_DEF int rendezvous_free(RendezvousHasher *rh)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  for (size_t i = 0; i < rh->chunk_count; ++i)
+    rendezvous__chunk_release(rh->chunks[i]);
+  rendezvous__chunks_free(rh);
+  if (rh->id_map) RENDEZVOUS_HASHER_FREE(rh->id_map);
+  rendezvous__engine_free(rh);
+#ifdef RENDEZVOUS__ARENA
+  if (rh->arena) rendezvous__arena_release(rh->arena);
+#endif
+  
+  return rendezvous_init(rh);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_clone(RendezvousHasher *dst,
+                 const RendezvousHasher *src)
+{
+  if (!dst || !src) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  rendezvous_init(dst);
+  dst->weighted = src->weighted;
+#ifdef RENDEZVOUS__ARENA
+  // The arena is shared, copies of the chunks come from it too
+  dst->arena = src->arena;
+  if (dst->arena) dst->arena->refs++;
+#endif
+  // The engine state is copied, O(engine_size) for AnchorHash and
+  // Maglev
+  if (rendezvous__engine_copy(dst, src) != RENDEZVOUS_HASHER_OK)
+  {
+    rendezvous_free(dst);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  if (src->chunk_count == 0) return RENDEZVOUS_HASHER_OK;
+
+  dst->chunks = rendezvous__chunks_alloc(dst, src->chunk_count);
+  if (!dst->chunks)
+  {
+    rendezvous_free(dst);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+
+  for (size_t i = 0; i < src->chunk_count; ++i)
+  {
+    dst->chunks[i] = src->chunks[i];
+    dst->chunks[i]->refs++;
+  }
+  dst->chunk_count = src->chunk_count;
+  dst->chunk_capacity = src->chunk_count;
+  dst->node_count = src->node_count;
+  dst->version = src->version;
+  dst->weighted = src->weighted;
+  rendezvous__bind(dst);
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_node_count(const RendezvousHasher *rh)
+{
+  return rh ? rh->node_count : 0;
+}
+
+RENDEZVOUS_HASHER_DEF RendezvousHasherId
+rendezvous_node_at(const RendezvousHasher *rh,
+                   size_t index)
+{
+  return rh->chunks[index / RENDEZVOUS_HASHER_CHUNK_SIZE]
+    ->ids[index % RENDEZVOUS_HASHER_CHUNK_SIZE];
+}
+
+// Make sure chunk [c] is not shared before writing to it
+static int rendezvous__chunk_own(RendezvousHasher *rh, size_t c)
+{
+  RendezvousHasherChunk *chunk = rh->chunks[c];
+  if (chunk->refs == 1) return RENDEZVOUS_HASHER_OK;
+
+  RendezvousHasherChunk *copy = rendezvous__chunk_alloc(rh);
+  if (!copy) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  memcpy(copy->ids, chunk->ids, sizeof(chunk->ids));
+  if (rh->weighted)
+    memcpy(copy->log2_weights, chunk->log2_weights,
+           RENDEZVOUS_HASHER_CHUNK_SIZE * sizeof(int));
+  chunk->refs--;
+  rh->chunks[c] = copy;
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Move the chunk pointers of [rh] to an array of [capacity] entries
+static int rendezvous__chunks_grow(RendezvousHasher *rh, size_t capacity)
+{
+  RendezvousHasherChunk **chunks = rendezvous__chunks_alloc(rh, capacity);
+  if (!chunks) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  if (rh->chunks)
+  {
+    memcpy(chunks, rh->chunks,
+           rh->chunk_count * sizeof(RendezvousHasherChunk *));
+    rendezvous__chunks_free(rh);
+  }
+  rh->chunks = chunks;
+  rh->chunk_capacity = capacity;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+//
+// Engines
+//
+// All the engines keep the nodes in the node table, which gives the
+// membership. Jump hashes to a position of the table, AnchorHash to
+// a bucket that maps to a node, Maglev to an entry of a table of ids
+//
+
+struct RendezvousHasherEngineState {
+  size_t size;                // AnchorHash buckets, Maglev table entries
+  size_t working;             // AnchorHash: buckets in use
+  size_t removed;             // AnchorHash: buckets on the removed stack
+  // AnchorHash: the A, K, W, L and R arrays of the paper and the
+  // bucket of each position of the node table, [size] entries each.
+  // Maglev: offset, skip and next of each node
+  unsigned int *words;
+  size_t node_capacity;       // Maglev: nodes [words] and [order] fit
+  RendezvousHasherId *ids;    // AnchorHash: node of each bucket,
+                              // Maglev: the lookup table
+  RendezvousHasherId *order;  // Maglev: the nodes sorted by id
+  unsigned char *filled;      // Maglev: entries filled by the build
+  int deferred;               // Maglev: the build waits for
+                              // rendezvous__engine_build
+};
+
+static int rendezvous__compare_ids(const void *a, const void *b);
+
+// splitmix64 finalizer, spreads the item hashes over 64 bits
+static unsigned long long rendezvous__mix64(unsigned long long x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static unsigned long long rendezvous__engine_key(RendezvousHasherId item_id)
+{
+  return rendezvous__mix64(
+    (unsigned long long) RENDEZVOUS_HASHER_HASH(item_id));
+}
+
+// Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash
+// Algorithm". Returns the position of the node, [steps] is set to the
+// number of jumps
+static size_t rendezvous__jump_walk(const RendezvousHasher *rh,
+                                    RendezvousHasherId item_id,
+                                    size_t *steps)
+{
+  unsigned long long key = rendezvous__engine_key(item_id);
+  long long b = -1, j = 0;
+  size_t n = 0;
+  while (j < (long long) rh->node_count)
+  {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (long long) ((double) (b + 1)
+                     * ((double) (1LL << 31) / (double) ((key >> 33) + 1)));
+    n++;
+  }
+  *steps = n;
+  return (size_t) b;
+}
+
+static RendezvousHasherId
+rendezvous__lookup_jump(const RendezvousHasher *rh,
+                        RendezvousHasherId item_id)
+{
+  size_t steps;
+  return rendezvous_node_at(rh, rendezvous__jump_walk(rh, item_id, &steps));
+}
+
+#define RENDEZVOUS__ANCHOR_A(state) ((state)->words)
+#define RENDEZVOUS__ANCHOR_K(state) ((state)->words + (state)->size)
+#define RENDEZVOUS__ANCHOR_W(state) ((state)->words + 2 * (state)->size)
+#define RENDEZVOUS__ANCHOR_L(state) ((state)->words + 3 * (state)->size)
+#define RENDEZVOUS__ANCHOR_R(state) ((state)->words + 4 * (state)->size)
+#define RENDEZVOUS__ANCHOR_BUCKET(state) ((state)->words + 5 * (state)->size)
+
+// Mendelson et al., "AnchorHash: A Scalable Consistent Hash". A
+// removed bucket b remembers in A[b] how many buckets were working
+// when it was removed, a key that lands on it is hashed again among
+// those, following K to the buckets removed after it. Returns the
+// bucket, [steps] is set to the number of buckets visited
+static size_t rendezvous__anchor_walk(const RendezvousHasher *rh,
+                                      RendezvousHasherId item_id,
+                                      size_t *steps)
+{
+  const RendezvousHasherEngineState *state = rh->engine_state;
+  const unsigned int *A = RENDEZVOUS__ANCHOR_A(state);
+  const unsigned int *K = RENDEZVOUS__ANCHOR_K(state);
+  unsigned long long key = rendezvous__engine_key(item_id);
+  size_t b = (size_t) (key % state->size);
+  size_t n = 1;
+  while (A[b] > 0)
+  {
+    size_t h = (size_t) (rendezvous__mix64(key + b * 0x9e3779b97f4a7c15ULL)
+                         % A[b]);
+    n++;
+    while (A[h] >= A[b])
+    {
+      h = K[h];
+      n++;
+    }
+    b = h;
+  }
+  *steps = n;
+  return b;
+}
+
+static RendezvousHasherId
+rendezvous__lookup_anchor(const RendezvousHasher *rh,
+                          RendezvousHasherId item_id)
+{
+  size_t steps;
+  const RendezvousHasherEngineState *state = rh->engine_state;
+  return state->ids[rendezvous__anchor_walk(rh, item_id, &steps)];
+}
+
+static RendezvousHasherId
+rendezvous__lookup_maglev(const RendezvousHasher *rh,
+                          RendezvousHasherId item_id)
+{
+  const RendezvousHasherEngineState *state = rh->engine_state;
+  return state->ids[rendezvous__engine_key(item_id) % state->size];
+}
+
+// Take a bucket from the removed stack for the node at [position]
+static void rendezvous__anchor_add(RendezvousHasher *rh, size_t position)
+{
+  RendezvousHasherEngineState *state = rh->engine_state;
+  unsigned int *A = RENDEZVOUS__ANCHOR_A(state);
+  unsigned int *K = RENDEZVOUS__ANCHOR_K(state);
+  unsigned int *W = RENDEZVOUS__ANCHOR_W(state);
+  unsigned int *L = RENDEZVOUS__ANCHOR_L(state);
+  unsigned int b = RENDEZVOUS__ANCHOR_R(state)[--state->removed];
+  size_t n = state->working;
+  A[b] = 0;
+  L[W[n]] = (unsigned int) n;
+  W[L[b]] = b;
+  K[b] = b;
+  state->working++;
+  state->ids[b] = rendezvous_node_at(rh, position);
+  RENDEZVOUS__ANCHOR_BUCKET(state)[position] = b;
+}
+
+static void rendezvous__anchor_remove(RendezvousHasherEngineState *state,
+                                      unsigned int b)
+{
+  unsigned int *A = RENDEZVOUS__ANCHOR_A(state);
+  unsigned int *K = RENDEZVOUS__ANCHOR_K(state);
+  unsigned int *W = RENDEZVOUS__ANCHOR_W(state);
+  unsigned int *L = RENDEZVOUS__ANCHOR_L(state);
+  RENDEZVOUS__ANCHOR_R(state)[state->removed++] = b;
+  size_t n = --state->working;
+  A[b] = (unsigned int) n;
+  W[L[b]] = W[n];
+  K[b] = W[n];
+  L[W[n]] = L[b];
+}
+
+static void rendezvous__state_free(RendezvousHasherEngineState *state)
+{
+  if (!state) return;
+  if (state->words) RENDEZVOUS_HASHER_FREE(state->words);
+  if (state->ids) RENDEZVOUS_HASHER_FREE(state->ids);
+  if (state->order) RENDEZVOUS_HASHER_FREE(state->order);
+  if (state->filled) RENDEZVOUS_HASHER_FREE(state->filled);
+  RENDEZVOUS_HASHER_FREE(state);
+}
+
+// AnchorHash state of [size] buckets, all removed
+static RendezvousHasherEngineState *rendezvous__anchor_create(size_t size)
+{
+  RendezvousHasherEngineState *state = (RendezvousHasherEngineState *)
+    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherEngineState));
+  if (!state) return NULL;
+  memset(state, 0, sizeof(*state));
+  state->size = size;
+  state->words = (unsigned int *)
+    RENDEZVOUS_HASHER_MALLOC(6 * size * sizeof(unsigned int));
+  state->ids = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC(size * sizeof(RendezvousHasherId));
+  if (!state->words || !state->ids)
+  {
+    rendezvous__state_free(state);
+    return NULL;
+  }
+
+  for (size_t b = size; b-- > 0; )
+  {
+    RENDEZVOUS__ANCHOR_R(state)[state->removed++] = (unsigned int) b;
+    RENDEZVOUS__ANCHOR_A(state)[b] = (unsigned int) b;
+    RENDEZVOUS__ANCHOR_K(state)[b] = (unsigned int) b;
+    RENDEZVOUS__ANCHOR_W(state)[b] = (unsigned int) b;
+    RENDEZVOUS__ANCHOR_L(state)[b] = (unsigned int) b;
+  }
+  return state;
+}
+
+// Replace the AnchorHash state with one of [size] buckets holding the
+// current nodes, the items are remapped
+static int rendezvous__anchor_rebuild(RendezvousHasher *rh, size_t size)
+{
+  if (size > UINT_MAX) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  RendezvousHasherEngineState *state = rendezvous__anchor_create(size);
+  if (!state) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  rendezvous__state_free(rh->engine_state);
+  rh->engine_state = state;
+  for (size_t position = 0; position < rh->node_count; ++position)
+    rendezvous__anchor_add(rh, position);
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Make room in the Maglev scratch arrays for [count] nodes
+static int rendezvous__maglev_reserve(RendezvousHasherEngineState *state,
+                                      size_t count)
+{
+  if (count <= state->node_capacity) return RENDEZVOUS_HASHER_OK;
+
+  size_t capacity = state->node_capacity ? state->node_capacity * 2 : 16;
+  if (capacity < count) capacity = count;
+  unsigned int *words = (unsigned int *)
+    RENDEZVOUS_HASHER_MALLOC(3 * capacity * sizeof(unsigned int));
+  RendezvousHasherId *order = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherId));
+  if (!words || !order)
+  {
+    if (words) RENDEZVOUS_HASHER_FREE(words);
+    if (order) RENDEZVOUS_HASHER_FREE(order);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  if (state->words) RENDEZVOUS_HASHER_FREE(state->words);
+  if (state->order) RENDEZVOUS_HASHER_FREE(state->order);
+  state->words = words;
+  state->order = order;
+  state->node_capacity = capacity;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Eisenbud et al., "Maglev: A Fast and Reliable Software Network Load
+// Balancer". Every node walks its own permutation of the table and
+// takes the next free entry, in turns. The nodes take turns in id
+// order, so the table does not depend on the order of the changes
+static void rendezvous__maglev_build(RendezvousHasher *rh)
+{
+  RendezvousHasherEngineState *state = rh->engine_state;
+  size_t n = rh->node_count;
+  if (n == 0 || state->deferred) return;
+
+  for (size_t i = 0; i < n; ++i)
+    state->order[i] = rendezvous_node_at(rh, i);
+  qsort(state->order, n, sizeof(RendezvousHasherId), rendezvous__compare_ids);
+
+  unsigned long long size = state->size;
+  unsigned int *offset = state->words;
+  unsigned int *skip = state->words + n;
+  unsigned int *next = state->words + 2 * n;
+  for (size_t i = 0; i < n; ++i)
+  {
+    unsigned long long h = rendezvous__engine_key(state->order[i]);
+    offset[i] = (unsigned int) (h % size);
+    skip[i] = (unsigned int) (rendezvous__mix64(h) % (size - 1) + 1);
+    next[i] = 0;
+  }
+
+  memset(state->filled, 0, state->size);
+  size_t filled = 0;
+  for (;;)
+  {
+    for (size_t i = 0; i < n; ++i)
+    {
+      unsigned long long c;
+      do
+      {
+        c = (offset[i] + (unsigned long long) next[i] * skip[i]) % size;
+        next[i]++;
+      } while (state->filled[c]);
+      state->ids[c] = state->order[i];
+      state->filled[c] = 1;
+      if (++filled == state->size) return;
+    }
+  }
+}
+
+static int rendezvous__engine_create(RendezvousHasher *rh,
+                                     int engine,
+                                     size_t size)
+{
+  rh->engine = engine;
+  if (engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+  {
+    if (size == 0) size = RENDEZVOUS_HASHER_ANCHOR_CAPACITY;
+    if (size > UINT_MAX) return RENDEZVOUS_HASHER_ERROR_INVALID;
+    rh->engine_state = rendezvous__anchor_create(size);
+    return rh->engine_state ? RENDEZVOUS_HASHER_OK
+                            : RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  if (engine != RENDEZVOUS_HASHER_ENGINE_MAGLEV) return RENDEZVOUS_HASHER_OK;
+
+  if (size == 0) size = RENDEZVOUS_HASHER_MAGLEV_TABLE_SIZE;
+  if (size < 2 || size > UINT_MAX) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  for (size_t d = 2; d * d <= size; ++d)
+    if (size % d == 0) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherEngineState *state = (RendezvousHasherEngineState *)
+    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherEngineState));
+  if (!state) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  memset(state, 0, sizeof(*state));
+  rh->engine_state = state;
+  state->size = size;
+  state->ids = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC(size * sizeof(RendezvousHasherId));
+  state->filled = (unsigned char *) RENDEZVOUS_HASHER_MALLOC(size);
+  return state->ids && state->filled ? RENDEZVOUS_HASHER_OK
+                                     : RENDEZVOUS_HASHER_ERROR_ALLOC;
+}
+
+static void rendezvous__engine_free(RendezvousHasher *rh)
+{
+  rendezvous__state_free(rh->engine_state);
+  rh->engine_state = NULL;
+}
+
+static void *rendezvous__memdup(const void *p, size_t size)
+{
+  if (!p) return NULL;
+  void *copy = RENDEZVOUS_HASHER_MALLOC(size);
+  if (copy) memcpy(copy, p, size);
+  return copy;
+}
+
+static int rendezvous__engine_copy(RendezvousHasher *dst,
+                                   const RendezvousHasher *src)
+{
+  dst->engine = src->engine;
+  const RendezvousHasherEngineState *from = src->engine_state;
+  if (!from) return RENDEZVOUS_HASHER_OK;
+
+  RendezvousHasherEngineState *state = (RendezvousHasherEngineState *)
+    rendezvous__memdup(from, sizeof(*from));
+  if (!state) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  dst->engine_state = state;
+  state->words = NULL;
+  state->ids = NULL;
+  state->order = NULL;
+  state->filled = NULL;
+
+  int anchor = src->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR;
+  size_t words = anchor ? 6 * from->size : 3 * from->node_capacity;
+  state->words = (unsigned int *)
+    rendezvous__memdup(from->words, words * sizeof(unsigned int));
+  state->ids = (RendezvousHasherId *)
+    rendezvous__memdup(from->ids, from->size * sizeof(RendezvousHasherId));
+  state->order = (RendezvousHasherId *) rendezvous__memdup(
+    from->order, from->node_capacity * sizeof(RendezvousHasherId));
+  state->filled = (unsigned char *)
+    rendezvous__memdup(from->filled, anchor ? 0 : from->size);
+  if ((from->words && !state->words) || (from->ids && !state->ids)
+      || (from->order && !state->order) || (from->filled && !state->filled))
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Called before a node is added to the table
+static int rendezvous__engine_reserve(RendezvousHasher *rh)
+{
+  RendezvousHasherEngineState *state = rh->engine_state;
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR
+      && state->working == state->size)
+    return rendezvous__anchor_rebuild(rh, 2 * state->size);
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+  {
+    if (rh->node_count + 1 >= state->size)
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+    return rendezvous__maglev_reserve(state, rh->node_count + 1);
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Called after the node at the end of the table was added
+static void rendezvous__engine_add(RendezvousHasher *rh)
+{
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+    rendezvous__anchor_add(rh, rh->node_count - 1);
+  else if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    rendezvous__maglev_build(rh);
+}
+
+// Called before the node at [index] is replaced by the one at [last]
+static void rendezvous__engine_remove(RendezvousHasher *rh,
+                                      size_t index,
+                                      size_t last)
+{
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_ANCHOR) return;
+  unsigned int *buckets = RENDEZVOUS__ANCHOR_BUCKET(rh->engine_state);
+  rendezvous__anchor_remove(rh->engine_state, buckets[index]);
+  buckets[index] = buckets[last];
+}
+
+#if defined(RENDEZVOUS_HASHER_JOURNAL) || defined(RENDEZVOUS_HASHER_RELOAD)
+
+// Loads that change many nodes at once build the Maglev table once,
+// at the end, instead of after every change. The lookups are wrong in
+// between
+static void rendezvous__engine_defer(RendezvousHasher *rh)
+{
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    rh->engine_state->deferred = 1;
+}
+
+static void rendezvous__engine_build(RendezvousHasher *rh)
+{
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_MAGLEV) return;
+  rh->engine_state->deferred = 0;
+  rendezvous__maglev_build(rh);
+}
+
+#endif // RENDEZVOUS_HASHER_JOURNAL || RENDEZVOUS_HASHER_RELOAD
+
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_memory_size(const RendezvousHasher *rh)
+{
+  if (!rh) return 0;
+
+  size_t size = rh->chunk_count * RENDEZVOUS_HASHER_CHUNK_BYTES(rh->weighted)
+    + rh->chunk_capacity * sizeof(RendezvousHasherChunk *)
+    + rh->id_map_capacity * sizeof(RendezvousHasherPosition);
+  const RendezvousHasherEngineState *state = rh->engine_state;
+  if (!state) return size;
+
+  size += sizeof(*state) + state->size * sizeof(RendezvousHasherId);
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+    return size + 6 * state->size * sizeof(unsigned int);
+  return size + state->size
+    + state->node_capacity * (3 * sizeof(unsigned int)
+                              + sizeof(RendezvousHasherId));
+}
+
+//
+// Id map
+//
+
+#define RENDEZVOUS__POSITION_NONE ((RendezvousHasherPosition) -1)
+
+static size_t rendezvous__map_home(const RendezvousHasher *rh,
+                                   RendezvousHasherId id)
+{
+  return (size_t) RENDEZVOUS_HASHER_HASH(id) & (rh->id_map_capacity - 1);
+}
+
+// Slot of [position] in the map
+static size_t rendezvous__map_slot(const RendezvousHasher *rh,
+                                   size_t position)
+{
+  size_t mask = rh->id_map_capacity - 1;
+  size_t slot = rendezvous__map_home(rh, rendezvous_node_at(rh, position));
+  while (rh->id_map[slot] != (RendezvousHasherPosition) position)
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+static void rendezvous__map_drop(RendezvousHasher *rh)
+{
+  if (rh->id_map) RENDEZVOUS_HASHER_FREE(rh->id_map);
+  rh->id_map = NULL;
+  rh->id_map_capacity = 0;
+}
+
+// Positions from RENDEZVOUS__POSITION_NONE up cannot be stored, the
+// map is dropped and the hasher goes on without it
+static void rendezvous__map_insert(RendezvousHasher *rh, size_t position)
+{
+  if (position >= (size_t) RENDEZVOUS__POSITION_NONE)
+  {
+    rendezvous__map_drop(rh);
+    return;
+  }
+
+  size_t mask = rh->id_map_capacity - 1;
+  size_t slot = rendezvous__map_home(rh, rendezvous_node_at(rh, position));
+  while (rh->id_map[slot] != RENDEZVOUS__POSITION_NONE)
+    slot = (slot + 1) & mask;
+  rh->id_map[slot] = (RendezvousHasherPosition) position;
+}
+
+// Replace the map with an empty one for [count] nodes, at most half
+// full. Without memory or positions for all the nodes the hasher goes
+// on without a map
+static void rendezvous__map_alloc(RendezvousHasher *rh, size_t count)
+{
+  rendezvous__map_drop(rh);
+  if (count >= (size_t) RENDEZVOUS__POSITION_NONE) return;
+
+  size_t capacity = 16;
+  while (capacity < 2 * count) capacity *= 2;
+  rh->id_map = (RendezvousHasherPosition *)
+    RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherPosition));
+  if (!rh->id_map) return;
+  rh->id_map_capacity = capacity;
+  for (size_t slot = 0; slot < capacity; ++slot)
+    rh->id_map[slot] = RENDEZVOUS__POSITION_NONE;
+}
+
+static void rendezvous__map_build(RendezvousHasher *rh, size_t count)
+{
+  rendezvous__map_alloc(rh, count < rh->node_count ? rh->node_count : count);
+  if (!rh->id_map) return;
+  for (size_t position = 0; position < rh->node_count; ++position)
+    rendezvous__map_insert(rh, position);
+}
+
+// Remove [position] from the map, the following slots of its cluster
+// are shifted back so that no tombstones are needed
+static void rendezvous__map_erase(RendezvousHasher *rh, size_t position)
+{
+  size_t mask = rh->id_map_capacity - 1;
+  size_t hole = rendezvous__map_slot(rh, position);
+  for (size_t slot = (hole + 1) & mask;
+       rh->id_map[slot] != RENDEZVOUS__POSITION_NONE;
+       slot = (slot + 1) & mask)
+  {
+    size_t home =
+      rendezvous__map_home(rh, rendezvous_node_at(rh, rh->id_map[slot]));
+    // Move it only if its home is not in (hole, slot]
+    if (((slot - home) & mask) < ((slot - hole) & mask)) continue;
+    rh->id_map[hole] = rh->id_map[slot];
+    hole = slot;
+  }
+  rh->id_map[hole] = RENDEZVOUS__POSITION_NONE;
+}
+
+// Position of a node with [id], or node_count. Tables of one chunk
+// are scanned, the map pays off only for larger ones
+static size_t rendezvous__find(RendezvousHasher *rh,
+                               RendezvousHasherId id)
+{
+  if (!rh->id_map && rh->node_count > RENDEZVOUS_HASHER_CHUNK_SIZE)
+    rendezvous__map_build(rh, rh->node_count);
+
+  if (!rh->id_map)
+  {
+    size_t index = 0;
+    while (index < rh->node_count && !(rendezvous_node_at(rh, index) == id))
+      index++;
+    return index;
+  }
+
+  size_t mask = rh->id_map_capacity - 1;
+  for (size_t slot = rendezvous__map_home(rh, id);
+       rh->id_map[slot] != RENDEZVOUS__POSITION_NONE;
+       slot = (slot + 1) & mask)
+    if (rendezvous_node_at(rh, rh->id_map[slot]) == id)
+      return rh->id_map[slot];
+  return rh->node_count;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_find_node(RendezvousHasher *rh,
+                     RendezvousHasherId id,
+                     size_t *index)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!index) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+
+  *index = rendezvous__find(rh, id);
+  return *index < rh->node_count
+    ? RENDEZVOUS_HASHER_OK : RENDEZVOUS_HASHER_ERROR_INVALID;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reserve(RendezvousHasher *rh,
+                   size_t node_count)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  size_t chunk_count = (node_count + RENDEZVOUS_HASHER_CHUNK_SIZE - 1)
+    / RENDEZVOUS_HASHER_CHUNK_SIZE;
+  if (chunk_count > rh->chunk_capacity
+      && rendezvous__chunks_grow(rh, chunk_count) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  if (rh->id_map && 2 * node_count > rh->id_map_capacity)
+    rendezvous__map_build(rh, node_count);
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR
+      && node_count > rh->engine_state->size)
+    return rendezvous__anchor_rebuild(rh, node_count);
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    return node_count < rh->engine_state->size
+      ? rendezvous__maglev_reserve(rh->engine_state, node_count)
+      : RENDEZVOUS_HASHER_ERROR_INVALID;
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+typedef struct {
+  RendezvousHasherId id;
+  int log2_weight;
+} RendezvousHasherPackEntry;
+
+static int rendezvous__compare_pack(const void *a, const void *b)
+{
+  const RendezvousHasherPackEntry *x = (const RendezvousHasherPackEntry *) a;
+  const RendezvousHasherPackEntry *y = (const RendezvousHasherPackEntry *) b;
+  if (!(x->id == y->id)) return x->id > y->id ? 1 : -1;
+  return (x->log2_weight > y->log2_weight) - (y->log2_weight > x->log2_weight);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shrink_to_fit(RendezvousHasher *rh)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  size_t n = rh->node_count;
+  size_t chunk_count = rh->chunk_count;
+  RendezvousHasherPackEntry *entries = NULL;
+  RendezvousHasherChunk **chunks = NULL;
+  if (n > 0)
+  {
+    entries = (RendezvousHasherPackEntry *)
+      RENDEZVOUS_HASHER_MALLOC(n * sizeof(RendezvousHasherPackEntry));
+    chunks = rendezvous__chunks_alloc(rh, chunk_count);
+    size_t allocated = 0;
+    while (entries && chunks && allocated < chunk_count
+           && (chunks[allocated] = rendezvous__chunk_alloc(rh)) != NULL)
+      allocated++;
+    if (allocated < chunk_count)
+    {
+      while (allocated > 0) rendezvous__chunk_release(chunks[--allocated]);
+      rendezvous__chunks_release(rh, chunks, chunk_count);
+      if (entries) RENDEZVOUS_HASHER_FREE(entries);
+      return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      entries[i].id = rendezvous_node_at(rh, i);
+      entries[i].log2_weight = rh->weighted
+        ? rh->chunks[i / RENDEZVOUS_HASHER_CHUNK_SIZE]
+            ->log2_weights[i % RENDEZVOUS_HASHER_CHUNK_SIZE]
+        : 0;
+    }
+    if (rh->engine == RENDEZVOUS_HASHER_ENGINE_HRW)
+      qsort(entries, n, sizeof(RendezvousHasherPackEntry),
+            rendezvous__compare_pack);
+  }
+
+  for (size_t i = 0; i < rh->chunk_count; ++i)
+    rendezvous__chunk_release(rh->chunks[i]);
+  rendezvous__chunks_free(rh);
+  rh->chunks = chunks;
+  rh->chunk_capacity = chunk_count;
+
+  // Fill the chunks and the map in one pass, the map is kept only if
+  // it would be built again on the next removal
+  if (n > RENDEZVOUS_HASHER_CHUNK_SIZE || rh->id_map)
+    rendezvous__map_alloc(rh, n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    RendezvousHasherChunk *chunk = chunks[i / RENDEZVOUS_HASHER_CHUNK_SIZE];
+    chunk->ids[i % RENDEZVOUS_HASHER_CHUNK_SIZE] = entries[i].id;
+    if (rh->weighted)
+      chunk->log2_weights[i % RENDEZVOUS_HASHER_CHUNK_SIZE] =
+        entries[i].log2_weight;
+    if (rh->id_map) rendezvous__map_insert(rh, i);
+  }
+  if (entries) RENDEZVOUS_HASHER_FREE(entries);
+  rendezvous__bind(rh);
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static int rendezvous__add(RendezvousHasher *rh,
+                           RendezvousHasherId id,
+                           int log2_weight)
+{
+  int err = rendezvous__engine_reserve(rh);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  size_t c = rh->node_count / RENDEZVOUS_HASHER_CHUNK_SIZE;
+  if (c == rh->chunk_count)
+  {
+    if (rh->chunk_count == rh->chunk_capacity
+        && rendezvous__chunks_grow(rh, rh->chunk_capacity
+                                   ? rh->chunk_capacity * 2 : 4)
+           != RENDEZVOUS_HASHER_OK)
+      return RENDEZVOUS_HASHER_ERROR_ALLOC;
+
+    RendezvousHasherChunk *chunk = rendezvous__chunk_alloc(rh);
+    if (!chunk) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    rh->chunks[rh->chunk_count++] = chunk;
+  }
+  else if (rendezvous__chunk_own(rh, c) != RENDEZVOUS_HASHER_OK)
+  {
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+
+  rh->chunks[c]->ids[rh->node_count % RENDEZVOUS_HASHER_CHUNK_SIZE] = id;
+  if (rh->weighted)
+    rh->chunks[c]->log2_weights[rh->node_count % RENDEZVOUS_HASHER_CHUNK_SIZE] =
+      log2_weight;
+  rh->node_count++;
+  if (rh->id_map)
+  {
+    if (2 * rh->node_count > rh->id_map_capacity)
+      rendezvous__map_build(rh, rh->node_count);
+    else
+      rendezvous__map_insert(rh, rh->node_count - 1);
+  }
+  rendezvous__engine_add(rh);
+  rh->version++;
+  rendezvous__bind(rh);
+  RENDEZVOUS__PROBE3(node_add, rh, id, rh->node_count);
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_remove_node(RendezvousHasher *rh,
+                       RendezvousHasherId id)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  size_t index = rendezvous__find(rh, id);
+  if (index == rh->node_count) return RENDEZVOUS_HASHER_OK;
+
+  // Move the last node in the hole
+  size_t c = index / RENDEZVOUS_HASHER_CHUNK_SIZE;
+  size_t last = rh->node_count - 1;
+  size_t last_c = last / RENDEZVOUS_HASHER_CHUNK_SIZE;
+  if (index != last
+      && rendezvous__chunk_own(rh, c) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  rendezvous__engine_remove(rh, index, last);
+  if (rh->id_map)
+  {
+    rendezvous__map_erase(rh, index);
+    if (index != last)
+      rh->id_map[rendezvous__map_slot(rh, last)] =
+        (RendezvousHasherPosition) index;
+  }
+  if (index != last)
+  {
+    rh->chunks[c]->ids[index % RENDEZVOUS_HASHER_CHUNK_SIZE] =
+      rendezvous_node_at(rh, last);
+    if (rh->weighted)
+      rh->chunks[c]->log2_weights[index % RENDEZVOUS_HASHER_CHUNK_SIZE] =
+        rh->chunks[last_c]->log2_weights[last % RENDEZVOUS_HASHER_CHUNK_SIZE];
+  }
+  rh->node_count--;
+
+  if (rh->node_count == last_c * RENDEZVOUS_HASHER_CHUNK_SIZE)
+  {
+    rendezvous__chunk_release(rh->chunks[last_c]);
+    rh->chunk_count--;
+  }
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    rendezvous__maglev_build(rh);
+  rh->version++;
+  rendezvous__bind(rh);
+  RENDEZVOUS__PROBE3(node_remove, rh, id, rh->node_count);
+  
+  return RENDEZVOUS_HASHER_OK;
+}
+
+//
+// Weighted scoring
+//
+// The weighted score of a node is w / -ln(u), with u the hash of the
+// node and the item mapped to (0, 1): the node with the highest one
+// wins with probability proportional to w. The comparison is the same
+// on log2(w) - log2(-log2(u)), which is computed in fixed point with
+// 24 fractional bits. Near u = 1, where the winners are, -log2(u) is
+// computed as t * (-log2(1 - t) / t) with t = 1 - u, so that it keeps
+// its relative precision
+//
+
+// log2(1 + i / 256) in Q30
+static const unsigned int rendezvous__log2_table[257] = {
+           0,    6039314,   12055174,   18047761,   24017256,   29963836,
+    35887675,   41788947,   47667823,   53524472,   59359063,   65171760,
+    70962728,   76732128,   82480119,   88206862,   93912511,   99597222,
+   105261148,  110904440,  116527248,  122129721,  127712004,  133274244,
+   138816582,  144339162,  149842124,  155325606,  160789745,  166234679,
+   171660541,  177067464,  182455581,  187825021,  193175914,  198508388,
+   203822568,  209118580,  214396548,  219656594,  224898839,  230123404,
+   235330407,  240519966,  245692198,  250847218,  255985140,  261106077,
+   266210141,  271297442,  276368092,  281422197,  286459867,  291481207,
+   296486323,  301475319,  306448299,  311405366,  316346620,  321272163,
+   326182095,  331076513,  335955515,  340819199,  345667660,  350500993,
+   355319292,  360122651,  364911162,  369684916,  374444004,  379188517,
+   383918542,  388634168,  393335482,  398022572,  402695523,  407354420,
+   411999347,  416630388,  421247625,  425851141,  430441017,  435017334,
+   439580170,  444129607,  448665721,  453188592,  457698295,  462194908,
+   466678506,  471149164,  475606957,  480051959,  484484242,  488903880,
+   493310944,  497705506,  502087636,  506457405,  510814882,  515160136,
+   519493235,  523814248,  528123241,  532420281,  536705435,  540978767,
+   545240343,  549490228,  553728485,  557955178,  562170370,  566374123,
+   570566499,  574747559,  578917365,  583075977,  587223455,  591359858,
+   595485245,  599599675,  603703206,  607795895,  611877800,  615948977,
+   620009483,  624059373,  628098702,  632127527,  636145900,  640153876,
+   644151509,  648138853,  652115959,  656082880,  660039669,  663986377,
+   667923055,  671849754,  675766525,  679673418,  683570481,  687457766,
+   691335320,  695203192,  699061430,  702910083,  706749198,  710578822,
+   714399001,  718209783,  722011213,  725803337,  729586201,  733359850,
+   737124328,  740879680,  744625951,  748363183,  752091421,  755810707,
+   759521085,  763222597,  766915285,  770599192,  774274358,  777940826,
+   781598637,  785247830,  788888448,  792520529,  796144114,  799759243,
+   803365955,  806964289,  810554283,  814135978,  817709409,  821274617,
+   824831638,  828380510,  831921271,  835453956,  838978604,  842495250,
+   846003931,  849504683,  852997541,  856482542,  859959719,  863429109,
+   866890747,  870344666,  873790901,  877229486,  880660455,  884083842,
+   887499680,  890908003,  894308843,  897702233,  901088206,  904466794,
+   907838029,  911201944,  914558569,  917907937,  921250079,  924585025,
+   927912807,  931233456,  934547002,  937853475,  941152905,  944445323,
+   947730758,  951009239,  954280797,  957545460,  960803257,  964054218,
+   967298370,  970535742,  973766362,  976990259,  980207461,  983417995,
+   986621888,  989819169,  993009864,  996194001,  999371606, 1002542707,
+  1005707329, 1008865499, 1012017244, 1015162589, 1018301561, 1021434185,
+  1024560487, 1027680492, 1030794226, 1033901713, 1037002979, 1040098049,
+  1043186948, 1046269699, 1049346328, 1052416858, 1055481314, 1058539720,
+  1061592099, 1064638476, 1067678873, 1070713315, 1073741824
+};
+
+// log2(-log2(1 - t) / t) for t = i / 256, in Q30
+static const unsigned int rendezvous__log2_ratio_table[129] = {
+   567758570,  570789057,  573829462,  576879856,  579940310,  583010896,
+   586091687,  589182757,  592284179,  595396029,  598518383,  601651318,
+   604794912,  607949244,  611114393,  614290440,  617477465,  620675553,
+   623884786,  627105248,  630337024,  633580202,  636834869,  640101112,
+   643379022,  646668689,  649970205,  653283662,  656609155,  659946778,
+   663296628,  666658803,  670033400,  673420519,  676820263,  680232733,
+   683658032,  687096267,  690547543,  694011967,  697489650,  700980701,
+   704485233,  708003358,  711535192,  715080852,  718640454,  722214119,
+   725801967,  729404122,  733020707,  736651849,  740297676,  743958317,
+   747633904,  751324568,  755030447,  758751675,  762488393,  766240741,
+   770008861,  773792899,  777593001,  781409316,  785241996,  789091193,
+   792957063,  796839764,  800739456,  804656302,  808590467,  812542117,
+   816511424,  820498560,  824503699,  828527019,  832568703,  836628931,
+   840707892,  844805774,  848922769,  853059073,  857214884,  861390404,
+   865585836,  869801390,  874037277,  878293712,  882570914,  886869104,
+   891188508,  895529357,  899891883,  904276325,  908682923,  913111924,
+   917563578,  922038140,  926535867,  931057023,  935601878,  940170703,
+   944763776,  949381381,  954023805,  958691341,  963384290,  968102954,
+   972847644,  977618676,  982416372,  987241059,  992093073,  996972754,
+  1001880449, 1006816514, 1011781308, 1016775202, 1021798570, 1026851797,
+  1031935274, 1037049401, 1042194584, 1047371242, 1052579797, 1057820685,
+  1063094349, 1068401241, 1073741824
+};
+
+#define RENDEZVOUS__LOG2_ZERO INT_MIN
+
+// Linear interpolation of [table] at [i] + [frac] / 2^16, in Q24
+static long rendezvous__interpolate(const unsigned int *table,
+                                    unsigned long i,
+                                    unsigned long frac)
+{
+  unsigned long long step = table[i + 1] - table[i];
+  return (long) ((table[i] + ((step * frac) >> 16)) >> 6);
+}
+
+// log2(x) in Q24, for x >= 1
+static long rendezvous__log2_q24(unsigned long long x)
+{
+#ifdef __GNUC__
+  unsigned long e = 63 - (unsigned long) __builtin_clzll(x);
+#else
+  unsigned long e = 0;
+  while (x >> (e + 1)) e++;
+#endif
+  // 32 bits of mantissa, with the leading one at bit 31
+  unsigned long long m = e > 31 ? x >> (e - 31) : x << (31 - e);
+  return (long) (e << 24)
+    + rendezvous__interpolate(rendezvous__log2_table,
+                              (unsigned long) (m >> 23) & 255,
+                              (unsigned long) (m >> 7) & 0xffff);
+}
+
+// Score of a node with weight 2^(log2_weight / 2^24) and [hash]
+static RendezvousHasherHash
+rendezvous__weighted_score(RendezvousHasherHash hash,
+                           int log2_weight)
+{
+  if (log2_weight == RENDEZVOUS__LOG2_ZERO) return 0;
+
+  // u = (2h + 1) / 2^33, never 0 or 1
+  unsigned long long u = 2 * ((unsigned long long) hash & 0xffffffffULL) + 1;
+  long log2_y; // log2(-log2(u))
+  if (u > (1ULL << 32))
+  {
+    unsigned long long t = (1ULL << 33) - u;
+    log2_y = rendezvous__log2_q24(t) - (33L << 24)
+      + rendezvous__interpolate(rendezvous__log2_ratio_table,
+                                (unsigned long) (t >> 25),
+                                (unsigned long) (t >> 9) & 0xffff);
+  }
+  else
+  {
+    // -log2(u) is in [1, 33]
+    log2_y = rendezvous__log2_q24((33ULL << 24)
+                                  - (unsigned long long) rendezvous__log2_q24(u))
+      - (24L << 24);
+  }
+
+  // In (2.9, 74) * 2^24 for weights below 2^32, never 0
+  return (RendezvousHasherHash) (unsigned long) (log2_weight - log2_y + (8L << 24));
+}
+
+// Score of the node at [index] of [rh] for [item_id]
+static RendezvousHasherHash
+rendezvous__score_at(const RendezvousHasher *rh,
+                     size_t index,
+                     RendezvousHasherId item_id)
+{
+  const RendezvousHasherChunk *chunk =
+    rh->chunks[index / RENDEZVOUS_HASHER_CHUNK_SIZE];
+  size_t i = index % RENDEZVOUS_HASHER_CHUNK_SIZE;
+  RendezvousHasherHash hash = RENDEZVOUS_HASHER_HASH(
+    RENDEZVOUS_HASHER_COMBINE(chunk->ids[i], item_id));
+  return rh->weighted
+    ? rendezvous__weighted_score(hash, chunk->log2_weights[i]) : hash;
+}
+
+static int rendezvous__log2_weight(unsigned int weight)
+{
+  return weight == 0 ? RENDEZVOUS__LOG2_ZERO
+                     : (int) rendezvous__log2_q24(weight);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_add_node(RendezvousHasher *rh,
+                    RendezvousHasherId id)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  return rendezvous__add(rh, id, 0);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_add_weighted_node(RendezvousHasher *rh,
+                             RendezvousHasherId id,
+                             unsigned int weight)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh->weighted) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  return rendezvous__add(rh, id, rendezvous__log2_weight(weight));
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_set_weight(RendezvousHasher *rh,
+                      RendezvousHasherId id,
+                      unsigned int weight)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh->weighted) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  if (rendezvous__find(rh, id) == rh->node_count)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  // Every copy of a duplicate id gets the weight. The chunks of all
+  // the copies are owned before any is written, so that a failed
+  // allocation leaves the weights as they were
+  size_t mask = rh->id_map_capacity - 1;
+  for (int write = 0; write <= 1; ++write)
+  {
+    size_t slot = rh->id_map ? rendezvous__map_home(rh, id) : 0;
+    for (size_t i = 0; rh->id_map ? rh->id_map[slot] != RENDEZVOUS__POSITION_NONE
+                                  : i < rh->node_count; ++i)
+    {
+      size_t index = rh->id_map ? rh->id_map[slot] : i;
+      slot = (slot + 1) & mask;
+      if (!(rendezvous_node_at(rh, index) == id)) continue;
+
+      size_t c = index / RENDEZVOUS_HASHER_CHUNK_SIZE;
+      if (!write)
+      {
+        if (rendezvous__chunk_own(rh, c) != RENDEZVOUS_HASHER_OK)
+          return RENDEZVOUS_HASHER_ERROR_ALLOC;
+        continue;
+      }
+      rh->chunks[c]->log2_weights[index % RENDEZVOUS_HASHER_CHUNK_SIZE] =
+        rendezvous__log2_weight(weight);
+    }
+  }
+  rh->version++;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Score of node [node_id] for [item_id]
+static RendezvousHasherHash
+rendezvous__score(RendezvousHasherId node_id,
+                  RendezvousHasherId item_id)
+{
+  return RENDEZVOUS_HASHER_HASH(RENDEZVOUS_HASHER_COMBINE(node_id, item_id));
+}
+
+// Find the winner for [item_id] in the non empty hasher [rh]
+static void rendezvous__lookup(const RendezvousHasher *rh,
+                               RendezvousHasherId item_id,
+                               RendezvousHasherId *node_id,
+                               RendezvousHasherHash *score)
+{
+  RendezvousHasherId chosen_node_id = rh->chunks[0]->ids[0];
+  RendezvousHasherHash max_hash = rendezvous__score_at(rh, 0, item_id);
+  for (size_t c = 0; c < rh->chunk_count; ++c)
+  {
+    const RendezvousHasherId *ids = rh->chunks[c]->ids;
+    const int *log2_weights = rh->weighted ? rh->chunks[c]->log2_weights : NULL;
+    size_t count = rh->node_count - c * RENDEZVOUS_HASHER_CHUNK_SIZE;
+    if (count > RENDEZVOUS_HASHER_CHUNK_SIZE)
+      count = RENDEZVOUS_HASHER_CHUNK_SIZE;
+    
+    for (size_t i = 0; i < count; ++i)
+    {
+      RendezvousHasherHash id_sum_hash = rendezvous__score(ids[i], item_id);
+      if (rh->weighted)
+        id_sum_hash = rendezvous__weighted_score(id_sum_hash, log2_weights[i]);
+      if (RENDEZVOUS_HASHER_BEATS(id_sum_hash, ids[i],
+                                  max_hash, chosen_node_id))
+      {
+        max_hash = id_sum_hash;
+        chosen_node_id = ids[i];
+      }
+    }
+  }
+
+  *node_id = chosen_node_id;
+  if (score) *score = max_hash;
+}
+
+#ifdef __GNUC__
+  #define RENDEZVOUS__INLINE static inline __attribute__((always_inline))
+#else
+  #define RENDEZVOUS__INLINE static inline
+#endif
+
+// Largest node count with its own lookup kernel, all its nodes are in
+// the first chunk
+#define RENDEZVOUS__SMALL_MAX \
+  (RENDEZVOUS_HASHER_CHUNK_SIZE < 32 ? RENDEZVOUS_HASHER_CHUNK_SIZE : 32)
+
+// With 32 bit scores and ids, a (score, id) pair packed in 64 bits
+// compares in the canonical order
+#if defined(RENDEZVOUS__DEFAULT_ID_T) && defined(RENDEZVOUS__DEFAULT_HASH_T) \
+  && UINT_MAX == 0xffffffffu
+  #define RENDEZVOUS__PACKED_KEYS
+#endif
+
+// Winner among the [n] nodes of [ids], with [n] a constant once
+// inlined in a kernel: the loops are unrolled, the ids stay in
+// registers and the winner comes out of a tree of max operations,
+// without branches
+RENDEZVOUS__INLINE RendezvousHasherId
+rendezvous__small_argmax(const RendezvousHasherId *ids,
+                         RendezvousHasherId item_id,
+                         size_t n)
+{
+#ifdef RENDEZVOUS__PACKED_KEYS
+  unsigned long long keys[32];
+  for (size_t i = 0; i < n; ++i)
+    keys[i] = (unsigned long long) rendezvous__score(ids[i], item_id) << 32
+            | ids[i];
+  for (size_t w = n; w > 1; w = (w + 1) / 2)
+    for (size_t i = 0; i < w / 2; ++i)
+    {
+      unsigned long long other = keys[i + (w + 1) / 2];
+      keys[i] = other > keys[i] ? other : keys[i];
+    }
+  return (RendezvousHasherId) keys[0];
+#else
+  RendezvousHasherHash scores[32];
+  RendezvousHasherId best[32];
+  for (size_t i = 0; i < n; ++i)
+  {
+    best[i] = ids[i];
+    scores[i] = rendezvous__score(ids[i], item_id);
+  }
+  for (size_t w = n; w > 1; w = (w + 1) / 2)
+    for (size_t i = 0; i < w / 2; ++i)
+    {
+      size_t j = i + (w + 1) / 2;
+      int win = RENDEZVOUS_HASHER_BEATS(scores[j], best[j], scores[i], best[i]);
+      scores[i] = win ? scores[j] : scores[i];
+      best[i] = win ? best[j] : best[i];
+    }
+  return best[0];
+#endif
+}
+
+#define RENDEZVOUS__SMALL_KERNEL(n)                                       \
+  static RendezvousHasherId                                              \
+  rendezvous__lookup_##n(const RendezvousHasher *rh,                     \
+                         RendezvousHasherId item_id)                     \
+  {                                                                      \
+    return rendezvous__small_argmax(rh->chunks[0]->ids, item_id, n);     \
+  }
+
+RENDEZVOUS__SMALL_KERNEL(1)  RENDEZVOUS__SMALL_KERNEL(2)
+RENDEZVOUS__SMALL_KERNEL(3)  RENDEZVOUS__SMALL_KERNEL(4)
+RENDEZVOUS__SMALL_KERNEL(5)  RENDEZVOUS__SMALL_KERNEL(6)
+RENDEZVOUS__SMALL_KERNEL(7)  RENDEZVOUS__SMALL_KERNEL(8)
+RENDEZVOUS__SMALL_KERNEL(9)  RENDEZVOUS__SMALL_KERNEL(10)
+RENDEZVOUS__SMALL_KERNEL(11) RENDEZVOUS__SMALL_KERNEL(12)
+RENDEZVOUS__SMALL_KERNEL(13) RENDEZVOUS__SMALL_KERNEL(14)
+RENDEZVOUS__SMALL_KERNEL(15) RENDEZVOUS__SMALL_KERNEL(16)
+RENDEZVOUS__SMALL_KERNEL(17) RENDEZVOUS__SMALL_KERNEL(18)
+RENDEZVOUS__SMALL_KERNEL(19) RENDEZVOUS__SMALL_KERNEL(20)
+RENDEZVOUS__SMALL_KERNEL(21) RENDEZVOUS__SMALL_KERNEL(22)
+RENDEZVOUS__SMALL_KERNEL(23) RENDEZVOUS__SMALL_KERNEL(24)
+RENDEZVOUS__SMALL_KERNEL(25) RENDEZVOUS__SMALL_KERNEL(26)
+RENDEZVOUS__SMALL_KERNEL(27) RENDEZVOUS__SMALL_KERNEL(28)
+RENDEZVOUS__SMALL_KERNEL(29) RENDEZVOUS__SMALL_KERNEL(30)
+RENDEZVOUS__SMALL_KERNEL(31) RENDEZVOUS__SMALL_KERNEL(32)
+
+static RendezvousHasherId
+rendezvous__lookup_any(const RendezvousHasher *rh,
+                       RendezvousHasherId item_id)
+{
+  RendezvousHasherId node_id;
+  rendezvous__lookup(rh, item_id, &node_id, NULL);
+  return node_id;
+}
+
+static RendezvousHasherId (*const rendezvous__small_kernels[33])(
+  const RendezvousHasher *rh, RendezvousHasherId item_id) = {
+  NULL,
+  rendezvous__lookup_1,  rendezvous__lookup_2,  rendezvous__lookup_3,
+  rendezvous__lookup_4,  rendezvous__lookup_5,  rendezvous__lookup_6,
+  rendezvous__lookup_7,  rendezvous__lookup_8,  rendezvous__lookup_9,
+  rendezvous__lookup_10, rendezvous__lookup_11, rendezvous__lookup_12,
+  rendezvous__lookup_13, rendezvous__lookup_14, rendezvous__lookup_15,
+  rendezvous__lookup_16, rendezvous__lookup_17, rendezvous__lookup_18,
+  rendezvous__lookup_19, rendezvous__lookup_20, rendezvous__lookup_21,
+  rendezvous__lookup_22, rendezvous__lookup_23, rendezvous__lookup_24,
+  rendezvous__lookup_25, rendezvous__lookup_26, rendezvous__lookup_27,
+  rendezvous__lookup_28, rendezvous__lookup_29, rendezvous__lookup_30,
+  rendezvous__lookup_31, rendezvous__lookup_32,
+};
+
+// Pick the lookup kernel for the current number of nodes
+static void rendezvous__bind(RendezvousHasher *rh)
+{
+  if (rh->node_count == 0)
+    rh->lookup = NULL;
+  else if (rh->engine == RENDEZVOUS_HASHER_ENGINE_JUMP)
+    rh->lookup = rendezvous__lookup_jump;
+  else if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+    rh->lookup = rendezvous__lookup_anchor;
+  else if (rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV)
+    rh->lookup = rendezvous__lookup_maglev;
+  else if (rh->weighted)
+    rh->lookup = rendezvous__lookup_any;
+  else if (rh->node_count <= RENDEZVOUS__SMALL_MAX)
+    rh->lookup = rendezvous__small_kernels[rh->node_count];
+  else
+    rh->lookup = rendezvous__lookup_any;
+}
+
+#ifdef RENDEZVOUS_HASHER_USDT
+
+// Lookup for the probes, [scanned] is set to the nodes scored by HRW,
+// the jumps of jump, the buckets visited by AnchorHash, or the one
+// entry read by Maglev
+static RendezvousHasherId
+rendezvous__lookup_counted(const RendezvousHasher *rh,
+                           RendezvousHasherId item_id,
+                           size_t *scanned)
+{
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_JUMP)
+    return rendezvous_node_at(rh, rendezvous__jump_walk(rh, item_id, scanned));
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+  {
+    size_t b = rendezvous__anchor_walk(rh, item_id, scanned);
+    return rh->engine_state->ids[b];
+  }
+  *scanned = rh->engine == RENDEZVOUS_HASHER_ENGINE_MAGLEV ? 1 : rh->node_count;
+  return rh->lookup(rh, item_id);
+}
+
+#endif // RENDEZVOUS_HASHER_USDT
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_get_node_for(RendezvousHasher *rh,
+                        RendezvousHasherId item_id,
+                        RendezvousHasherId *node_id)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  RENDEZVOUS__PROBE2(lookup_entry, rh, item_id);
+  if (rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+#ifdef RENDEZVOUS_HASHER_USDT
+  size_t scanned;
+  *node_id = rendezvous__lookup_counted(rh, item_id, &scanned);
+  RENDEZVOUS__PROBE4(lookup_return, rh, item_id, *node_id, scanned);
+#else
+  *node_id = rh->lookup(rh, item_id);
+#endif
+  return RENDEZVOUS_HASHER_OK;
+}
+
+#if defined(__GNUC__)
+  #define RENDEZVOUS__PREFETCH(addr) __builtin_prefetch(addr)
+#else
+  #define RENDEZVOUS__PREFETCH(addr) ((void) (addr))
+#endif
+
+// Items per group of a batch lookup: the best score and node of each
+// item, its score for the current node and the combined ids
+#define RENDEZVOUS__GROUP_MAX 1024
+#define RENDEZVOUS__GROUP_ITEM_SIZE \
+  (3 * sizeof(RendezvousHasherId) + 2 * sizeof(RendezvousHasherHash))
+#define RENDEZVOUS__GROUP_SIZE                                        \
+  (RENDEZVOUS_HASHER_L1_CACHE_SIZE / 2 / RENDEZVOUS__GROUP_ITEM_SIZE \
+   > RENDEZVOUS__GROUP_MAX ? RENDEZVOUS__GROUP_MAX                    \
+   : RENDEZVOUS_HASHER_L1_CACHE_SIZE / 2 / RENDEZVOUS__GROUP_ITEM_SIZE > 0 \
+   ? RENDEZVOUS_HASHER_L1_CACHE_SIZE / 2 / RENDEZVOUS__GROUP_ITEM_SIZE : 1)
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_get_nodes_for(RendezvousHasher *rh,
+                         const RendezvousHasherId *item_ids,
+                         RendezvousHasherId *node_ids,
+                         size_t count)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!item_ids || !node_ids) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  RENDEZVOUS__PROBE2(lookup_batch_entry, rh, count);
+  if (rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+  {
+#ifdef RENDEZVOUS_HASHER_USDT
+    size_t scanned = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      size_t steps;
+      node_ids[i] = rendezvous__lookup_counted(rh, item_ids[i], &steps);
+      scanned += steps;
+    }
+    RENDEZVOUS__PROBE3(lookup_batch_return, rh, count,
+                       count ? scanned / count : 0);
+#else
+    for (size_t i = 0; i < count; ++i)
+      node_ids[i] = rh->lookup(rh, item_ids[i]);
+#endif
+    return RENDEZVOUS_HASHER_OK;
+  }
+
+  // Sized for the group actually used, not the maximum, to keep the
+  // stack of small targets
+  RendezvousHasherHash best_scores[RENDEZVOUS__GROUP_SIZE];
+  RendezvousHasherId best_ids[RENDEZVOUS__GROUP_SIZE];
+  RendezvousHasherHash scores[RENDEZVOUS__GROUP_SIZE];
+#ifdef RENDEZVOUS_HASHER_HASH_N
+  RendezvousHasherId sums[RENDEZVOUS__GROUP_SIZE];
+#endif
+
+  size_t group = RENDEZVOUS__GROUP_SIZE;
+  for (size_t base = 0; base < count; base += group)
+  {
+    const RendezvousHasherId *items = item_ids + base;
+    size_t g = count - base < group ? count - base : group;
+
+    RendezvousHasherId first = rh->chunks[0]->ids[0];
+    for (size_t k = 0; k < g; ++k)
+    {
+      best_ids[k] = first;
+      best_scores[k] = rendezvous__score_at(rh, 0, items[k]);
+    }
+
+    for (size_t c = 0; c < rh->chunk_count; ++c)
+    {
+      if (c + RENDEZVOUS_HASHER_PREFETCH_DISTANCE < rh->chunk_count)
+      {
+        const char *next = (const char *)
+          rh->chunks[c + RENDEZVOUS_HASHER_PREFETCH_DISTANCE]->ids;
+        for (size_t line = 0; line < sizeof(rh->chunks[0]->ids);
+             line += RENDEZVOUS_HASHER_CACHE_LINE)
+          RENDEZVOUS__PREFETCH(next + line);
+      }
+
+      const RendezvousHasherId *ids = rh->chunks[c]->ids;
+      size_t n = rh->node_count - c * RENDEZVOUS_HASHER_CHUNK_SIZE;
+      if (n > RENDEZVOUS_HASHER_CHUNK_SIZE) n = RENDEZVOUS_HASHER_CHUNK_SIZE;
+
+      for (size_t i = 0; i < n; ++i)
+      {
+        RendezvousHasherId node_id = ids[i];
+#ifdef RENDEZVOUS_HASHER_HASH_N
+        for (size_t k = 0; k < g; ++k)
+          sums[k] = RENDEZVOUS_HASHER_COMBINE(node_id, items[k]);
+        RENDEZVOUS_HASHER_HASH_N(sums, scores, g);
+#else
+        for (size_t k = 0; k < g; ++k)
+          scores[k] = rendezvous__score(node_id, items[k]);
+#endif
+        if (rh->weighted)
+        {
+          int log2_weight = rh->chunks[c]->log2_weights[i];
+          for (size_t k = 0; k < g; ++k)
+            scores[k] = rendezvous__weighted_score(scores[k], log2_weight);
+        }
+        // Branchless, so that the compiler can vectorize it
+        for (size_t k = 0; k < g; ++k)
+        {
+          int win = RENDEZVOUS_HASHER_BEATS(scores[k], node_id,
+                                            best_scores[k], best_ids[k]);
+          best_scores[k] = win ? scores[k] : best_scores[k];
+          best_ids[k] = win ? node_id : best_ids[k];
+        }
+      }
+    }
+
+    for (size_t k = 0; k < g; ++k) node_ids[base + k] = best_ids[k];
+  }
+
+  RENDEZVOUS__PROBE3(lookup_batch_return, rh, count, rh->node_count);
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// splitmix64
+static unsigned long long rendezvous__rng_next(unsigned long long *state)
+{
+  unsigned long long z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Newton-Raphson, so that libm is not needed
+static double rendezvous__sqrt(double x)
+{
+  if (x <= 0) return 0;
+  double r = x > 1 ? x : 1;
+  for (int i = 0; i < 64; ++i) r = 0.5 * (r + x / r);
+  return r;
+}
+
+static int rendezvous__compare_ids(const void *a, const void *b)
+{
+  RendezvousHasherId x = *(const RendezvousHasherId *) a;
+  RendezvousHasherId y = *(const RendezvousHasherId *) b;
+  return (x > y) - (y > x);
+}
+
+static size_t rendezvous__find_load(const RendezvousHasherEstimate *estimate,
+                                    RendezvousHasherId id)
+{
+  size_t lo = 0, hi = estimate->load_count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (id > estimate->loads[mid].id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Wilson score interval of [hits] successes out of [n]
+static void rendezvous__wilson(size_t hits, size_t n, double z,
+                               double *low, double *high)
+{
+  double p = (double) hits / n;
+  double z2n = z * z / n;
+  double center = (p + z2n / 2) / (1 + z2n);
+  double half = z * rendezvous__sqrt(p * (1 - p) / n + z2n / (4 * n))
+              / (1 + z2n);
+  *low = center - half < 0 ? 0 : center - half;
+  *high = center + half > 1 ? 1 : center + half;
+}
+
+#define RENDEZVOUS__ESTIMATE_BATCH 1024
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_estimate_change(RendezvousHasher *rh,
+                           const RendezvousHasherChange *changes,
+                           size_t change_count,
+                           size_t sample_size,
+                           unsigned long long rng_seed,
+                           RendezvousHasherEstimate *estimate)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!estimate || (!changes && change_count > 0)
+      || (!estimate->keys && estimate->key_count > 0))
+    return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+  if (sample_size == 0 || (estimate->keys && estimate->key_count == 0))
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  int err = RENDEZVOUS_HASHER_OK;
+  RendezvousHasherId *items = NULL, *before = NULL, *after = NULL;
+  size_t *gained = NULL, *lost = NULL;
+  estimate->loads = NULL;
+  estimate->load_count = 0;
+  estimate->samples = 0;
+  double z = estimate->z > 0 ? estimate->z : 1.96;
+
+  RendezvousHasher proposed;
+  err = rendezvous_clone(&proposed, rh);
+  for (size_t i = 0; i < change_count && err == RENDEZVOUS_HASHER_OK; ++i)
+  {
+    if (changes[i].op == RENDEZVOUS_HASHER_CHANGE_ADD)
+      err = rendezvous_add_node(&proposed, changes[i].id);
+    else
+      err = rendezvous_remove_node(&proposed, changes[i].id);
+  }
+  if (err != RENDEZVOUS_HASHER_OK) goto done;
+  if (proposed.node_count == 0)
+  {
+    err = RENDEZVOUS_HASHER_ERROR_EMPTY;
+    goto done;
+  }
+
+  // One load entry for every node before or after the change
+  estimate->loads = (RendezvousHasherNodeLoad *) RENDEZVOUS_HASHER_MALLOC(
+    (rh->node_count + proposed.node_count) * sizeof(RendezvousHasherNodeLoad));
+  items = (RendezvousHasherId *) RENDEZVOUS_HASHER_MALLOC(
+    (rh->node_count + proposed.node_count) * sizeof(RendezvousHasherId));
+  if (!estimate->loads || !items)
+  {
+    err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+    goto done;
+  }
+  for (size_t i = 0; i < rh->node_count; ++i)
+    items[i] = rendezvous_node_at(rh, i);
+  for (size_t i = 0; i < proposed.node_count; ++i)
+    items[rh->node_count + i] = rendezvous_node_at(&proposed, i);
+  qsort(items, rh->node_count + proposed.node_count,
+        sizeof(RendezvousHasherId), rendezvous__compare_ids);
+  for (size_t i = 0; i < rh->node_count + proposed.node_count; ++i)
+  {
+    if (i > 0 && items[i] == items[i - 1]) continue;
+    RendezvousHasherNodeLoad *load = &estimate->loads[estimate->load_count++];
+    load->id = items[i];
+    load->before = 0;
+    load->after = 0;
+    load->shift_half_width = 0;
+  }
+  RENDEZVOUS_HASHER_FREE(items);
+
+  items = (RendezvousHasherId *) RENDEZVOUS_HASHER_MALLOC(
+    3 * RENDEZVOUS__ESTIMATE_BATCH * sizeof(RendezvousHasherId));
+  gained = (size_t *) RENDEZVOUS_HASHER_MALLOC(
+    2 * estimate->load_count * sizeof(size_t));
+  if (!items || !gained)
+  {
+    err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+    goto done;
+  }
+  before = items + RENDEZVOUS__ESTIMATE_BATCH;
+  after = before + RENDEZVOUS__ESTIMATE_BATCH;
+  lost = gained + estimate->load_count;
+  memset(gained, 0, 2 * estimate->load_count * sizeof(size_t));
+
+  // With fewer keys than samples every key is checked once and the
+  // result is exact
+  int exhaustive = estimate->keys && estimate->key_count <= sample_size;
+  if (exhaustive) sample_size = estimate->key_count;
+
+  unsigned long long rng = rng_seed;
+  size_t moved = 0;
+  while (estimate->samples < sample_size)
+  {
+    size_t n = sample_size - estimate->samples;
+    if (n > RENDEZVOUS__ESTIMATE_BATCH) n = RENDEZVOUS__ESTIMATE_BATCH;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (exhaustive)
+        items[i] = estimate->keys[estimate->samples + i];
+      else if (estimate->keys)
+        items[i] = estimate->keys[rendezvous__rng_next(&rng)
+                                  % estimate->key_count];
+      else
+        items[i] = (RendezvousHasherId) rendezvous__rng_next(&rng);
+    }
+    rendezvous_get_nodes_for(rh, items, before, n);
+    rendezvous_get_nodes_for(&proposed, items, after, n);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+      size_t b = rendezvous__find_load(estimate, before[i]);
+      estimate->loads[b].before++;
+      estimate->loads[rendezvous__find_load(estimate, after[i])].after++;
+      if (before[i] == after[i]) continue;
+      moved++;
+      lost[b]++;
+      gained[rendezvous__find_load(estimate, after[i])]++;
+    }
+    estimate->samples += n;
+
+    if (estimate->target_half_width > 0 && !exhaustive)
+    {
+      double low, high;
+      rendezvous__wilson(moved, estimate->samples, z, &low, &high);
+      if ((high - low) / 2 <= estimate->target_half_width) break;
+    }
+  }
+
+  double samples = (double) estimate->samples;
+  estimate->moved = moved / samples;
+  rendezvous__wilson(moved, estimate->samples, z,
+                     &estimate->moved_low, &estimate->moved_high);
+  if (exhaustive)
+  {
+    estimate->moved_low = estimate->moved;
+    estimate->moved_high = estimate->moved;
+  }
+
+  // The shift of a node is the mean of a per item variable which is
+  // +1 if the item moves to the node, -1 if it moves away from it
+  for (size_t i = 0; i < estimate->load_count; ++i)
+  {
+    RendezvousHasherNodeLoad *load = &estimate->loads[i];
+    load->before /= samples;
+    load->after /= samples;
+    double shift = load->after - load->before;
+    double var = (gained[i] + lost[i]) / samples - shift * shift;
+    load->shift_half_width = exhaustive ? 0
+      : z * rendezvous__sqrt(var / samples);
+  }
+
+ done:
+  if (items) RENDEZVOUS_HASHER_FREE(items);
+  if (gained) RENDEZVOUS_HASHER_FREE(gained);
+  rendezvous_free(&proposed);
+  if (err != RENDEZVOUS_HASHER_OK) rendezvous_estimate_free(estimate);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_estimate_free(RendezvousHasherEstimate *estimate)
+{
+  if (!estimate) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (estimate->loads) RENDEZVOUS_HASHER_FREE(estimate->loads);
+  estimate->loads = NULL;
+  estimate->load_count = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Scratch space of the placement functions, one entry per node
+typedef struct {
+  RendezvousHasherHash *scores;
+  RendezvousHasherId *ids;
+  unsigned int *domains;     // NULL without failure domains
+  unsigned int *node_domains;
+  size_t domain_cap;         // Max shards in a domain
+} RendezvousHasherPlaceScratch;
+
+static int rendezvous__place_begin(const RendezvousHasher *rh,
+                                   const RendezvousHasherPlacement *rule,
+                                   RendezvousHasherPlaceScratch *scratch)
+{
+  size_t n = rh->node_count;
+  scratch->domains = NULL;
+  scratch->node_domains = NULL;
+  scratch->domain_cap = rule->shards;
+  scratch->scores = (RendezvousHasherHash *)
+    RENDEZVOUS_HASHER_MALLOC(n * sizeof(RendezvousHasherHash));
+  scratch->ids = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC(n * sizeof(RendezvousHasherId));
+  if (!scratch->scores || !scratch->ids) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  if (!rule->domain_of) return RENDEZVOUS_HASHER_OK;
+
+  scratch->domains = (unsigned int *)
+    RENDEZVOUS_HASHER_MALLOC(2 * n * sizeof(unsigned int));
+  if (!scratch->domains) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  scratch->node_domains = scratch->domains + n;
+  for (size_t i = 0; i < n; ++i)
+    scratch->node_domains[i] = rule->domain_of(rendezvous_node_at(rh, i),
+                                               rule->user);
+
+  // Count the distinct domains to get the cap
+  size_t distinct = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    size_t j = 0;
+    while (j < distinct && scratch->domains[j] != scratch->node_domains[i]) j++;
+    if (j == distinct) scratch->domains[distinct++] = scratch->node_domains[i];
+  }
+  scratch->domain_cap = (rule->shards + distinct - 1) / distinct;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static void rendezvous__place_end(RendezvousHasherPlaceScratch *scratch)
+{
+  if (scratch->scores) RENDEZVOUS_HASHER_FREE(scratch->scores);
+  if (scratch->ids) RENDEZVOUS_HASHER_FREE(scratch->ids);
+  if (scratch->domains) RENDEZVOUS_HASHER_FREE(scratch->domains);
+}
+
+// Selection sort of the first [shards] nodes by score, the candidates
+// at [chosen, n) whose domain is full are skipped in the first pass
+static void rendezvous__place_one(const RendezvousHasher *rh,
+                                  size_t shards,
+                                  RendezvousHasherId item_id,
+                                  RendezvousHasherPlaceScratch *scratch,
+                                  RendezvousHasherId *shard_nodes)
+{
+  size_t n = rh->node_count;
+  RendezvousHasherHash *scores = scratch->scores;
+  RendezvousHasherId *ids = scratch->ids;
+  unsigned int *domains = scratch->domains;
+  for (size_t i = 0; i < n; ++i)
+  {
+    ids[i] = rendezvous_node_at(rh, i);
+    scores[i] = rendezvous__score_at(rh, i, item_id);
+    if (domains) domains[i] = scratch->node_domains[i];
+  }
+
+  size_t chosen = 0;
+  for (int spread = domains != NULL; spread >= 0 && chosen < shards; --spread)
+  {
+    while (chosen < shards)
+    {
+      size_t best = n;
+      for (size_t i = chosen; i < n; ++i)
+      {
+        if (best != n && !RENDEZVOUS_HASHER_BEATS(scores[i], ids[i],
+                                                  scores[best], ids[best]))
+          continue;
+        if (spread)
+        {
+          size_t used = 0;
+          for (size_t j = 0; j < chosen; ++j) used += domains[j] == domains[i];
+          if (used >= scratch->domain_cap) continue;
+        }
+        best = i;
+      }
+      if (best == n) break;
+
+      RendezvousHasherHash score = scores[best];
+      RendezvousHasherId id = ids[best];
+      scores[best] = scores[chosen];
+      ids[best] = ids[chosen];
+      scores[chosen] = score;
+      ids[chosen] = id;
+      if (domains)
+      {
+        unsigned int domain = domains[best];
+        domains[best] = domains[chosen];
+        domains[chosen] = domain;
+      }
+      shard_nodes[chosen++] = id;
+    }
+  }
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_get_top_nodes(RendezvousHasher *rh,
+                         RendezvousHasherId item_id,
+                         size_t count,
+                         RendezvousHasherId *node_ids)
+{
+  RendezvousHasherPlacement rule = { count, NULL, NULL };
+  return rendezvous_place(rh, &rule, item_id, node_ids);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place(RendezvousHasher *rh,
+                 const RendezvousHasherPlacement *rule,
+                 RendezvousHasherId item_id,
+                 RendezvousHasherId *shard_nodes)
+{
+  return rendezvous_place_batch(rh, rule, &item_id, 1, shard_nodes);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place_batch(RendezvousHasher *rh,
+                       const RendezvousHasherPlacement *rule,
+                       const RendezvousHasherId *item_ids,
+                       size_t count,
+                       RendezvousHasherId *shard_nodes)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rule || !item_ids || !shard_nodes)
+    return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+  if (rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+  if (rule->shards == 0 || rule->shards > rh->node_count)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherPlaceScratch scratch;
+  int err = rendezvous__place_begin(rh, rule, &scratch);
+  if (err == RENDEZVOUS_HASHER_OK)
+  {
+    for (size_t i = 0; i < count; ++i)
+      rendezvous__place_one(rh, rule->shards, item_ids[i], &scratch,
+                            shard_nodes + i * rule->shards);
+  }
+  rendezvous__place_end(&scratch);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_place_repair(RendezvousHasher *rh,
+                        const RendezvousHasherPlacement *rule,
+                        RendezvousHasherId item_id,
+                        RendezvousHasherId *shard_nodes,
+                        RendezvousHasherId lost_node,
+                        size_t *shard)
+{
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rule || !shard_nodes) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+  if (rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+  size_t lost = 0;
+  while (lost < rule->shards && !(shard_nodes[lost] == lost_node)) lost++;
+  if (lost == rule->shards) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherPlaceScratch scratch;
+  int err = rendezvous__place_begin(rh, rule, &scratch);
+  if (err != RENDEZVOUS_HASHER_OK)
+  {
+    rendezvous__place_end(&scratch);
+    return err;
+  }
+
+  // Domains of the shards that stay
+  unsigned int *kept = NULL;
+  if (rule->domain_of)
+  {
+    kept = (unsigned int *)
+      RENDEZVOUS_HASHER_MALLOC(rule->shards * sizeof(unsigned int));
+    if (!kept)
+    {
+      rendezvous__place_end(&scratch);
+      return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    }
+    for (size_t j = 0; j < rule->shards; ++j)
+      kept[j] = j == lost ? 0 : rule->domain_of(shard_nodes[j], rule->user);
+  }
+
+  size_t best = rh->node_count;
+  for (int spread = kept != NULL; spread >= 0 && best == rh->node_count; --spread)
+  {
+    for (size_t i = 0; i < rh->node_count; ++i)
+    {
+      RendezvousHasherId id = rendezvous_node_at(rh, i);
+      size_t j = 0;
+      while (j < rule->shards && !(shard_nodes[j] == id)) j++;
+      if (j < rule->shards) continue;
+
+      RendezvousHasherHash score = rendezvous__score_at(rh, i, item_id);
+      if (best != rh->node_count
+          && !RENDEZVOUS_HASHER_BEATS(score, id, scratch.scores[0],
+                                      scratch.ids[0]))
+        continue;
+      if (spread)
+      {
+        size_t used = 0;
+        for (j = 0; j < rule->shards; ++j)
+          used += j != lost && kept[j] == scratch.node_domains[i];
+        if (used >= scratch.domain_cap) continue;
+      }
+      best = i;
+      scratch.scores[0] = score;
+      scratch.ids[0] = id;
+    }
+  }
+
+  if (best == rh->node_count) err = RENDEZVOUS_HASHER_ERROR_EMPTY;
+  else
+  {
+    shard_nodes[lost] = scratch.ids[0];
+    if (shard) *shard = lost;
+  }
+  if (kept) RENDEZVOUS_HASHER_FREE(kept);
+  rendezvous__place_end(&scratch);
+  return err;
+}
+
+#define RENDEZVOUS__INDEX_NONE ((size_t) -1)
+
+static size_t rendezvous__index_home(RendezvousHasherId id, size_t capacity)
+{
+  return (size_t) RENDEZVOUS_HASHER_HASH(id) & (capacity - 1);
+}
+
+// Slot of [item_id] in the item map, or the empty slot that ends its
+// cluster
+static size_t rendezvous__index_item_slot(const RendezvousHasherIndex *index,
+                                          RendezvousHasherId item_id)
+{
+  size_t mask = index->item_map_capacity - 1;
+  size_t slot = rendezvous__index_home(item_id, index->item_map_capacity);
+  while (index->item_map[slot]
+         && !(index->items[index->item_map[slot] - 1].item_id == item_id))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Make room in the item map for [count] items, at most half full
+static int rendezvous__index_item_reserve(RendezvousHasherIndex *index,
+                                          size_t count)
+{
+  if (2 * count <= index->item_map_capacity) return RENDEZVOUS_HASHER_OK;
+  size_t capacity = 16;
+  while (capacity < 2 * count) capacity *= 2;
+  size_t *map = (size_t *) RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(size_t));
+  if (!map) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  memset(map, 0, capacity * sizeof(size_t));
+  for (size_t i = 0; i < index->count; ++i)
+  {
+    size_t slot = rendezvous__index_home(index->items[i].item_id, capacity);
+    while (map[slot]) slot = (slot + 1) & (capacity - 1);
+    map[slot] = i + 1;
+  }
+  if (index->item_map) RENDEZVOUS_HASHER_FREE(index->item_map);
+  index->item_map = map;
+  index->item_map_capacity = capacity;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Empty the slot [hole] of the item map, the following slots of its
+// cluster are shifted back as in the id map of the hasher
+static void rendezvous__index_item_erase(RendezvousHasherIndex *index,
+                                         size_t hole)
+{
+  size_t mask = index->item_map_capacity - 1;
+  for (size_t slot = (hole + 1) & mask; index->item_map[slot];
+       slot = (slot + 1) & mask)
+  {
+    size_t home = rendezvous__index_home(
+      index->items[index->item_map[slot] - 1].item_id,
+      index->item_map_capacity);
+    if (((slot - home) & mask) < ((slot - hole) & mask)) continue;
+    index->item_map[hole] = index->item_map[slot];
+    hole = slot;
+  }
+  index->item_map[hole] = 0;
+}
+
+// Slot of owner [id], or the empty slot that ends its cluster
+static size_t rendezvous__index_owner_slot(const RendezvousHasherIndex *index,
+                                           RendezvousHasherId id)
+{
+  size_t mask = index->owner_capacity - 1;
+  size_t slot = rendezvous__index_home(id, index->owner_capacity);
+  while (index->owners[slot].head != RENDEZVOUS__INDEX_NONE
+         && !(index->owners[slot].id == id))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Make room for an owner per node of the hasher, plus one for a node
+// being added, so that linking an item never allocates
+static int rendezvous__index_owner_reserve(RendezvousHasherIndex *index)
+{
+  size_t count = index->rh->node_count + 1;
+  if (2 * count <= index->owner_capacity) return RENDEZVOUS_HASHER_OK;
+  size_t capacity = 16;
+  while (capacity < 2 * count) capacity *= 2;
+  RendezvousHasherIndexOwner *owners = (RendezvousHasherIndexOwner *)
+    RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherIndexOwner));
+  if (!owners) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  for (size_t slot = 0; slot < capacity; ++slot)
+    owners[slot].head = RENDEZVOUS__INDEX_NONE;
+  for (size_t old = 0; old < index->owner_capacity; ++old)
+  {
+    if (index->owners[old].head == RENDEZVOUS__INDEX_NONE) continue;
+    size_t slot = rendezvous__index_home(index->owners[old].id, capacity);
+    while (owners[slot].head != RENDEZVOUS__INDEX_NONE)
+      slot = (slot + 1) & (capacity - 1);
+    owners[slot] = index->owners[old];
+  }
+  if (index->owners) RENDEZVOUS_HASHER_FREE(index->owners);
+  index->owners = owners;
+  index->owner_capacity = capacity;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static void rendezvous__index_owner_erase(RendezvousHasherIndex *index,
+                                          size_t hole)
+{
+  size_t mask = index->owner_capacity - 1;
+  for (size_t slot = (hole + 1) & mask;
+       index->owners[slot].head != RENDEZVOUS__INDEX_NONE;
+       slot = (slot + 1) & mask)
+  {
+    size_t home = rendezvous__index_home(index->owners[slot].id,
+                                         index->owner_capacity);
+    if (((slot - home) & mask) < ((slot - hole) & mask)) continue;
+    index->owners[hole] = index->owners[slot];
+    hole = slot;
+  }
+  index->owners[hole].head = RENDEZVOUS__INDEX_NONE;
+  index->owner_count--;
+}
+
+// Add the item at [i] to the list of its owner
+static void rendezvous__index_link(RendezvousHasherIndex *index, size_t i)
+{
+  RendezvousHasherIndexEntry *entry = &index->items[i];
+  size_t slot = rendezvous__index_owner_slot(index, entry->owner);
+  RendezvousHasherIndexOwner *owner = &index->owners[slot];
+  if (owner->head == RENDEZVOUS__INDEX_NONE)
+  {
+    owner->id = entry->owner;
+    index->owner_count++;
+  }
+  else
+  {
+    index->items[owner->head].prev = i;
+  }
+  entry->prev = RENDEZVOUS__INDEX_NONE;
+  entry->next = owner->head;
+  owner->head = i;
+}
+
+// Remove the item at [i] from the list of its owner
+static void rendezvous__index_unlink(RendezvousHasherIndex *index, size_t i)
+{
+  RendezvousHasherIndexEntry *entry = &index->items[i];
+  if (entry->next != RENDEZVOUS__INDEX_NONE)
+    index->items[entry->next].prev = entry->prev;
+  if (entry->prev != RENDEZVOUS__INDEX_NONE)
+  {
+    index->items[entry->prev].next = entry->next;
+    return;
+  }
+  size_t slot = rendezvous__index_owner_slot(index, entry->owner);
+  index->owners[slot].head = entry->next;
+  if (entry->next == RENDEZVOUS__INDEX_NONE)
+    rendezvous__index_owner_erase(index, slot);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_init(RendezvousHasherIndex *index,
+                      RendezvousHasher *rh,
+                      RendezvousHasherMoveFn on_move,
+                      void *user)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+
+  memset(index, 0, sizeof(*index));
+  index->rh = rh;
+  index->on_move = on_move;
+  index->user = user;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_free(RendezvousHasherIndex *index)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (index->items) RENDEZVOUS_HASHER_FREE(index->items);
+  if (index->item_map) RENDEZVOUS_HASHER_FREE(index->item_map);
+  if (index->owners) RENDEZVOUS_HASHER_FREE(index->owners);
+  index->items = NULL;
+  index->count = 0;
+  index->capacity = 0;
+  index->item_map = NULL;
+  index->item_map_capacity = 0;
+  index->owners = NULL;
+  index->owner_count = 0;
+  index->owner_capacity = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_register(RendezvousHasherIndex *index,
+                          RendezvousHasherId item_id,
+                          RendezvousHasherId *node_id)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (index->rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+  if (index->item_map)
+  {
+    size_t slot = rendezvous__index_item_slot(index, item_id);
+    if (index->item_map[slot])
+    {
+      if (node_id) *node_id = index->items[index->item_map[slot] - 1].owner;
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+    }
+  }
+
+  if (index->count == index->capacity)
+  {
+    size_t capacity = index->capacity ? index->capacity * 2 : 64;
+    RendezvousHasherIndexEntry *items = (RendezvousHasherIndexEntry *)
+      RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherIndexEntry));
+    if (!items) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    if (index->items)
+    {
+      memcpy(items, index->items,
+             index->count * sizeof(RendezvousHasherIndexEntry));
+      RENDEZVOUS_HASHER_FREE(index->items);
+    }
+    index->items = items;
+    index->capacity = capacity;
+  }
+  if (rendezvous__index_item_reserve(index, index->count + 1)
+        != RENDEZVOUS_HASHER_OK
+      || rendezvous__index_owner_reserve(index) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+
+  size_t i = index->count++;
+  RendezvousHasherIndexEntry *entry = &index->items[i];
+  entry->item_id = item_id;
+  rendezvous__lookup(index->rh, item_id, &entry->owner, &entry->score);
+  index->item_map[rendezvous__index_item_slot(index, item_id)] = i + 1;
+  rendezvous__index_link(index, i);
+  if (node_id) *node_id = entry->owner;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_unregister(RendezvousHasherIndex *index,
+                            RendezvousHasherId item_id)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!index->item_map) return RENDEZVOUS_HASHER_OK;
+
+  size_t slot = rendezvous__index_item_slot(index, item_id);
+  if (!index->item_map[slot]) return RENDEZVOUS_HASHER_OK;
+  size_t i = index->item_map[slot] - 1;
+  rendezvous__index_unlink(index, i);
+  rendezvous__index_item_erase(index, slot);
+
+  // Move the last item in the hole, and repoint what pointed to it
+  size_t last = --index->count;
+  if (i == last) return RENDEZVOUS_HASHER_OK;
+  RendezvousHasherIndexEntry *entry = &index->items[i];
+  *entry = index->items[last];
+  index->item_map[rendezvous__index_item_slot(index, entry->item_id)] = i + 1;
+  if (entry->next != RENDEZVOUS__INDEX_NONE)
+    index->items[entry->next].prev = i;
+  if (entry->prev != RENDEZVOUS__INDEX_NONE)
+    index->items[entry->prev].next = i;
+  else
+    index->owners[rendezvous__index_owner_slot(index, entry->owner)].head = i;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_owner(RendezvousHasherIndex *index,
+                       RendezvousHasherId item_id,
+                       RendezvousHasherId *node_id)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (!index->item_map) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  size_t slot = rendezvous__index_item_slot(index, item_id);
+  if (!index->item_map[slot]) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  *node_id = index->items[index->item_map[slot] - 1].owner;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_add_node(RendezvousHasherIndex *index,
+                          RendezvousHasherId id)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (rendezvous__index_owner_reserve(index) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  int err = rendezvous_add_node(index->rh, id);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  // The other scores do not change, an item moves only if the new
+  // node beats its current owner
+  size_t last = index->rh->node_count - 1;
+  for (size_t i = 0; i < index->count; ++i)
+  {
+    RendezvousHasherIndexEntry *entry = &index->items[i];
+    RendezvousHasherHash score =
+      rendezvous__score_at(index->rh, last, entry->item_id);
+    if (!RENDEZVOUS_HASHER_BEATS(score, id, entry->score, entry->owner))
+      continue;
+
+    RendezvousHasherId from = entry->owner;
+    rendezvous__index_unlink(index, i);
+    entry->owner = id;
+    entry->score = score;
+    rendezvous__index_link(index, i);
+    if (index->on_move) index->on_move(entry->item_id, from, id, index->user);
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_set_weight(RendezvousHasherIndex *index,
+                            RendezvousHasherId id,
+                            unsigned int weight)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  size_t position;
+  int err = rendezvous_find_node(index->rh, id, &position);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+  err = rendezvous_set_weight(index->rh, id, weight);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  // Only the score of [id] changed: its items are looked up again,
+  // the others move to it if it beats their owner now
+  for (size_t i = 0; i < index->count; ++i)
+  {
+    RendezvousHasherIndexEntry *entry = &index->items[i];
+    RendezvousHasherId from = entry->owner;
+    if (from == id)
+    {
+      rendezvous__lookup(index->rh, entry->item_id,
+                         &entry->owner, &entry->score);
+      if (entry->owner == id) continue;
+      RendezvousHasherId to = entry->owner;
+      entry->owner = from;
+      rendezvous__index_unlink(index, i);
+      entry->owner = to;
+      rendezvous__index_link(index, i);
+      if (index->on_move) index->on_move(entry->item_id, from, to, index->user);
+      continue;
+    }
+
+    RendezvousHasherHash score =
+      rendezvous__score_at(index->rh, position, entry->item_id);
+    if (!RENDEZVOUS_HASHER_BEATS(score, id, entry->score, entry->owner))
+      continue;
+    rendezvous__index_unlink(index, i);
+    entry->owner = id;
+    entry->score = score;
+    rendezvous__index_link(index, i);
+    if (index->on_move) index->on_move(entry->item_id, from, id, index->user);
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_index_remove_node(RendezvousHasherIndex *index,
+                             RendezvousHasherId id)
+{
+  if (!index) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (index->count > 0 && index->rh->node_count == 1
+      && index->rh->chunks[0]->ids[0] == id)
+    return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+  int err = rendezvous_remove_node(index->rh, id);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+  if (index->owner_count == 0) return RENDEZVOUS_HASHER_OK;
+
+  // Only the items owned by the removed node can move: its list is
+  // detached, then each item is linked to its new owner
+  size_t slot = rendezvous__index_owner_slot(index, id);
+  size_t i = index->owners[slot].head;
+  if (i == RENDEZVOUS__INDEX_NONE) return RENDEZVOUS_HASHER_OK;
+  rendezvous__index_owner_erase(index, slot);
+  while (i != RENDEZVOUS__INDEX_NONE)
+  {
+    RendezvousHasherIndexEntry *entry = &index->items[i];
+    size_t next = entry->next;
+    rendezvous__lookup(index->rh, entry->item_id,
+                       &entry->owner, &entry->score);
+    rendezvous__index_link(index, i);
+    if (index->on_move)
+      index->on_move(entry->item_id, id, entry->owner, index->user);
+    i = next;
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_init(RendezvousHasherController *controller,
+                           RendezvousHasher *rh,
+                           const RendezvousHasherControllerConfig *config)
+{
+  if (!controller) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (!rh->weighted) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherControllerConfig c = {0};
+  if (config) c = *config;
+  if (c.base_weight == 0) c.base_weight = 1000;
+  if (c.min_weight == 0)
+    c.min_weight = c.base_weight / 10 ? c.base_weight / 10 : 1;
+  if (c.max_weight == 0)
+    c.max_weight = c.base_weight <= UINT_MAX / 10
+      ? c.base_weight * 10 : UINT_MAX;
+  if (c.gain <= 0) c.gain = 0.5;
+  if (c.max_moved <= 0) c.max_moved = 0.05;
+  if (c.min_weight > c.base_weight || c.max_weight < c.base_weight
+      || c.gain > 1 || c.max_moved > 1)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  controller->rh = rh;
+  controller->config = c;
+  controller->nodes = NULL;
+  controller->node_count = 0;
+  controller->node_capacity = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_free(RendezvousHasherController *controller)
+{
+  if (!controller) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (controller->nodes) RENDEZVOUS_HASHER_FREE(controller->nodes);
+  controller->nodes = NULL;
+  controller->node_count = 0;
+  controller->node_capacity = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Position of [id] in the nodes of [controller], or where it goes
+static size_t
+rendezvous__controller_find(const RendezvousHasherController *controller,
+                            RendezvousHasherId id)
+{
+  size_t lo = 0, hi = controller->node_count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (id > controller->nodes[mid].id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_report(RendezvousHasherController *controller,
+                             RendezvousHasherId id,
+                             double load)
+{
+  if (!controller) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  size_t index;
+  if (rendezvous_find_node(controller->rh, id, &index) != RENDEZVOUS_HASHER_OK
+      || !(load >= 0))
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  size_t i = rendezvous__controller_find(controller, id);
+  if (i == controller->node_count || !(controller->nodes[i].id == id))
+  {
+    if (controller->node_count == controller->node_capacity)
+    {
+      size_t capacity = controller->node_capacity
+        ? controller->node_capacity * 2 : 16;
+      RendezvousHasherControllerNode *nodes = (RendezvousHasherControllerNode *)
+        RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherControllerNode));
+      if (!nodes) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+      if (controller->nodes)
+      {
+        memcpy(nodes, controller->nodes,
+               controller->node_count * sizeof(RendezvousHasherControllerNode));
+        RENDEZVOUS_HASHER_FREE(controller->nodes);
+      }
+      controller->nodes = nodes;
+      controller->node_capacity = capacity;
+    }
+    memmove(&controller->nodes[i + 1], &controller->nodes[i],
+            (controller->node_count - i) * sizeof(RendezvousHasherControllerNode));
+    controller->node_count++;
+    controller->nodes[i].id = id;
+    controller->nodes[i].weight = controller->config.base_weight;
+    controller->nodes[i].load = 0;
+    controller->nodes[i].samples = 0;
+  }
+
+  controller->nodes[i].load += load;
+  controller->nodes[i].samples++;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Fraction of the items that move when the weights go from [weights]
+// to [targets] scaled by [scale]: half the total change of the shares
+static double
+rendezvous__controller_moved(const RendezvousHasherController *controller,
+                             double base_total,
+                             const double *targets,
+                             double scale)
+{
+  double total = base_total, new_total = base_total;
+  for (size_t i = 0; i < controller->node_count; ++i)
+  {
+    double w = controller->nodes[i].weight;
+    total += w;
+    new_total += w + scale * (targets[i] - w);
+  }
+
+  double moved = 0;
+  for (size_t i = 0; i < controller->node_count; ++i)
+  {
+    double w = controller->nodes[i].weight;
+    double share = w / total - (w + scale * (targets[i] - w)) / new_total;
+    moved += share < 0 ? -share : share;
+  }
+  // The nodes without a controller entry keep their weight
+  double share = base_total / total - base_total / new_total;
+  moved += share < 0 ? -share : share;
+  return moved / 2;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_controller_step(RendezvousHasherController *controller,
+                           double *moved)
+{
+  if (!controller) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (moved) *moved = 0;
+
+  // Forget the nodes that left the hasher
+  size_t kept = 0;
+  size_t index;
+  for (size_t i = 0; i < controller->node_count; ++i)
+    if (rendezvous_find_node(controller->rh, controller->nodes[i].id, &index)
+        == RENDEZVOUS_HASHER_OK)
+      controller->nodes[kept++] = controller->nodes[i];
+  controller->node_count = kept;
+  if (kept == 0) return RENDEZVOUS_HASHER_OK;
+
+  double *targets = (double *)
+    RENDEZVOUS_HASHER_MALLOC(kept * sizeof(double));
+  if (!targets) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+
+  const RendezvousHasherControllerConfig *c = &controller->config;
+  double mean = 0;
+  size_t sampled = 0;
+  for (size_t i = 0; i < kept; ++i)
+  {
+    RendezvousHasherControllerNode *node = &controller->nodes[i];
+    if (node->samples == 0) continue;
+    mean += node->load / node->samples;
+    sampled++;
+  }
+  mean = sampled ? mean / sampled : 0;
+
+  for (size_t i = 0; i < kept; ++i)
+  {
+    RendezvousHasherControllerNode *node = &controller->nodes[i];
+    double target = node->weight;
+    if (node->samples > 0 && mean > 0)
+    {
+      double load = node->load / node->samples;
+      // An idle node doubles at most
+      double error = load > 0 ? (mean - load) / load : 1;
+      target = node->weight * (1 + c->gain * (error > 1 ? 1 : error));
+    }
+    if (target < c->min_weight) target = c->min_weight;
+    if (target > c->max_weight) target = c->max_weight;
+    targets[i] = target;
+  }
+
+  // The nodes of the hasher without samples so far have the base weight
+  double base_total = (double) c->base_weight
+    * (double) (rendezvous_node_count(controller->rh) - kept);
+  double scale = 1;
+  double estimate = rendezvous__controller_moved(controller, base_total,
+                                                 targets, scale);
+  if (estimate > c->max_moved)
+  {
+    scale = c->max_moved / estimate;
+    estimate = rendezvous__controller_moved(controller, base_total,
+                                            targets, scale);
+    for (int i = 0; i < 32 && estimate > c->max_moved; ++i)
+    {
+      scale /= 2;
+      estimate = rendezvous__controller_moved(controller, base_total,
+                                              targets, scale);
+    }
+  }
+
+  // A weight is committed only once the hasher has it, a node that
+  // failed keeps its weight and samples for the next step
+  int err = RENDEZVOUS_HASHER_OK;
+  for (size_t i = 0; i < kept; ++i)
+  {
+    RendezvousHasherControllerNode *node = &controller->nodes[i];
+    double weight = node->weight + scale * (targets[i] - node->weight);
+    unsigned int before = (unsigned int) (node->weight + 0.5);
+    unsigned int after = (unsigned int) (weight + 0.5);
+    if (after != before)
+    {
+      int set = rendezvous_set_weight(controller->rh, node->id, after);
+      if (set != RENDEZVOUS_HASHER_OK)
+      {
+        if (err == RENDEZVOUS_HASHER_OK) err = set;
+        continue;
+      }
+    }
+    node->weight = weight;
+    node->load = 0;
+    node->samples = 0;
+  }
+  RENDEZVOUS_HASHER_FREE(targets);
+
+  if (moved) *moved = estimate;
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_init(RendezvousHasherHotKeys *hot,
+                    RendezvousHasher *rh,
+                    const RendezvousHasherHotKeysConfig *config)
+{
+  if (!hot) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->engine != RENDEZVOUS_HASHER_ENGINE_HRW)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+
+  RendezvousHasherHotKeysConfig c = {0};
+  if (config) c = *config;
+  if (c.counters == 0) c.counters = 64;
+  if (c.sample_period == 0) c.sample_period = 16;
+  if (c.threshold <= 0) c.threshold = 0.01;
+  if (c.fan_out == 0) c.fan_out = 3;
+  if (c.decay_period == 0) c.decay_period = 65536;
+  if (c.fan_out > RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX || c.threshold > 1)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  // The index is at most half full
+  size_t capacity = 16;
+  while (capacity < 2 * c.counters) capacity *= 2;
+  hot->counters = (RendezvousHasherHotCounter *)
+    RENDEZVOUS_HASHER_MALLOC(c.counters * sizeof(RendezvousHasherHotCounter));
+  hot->hot = (RendezvousHasherHotKey *)
+    RENDEZVOUS_HASHER_MALLOC(c.counters * sizeof(RendezvousHasherHotKey));
+  hot->index = (size_t *) RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(size_t));
+  if (!hot->counters || !hot->hot || !hot->index)
+  {
+    if (hot->counters) RENDEZVOUS_HASHER_FREE(hot->counters);
+    if (hot->hot) RENDEZVOUS_HASHER_FREE(hot->hot);
+    if (hot->index) RENDEZVOUS_HASHER_FREE(hot->index);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  memset(hot->index, 0, capacity * sizeof(size_t));
+  hot->index_capacity = capacity;
+  hot->rh = rh;
+  hot->config = c;
+  hot->counter_count = 0;
+  hot->hot_count = 0;
+  hot->sampled = 0;
+  hot->countdown = 1;
+  hot->rng = 0x2545f4914f6cdd1dULL;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_free(RendezvousHasherHotKeys *hot)
+{
+  if (!hot) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (hot->counters) RENDEZVOUS_HASHER_FREE(hot->counters);
+  if (hot->hot) RENDEZVOUS_HASHER_FREE(hot->hot);
+  if (hot->index) RENDEZVOUS_HASHER_FREE(hot->index);
+  hot->counters = NULL;
+  hot->hot = NULL;
+  hot->index = NULL;
+  hot->counter_count = 0;
+  hot->hot_count = 0;
+  hot->index_capacity = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static size_t rendezvous__hot_home(const RendezvousHasherHotKeys *hot,
+                                   RendezvousHasherId item_id)
+{
+  return (size_t) RENDEZVOUS_HASHER_HASH(item_id) & (hot->index_capacity - 1);
+}
+
+// Slot of [item_id] in the index, or the empty slot where it goes
+static size_t rendezvous__hot_slot(const RendezvousHasherHotKeys *hot,
+                                   RendezvousHasherId item_id)
+{
+  size_t mask = hot->index_capacity - 1;
+  size_t slot = rendezvous__hot_home(hot, item_id);
+  while (hot->index[slot]
+         && !(hot->counters[hot->index[slot] - 1].item_id == item_id))
+    slot = (slot + 1) & mask;
+  return slot;
+}
+
+// Remove [item_id] from the index, the following slots of its cluster
+// are shifted back like in the id map
+static void rendezvous__hot_erase(RendezvousHasherHotKeys *hot,
+                                  RendezvousHasherId item_id)
+{
+  size_t mask = hot->index_capacity - 1;
+  size_t hole = rendezvous__hot_slot(hot, item_id);
+  for (size_t slot = (hole + 1) & mask; hot->index[slot];
+       slot = (slot + 1) & mask)
+  {
+    size_t home = rendezvous__hot_home(
+      hot, hot->counters[hot->index[slot] - 1].item_id);
+    if (((slot - home) & mask) < ((slot - hole) & mask)) continue;
+    hot->index[hole] = hot->index[slot];
+    hole = slot;
+  }
+  hot->index[hole] = 0;
+}
+
+// Swap the counters [a] and [b] of the heap, and their index slots
+static void rendezvous__hot_swap(RendezvousHasherHotKeys *hot,
+                                 size_t a, size_t b)
+{
+  size_t slot_a = rendezvous__hot_slot(hot, hot->counters[a].item_id);
+  size_t slot_b = rendezvous__hot_slot(hot, hot->counters[b].item_id);
+  RendezvousHasherHotCounter counter = hot->counters[a];
+  hot->counters[a] = hot->counters[b];
+  hot->counters[b] = counter;
+  hot->index[slot_a] = b + 1;
+  hot->index[slot_b] = a + 1;
+}
+
+// Restore the heap after the count of counter [i] changed, returns
+// where the counter ends up
+static size_t rendezvous__hot_sift(RendezvousHasherHotKeys *hot, size_t i)
+{
+  while (i > 0 && hot->counters[i].count < hot->counters[(i - 1) / 2].count)
+  {
+    rendezvous__hot_swap(hot, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  for (;;)
+  {
+    size_t min = i;
+    size_t left = 2 * i + 1, right = 2 * i + 2;
+    if (left < hot->counter_count
+        && hot->counters[left].count < hot->counters[min].count)
+      min = left;
+    if (right < hot->counter_count
+        && hot->counters[right].count < hot->counters[min].count)
+      min = right;
+    if (min == i) return i;
+    rendezvous__hot_swap(hot, i, min);
+    i = min;
+  }
+}
+
+static RendezvousHasherHotKey *
+rendezvous__hot_find(const RendezvousHasherHotKeys *hot,
+                     RendezvousHasherId item_id)
+{
+  if (hot->index_capacity == 0) return NULL;
+  size_t counter = hot->index[rendezvous__hot_slot(hot, item_id)];
+  if (counter == 0 || hot->counters[counter - 1].hot == 0) return NULL;
+  return &hot->hot[hot->counters[counter - 1].hot - 1];
+}
+
+// Samples a key needs at least to be hot, fewer are noise
+#define RENDEZVOUS__HOT_MIN_COUNT 8
+
+// A key is hot if it was surely seen in more than threshold of the
+// samples
+static int rendezvous__hot_qualifies(const RendezvousHasherHotKeys *hot,
+                                     const RendezvousHasherHotCounter *counter)
+{
+  unsigned long seen = counter->count - counter->error;
+  return seen >= RENDEZVOUS__HOT_MIN_COUNT
+    && (double) seen >= hot->config.threshold * (double) hot->sampled;
+}
+
+// Count [item_id] in the sketch and update the hot keys
+static void rendezvous__hot_sample(RendezvousHasherHotKeys *hot,
+                                   RendezvousHasherId item_id)
+{
+  // Space-saving: a new key replaces the smallest counter, the root of
+  // the heap, and inherits its count as the error
+  size_t slot = rendezvous__hot_slot(hot, item_id);
+  size_t i;
+  if (hot->index[slot])
+    i = hot->index[slot] - 1;
+  else
+  {
+    if (hot->counter_count < hot->config.counters)
+    {
+      i = hot->counter_count++;
+      hot->counters[i].count = 0;
+      hot->counters[i].error = 0;
+    }
+    else
+    {
+      i = 0;
+      rendezvous__hot_erase(hot, hot->counters[i].item_id);
+      slot = rendezvous__hot_slot(hot, item_id);
+      hot->counters[i].error = hot->counters[i].count;
+    }
+    hot->counters[i].item_id = item_id;
+    hot->counters[i].hot = 0;
+    hot->index[slot] = i + 1;
+  }
+  hot->counters[i].count++;
+  i = rendezvous__hot_sift(hot, i);
+  hot->sampled++;
+
+  // Halving keeps the order of the heap
+  if (hot->sampled >= hot->config.decay_period)
+  {
+    for (size_t j = 0; j < hot->counter_count; ++j)
+    {
+      hot->counters[j].count /= 2;
+      hot->counters[j].error /= 2;
+    }
+    hot->sampled /= 2;
+  }
+
+  // Drop the keys that cooled down or left the sketch
+  size_t kept = 0;
+  for (size_t h = 0; h < hot->hot_count; ++h)
+  {
+    size_t counter = hot->index[rendezvous__hot_slot(hot, hot->hot[h].item_id)];
+    if (counter == 0) continue;
+    RendezvousHasherHotCounter *c = &hot->counters[counter - 1];
+    if (!rendezvous__hot_qualifies(hot, c))
+    {
+      c->hot = 0;
+      continue;
+    }
+    hot->hot[kept] = hot->hot[h];
+    c->hot = ++kept;
+  }
+  hot->hot_count = kept;
+
+  if (rendezvous__hot_qualifies(hot, &hot->counters[i])
+      && hot->counters[i].hot == 0)
+  {
+    RendezvousHasherHotKey *key = &hot->hot[hot->hot_count++];
+    key->item_id = item_id;
+    key->version = 0;
+    key->next = 0;
+    key->node_count = 0;
+    hot->counters[i].hot = hot->hot_count;
+  }
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_get_node_for(RendezvousHasherHotKeys *hot,
+                            RendezvousHasherId item_id,
+                            RendezvousHasherId *node_id)
+{
+  if (!hot) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (hot->rh->node_count == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+
+  if (--hot->countdown == 0)
+  {
+    rendezvous__hot_sample(hot, item_id);
+    // Random gaps, so that periodic traffic is not sampled in phase
+    unsigned long period = hot->config.sample_period;
+    hot->countdown = 1 + (unsigned long)
+      (rendezvous__rng_next(&hot->rng) % (2 * period - 1));
+  }
+
+  RendezvousHasherHotKey *key =
+    hot->hot_count ? rendezvous__hot_find(hot, item_id) : NULL;
+  if (!key) return rendezvous_get_node_for(hot->rh, item_id, node_id);
+
+  if (key->node_count == 0 || key->version != hot->rh->version)
+  {
+    size_t count = hot->config.fan_out < hot->rh->node_count
+      ? hot->config.fan_out : hot->rh->node_count;
+    int err = rendezvous_get_top_nodes(hot->rh, item_id, count, key->nodes);
+    if (err != RENDEZVOUS_HASHER_OK) return err;
+    key->node_count = count;
+    key->version = hot->rh->version;
+  }
+  *node_id = key->nodes[key->next++ % key->node_count];
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_hot_is_hot(const RendezvousHasherHotKeys *hot,
+                      RendezvousHasherId item_id)
+{
+  return hot && rendezvous__hot_find(hot, item_id) != NULL;
+}
+
+//
+// Hierarchical placement
+//
+// Weil et al., "CRUSH: Controlled, Scalable, Decentralized Placement
+// of Replicated Data", with the straw2 buckets of its later versions:
+// the child of a bucket with the highest weighted score wins. Attempt
+// r of a choose step rehashes the scores with r, attempt 0 is the
+// same draw as a weighted hasher over the children
+//
+
+// Attempts of a choose step before it gives up on an item
+#define RENDEZVOUS__CRUSH_TRIES 50
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_init(RendezvousHasherCrush *crush)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  memset(crush, 0, sizeof(*crush));
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_free(RendezvousHasherCrush *crush)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (crush->nodes) RENDEZVOUS_HASHER_FREE(crush->nodes);
+  // The flat tree is a single block starting at [weights]
+  if (crush->weights) RENDEZVOUS_HASHER_FREE(crush->weights);
+  memset(crush, 0, sizeof(*crush));
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_add(RendezvousHasherCrush *crush,
+                     const RendezvousHasherId *parent,
+                     RendezvousHasherId id,
+                     unsigned int type,
+                     unsigned int weight)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (crush->node_count == crush->node_capacity)
+  {
+    size_t capacity = crush->node_capacity ? crush->node_capacity * 2 : 16;
+    RendezvousHasherCrushNode *nodes = (RendezvousHasherCrushNode *)
+      RENDEZVOUS_HASHER_MALLOC(capacity * sizeof(RendezvousHasherCrushNode));
+    if (!nodes) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    if (crush->nodes)
+    {
+      memcpy(nodes, crush->nodes,
+             crush->node_count * sizeof(RendezvousHasherCrushNode));
+      RENDEZVOUS_HASHER_FREE(crush->nodes);
+    }
+    crush->nodes = nodes;
+    crush->node_capacity = capacity;
+  }
+
+  RendezvousHasherCrushNode *node = &crush->nodes[crush->node_count++];
+  node->id = id;
+  node->parent = parent ? *parent : id;
+  node->root = parent == NULL;
+  node->type = type;
+  node->weight = type == RENDEZVOUS_HASHER_CRUSH_LEAF ? weight : 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static int rendezvous__crush_log2(unsigned long long weight)
+{
+  return weight == 0 ? RENDEZVOUS__LOG2_ZERO
+                     : (int) rendezvous__log2_q24(weight);
+}
+
+typedef struct {
+  RendezvousHasherId id;
+  size_t node;                // Index in the added nodes
+} RendezvousHasherCrushEntry;
+
+static int rendezvous__compare_crush(const void *a, const void *b)
+{
+  RendezvousHasherId x = ((const RendezvousHasherCrushEntry *) a)->id;
+  RendezvousHasherId y = ((const RendezvousHasherCrushEntry *) b)->id;
+  return (x > y) - (y > x);
+}
+
+// Index in [entries], sorted by id, of the entry with [id], or [n]
+static size_t
+rendezvous__crush_search(const RendezvousHasherCrushEntry *entries,
+                         size_t n,
+                         RendezvousHasherId id)
+{
+  size_t lo = 0, hi = n;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (id > entries[mid].id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo < n && entries[lo].id == id ? lo : n;
+}
+
+// Position of [id] in the flat tree of [crush], or its size
+static size_t rendezvous__crush_find(const RendezvousHasherCrush *crush,
+                                     RendezvousHasherId id)
+{
+  size_t lo = 0, hi = crush->size;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (id > crush->ids[crush->by_id[mid]]) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo < crush->size && crush->ids[crush->by_id[lo]] == id
+    ? crush->by_id[lo] : crush->size;
+}
+
+// Bytes of [n] entries of [size] bytes, rounded up so that the next
+// array of the block stays aligned
+static size_t rendezvous__crush_bytes(size_t n, size_t size)
+{
+  size_t align = sizeof(unsigned long long);
+  return (n * size + align - 1) / align * align;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_build(RendezvousHasherCrush *crush)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  size_t n = crush->node_count;
+  if (n >= (size_t) RENDEZVOUS__POSITION_NONE)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  if (crush->weights) RENDEZVOUS_HASHER_FREE(crush->weights);
+  crush->weights = NULL;
+  crush->size = 0;
+  crush->root_count = 0;
+  if (n == 0) return RENDEZVOUS_HASHER_OK;
+
+  const RendezvousHasherCrushNode *nodes = crush->nodes;
+  size_t pos_bytes = rendezvous__crush_bytes(n, sizeof(RendezvousHasherPosition));
+  size_t block_size = rendezvous__crush_bytes(n, sizeof(unsigned long long))
+    + rendezvous__crush_bytes(n, sizeof(RendezvousHasherId))
+    + rendezvous__crush_bytes(n, sizeof(int))
+    + rendezvous__crush_bytes(n, sizeof(unsigned int))
+    + 4 * pos_bytes;
+  RendezvousHasherCrushEntry *entries = (RendezvousHasherCrushEntry *)
+    RENDEZVOUS_HASHER_MALLOC(n * sizeof(RendezvousHasherCrushEntry));
+  // Parent of each node, its children grouped by parent with their
+  // offsets, and the position of each node in the flat tree
+  size_t *scratch = (size_t *)
+    RENDEZVOUS_HASHER_MALLOC((4 * n + 1) * sizeof(size_t));
+  char *block = (char *) RENDEZVOUS_HASHER_MALLOC(block_size);
+  int err = RENDEZVOUS_HASHER_ERROR_INVALID;
+  if (!entries || !scratch || !block)
+  {
+    err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+    goto done;
+  }
+  size_t *parent_of = scratch;
+  size_t *offsets = scratch + n;
+  size_t *children = offsets + n + 1;
+  size_t *position_of = children + n;
+
+  for (size_t i = 0; i < n; ++i)
+  {
+    entries[i].id = nodes[i].id;
+    entries[i].node = i;
+  }
+  qsort(entries, n, sizeof(RendezvousHasherCrushEntry),
+        rendezvous__compare_crush);
+  for (size_t i = 1; i < n; ++i)
+    if (entries[i].id == entries[i - 1].id) goto done;
+
+  memset(offsets, 0, (n + 1) * sizeof(size_t));
+  for (size_t i = 0; i < n; ++i)
+  {
+    parent_of[i] = n;
+    if (nodes[i].root) continue;
+    size_t e = rendezvous__crush_search(entries, n, nodes[i].parent);
+    if (e == n || nodes[entries[e].node].type == RENDEZVOUS_HASHER_CRUSH_LEAF)
+      goto done;
+    parent_of[i] = entries[e].node;
+    offsets[parent_of[i] + 1]++;
+  }
+  for (size_t i = 0; i < n; ++i) offsets[i + 1] += offsets[i];
+  memcpy(position_of, offsets, n * sizeof(size_t));
+  for (size_t i = 0; i < n; ++i)
+    if (parent_of[i] < n) children[position_of[parent_of[i]]++] = i;
+
+  unsigned long long *weights = (unsigned long long *) block;
+  char *p = block + rendezvous__crush_bytes(n, sizeof(unsigned long long));
+  RendezvousHasherId *ids = (RendezvousHasherId *) p;
+  p += rendezvous__crush_bytes(n, sizeof(RendezvousHasherId));
+  int *log2_weights = (int *) p;
+  p += rendezvous__crush_bytes(n, sizeof(int));
+  unsigned int *types = (unsigned int *) p;
+  p += rendezvous__crush_bytes(n, sizeof(unsigned int));
+  RendezvousHasherPosition *parents = (RendezvousHasherPosition *) p;
+  RendezvousHasherPosition *first_child = (RendezvousHasherPosition *) (p + pos_bytes);
+  RendezvousHasherPosition *child_count = (RendezvousHasherPosition *) (p + 2 * pos_bytes);
+  // Node at each position until the tree is laid out
+  RendezvousHasherPosition *by_id = (RendezvousHasherPosition *) (p + 3 * pos_bytes);
+
+  // Breadth first: the roots, then the children of each position in
+  // turn. Nodes in a cycle are never reached
+  size_t size = 0;
+  for (size_t i = 0; i < n; ++i)
+    if (nodes[i].root)
+    {
+      by_id[size] = (RendezvousHasherPosition) i;
+      parents[size++] = RENDEZVOUS__POSITION_NONE;
+    }
+  size_t root_count = size;
+  for (size_t q = 0; q < size; ++q)
+  {
+    size_t node = by_id[q];
+    first_child[q] = (RendezvousHasherPosition) size;
+    child_count[q] = (RendezvousHasherPosition) (offsets[node + 1] - offsets[node]);
+    for (size_t k = offsets[node]; k < offsets[node + 1]; ++k)
+    {
+      by_id[size] = (RendezvousHasherPosition) children[k];
+      parents[size++] = (RendezvousHasherPosition) q;
+    }
+  }
+  if (size < n) goto done;
+
+  for (size_t q = 0; q < n; ++q)
+  {
+    const RendezvousHasherCrushNode *node = &nodes[by_id[q]];
+    ids[q] = node->id;
+    types[q] = node->type;
+    weights[q] = node->weight;
+    position_of[by_id[q]] = q;
+  }
+  // Children come after their bucket, so a bucket has its whole
+  // weight when it is added to its parent
+  for (size_t q = n; q-- > 0;)
+  {
+    if (parents[q] != RENDEZVOUS__POSITION_NONE)
+      weights[parents[q]] += weights[q];
+    log2_weights[q] = rendezvous__crush_log2(weights[q]);
+  }
+  for (size_t e = 0; e < n; ++e)
+    by_id[e] = (RendezvousHasherPosition) position_of[entries[e].node];
+
+  crush->size = n;
+  crush->root_count = root_count;
+  crush->weights = weights;
+  crush->ids = ids;
+  crush->log2_weights = log2_weights;
+  crush->types = types;
+  crush->parents = parents;
+  crush->first_child = first_child;
+  crush->child_count = child_count;
+  crush->by_id = by_id;
+  block = NULL;
+  err = RENDEZVOUS_HASHER_OK;
+
+done:
+  if (entries) RENDEZVOUS_HASHER_FREE(entries);
+  if (scratch) RENDEZVOUS_HASHER_FREE(scratch);
+  if (block) RENDEZVOUS_HASHER_FREE(block);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_set_weight(RendezvousHasherCrush *crush,
+                            RendezvousHasherId id,
+                            unsigned int weight)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  size_t position = rendezvous__crush_find(crush, id);
+  if (position == crush->size
+      || crush->types[position] != RENDEZVOUS_HASHER_CRUSH_LEAF)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  // Kept for the next build
+  for (size_t i = 0; i < crush->node_count; ++i)
+    if (crush->nodes[i].id == id) crush->nodes[i].weight = weight;
+
+  unsigned long long old = crush->weights[position];
+  for (RendezvousHasherPosition q = (RendezvousHasherPosition) position;
+       q != RENDEZVOUS__POSITION_NONE; q = crush->parents[q])
+  {
+    crush->weights[q] = crush->weights[q] - old + weight;
+    crush->log2_weights[q] = rendezvous__crush_log2(crush->weights[q]);
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static const char *rendezvous__text_skip(const char *p)
+{
+  while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+  return p;
+}
+
+// Consume [word] from [p], if it is the next word
+static int rendezvous__crush_word(const char **p, const char *word)
+{
+  const char *q = rendezvous__text_skip(*p);
+  size_t n = strlen(word);
+  if (strncmp(q, word, n) != 0
+      || (q[n] >= 'a' && q[n] <= 'z') || (q[n] >= '0' && q[n] <= '9'))
+    return 0;
+  *p = q + n;
+  return 1;
+}
+
+// Consume a decimal number from [p]
+static int rendezvous__text_number(const char **p,
+                                    unsigned long long *value)
+{
+  const char *q = rendezvous__text_skip(*p);
+  if (*q < '0' || *q > '9') return 0;
+  unsigned long long v = 0;
+  for (; *q >= '0' && *q <= '9'; ++q)
+  {
+    unsigned int digit = (unsigned int) (*q - '0');
+    if (v > (ULLONG_MAX - digit) / 10) return 0;
+    v = v * 10 + digit;
+  }
+  *p = q;
+  *value = v;
+  return 1;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_parse(const char *text,
+                       RendezvousHasherCrushStep *steps,
+                       size_t capacity,
+                       size_t *step_count)
+{
+  if (!text) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!steps || !step_count) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+
+  size_t n = 0;
+  const char *p = text;
+  for (;;)
+  {
+    p = rendezvous__text_skip(p);
+    if (*p == ';' || *p == '\n')
+    {
+      p++;
+      continue;
+    }
+    if (*p == '\0') break;
+
+    RendezvousHasherCrushStep step;
+    unsigned long long a, b;
+    memset(&step, 0, sizeof(step));
+    step.op = rendezvous__crush_word(&p, "take") ? RENDEZVOUS_HASHER_CRUSH_TAKE
+      : rendezvous__crush_word(&p, "chooseleaf") ? RENDEZVOUS_HASHER_CRUSH_CHOOSE_LEAF
+      : rendezvous__crush_word(&p, "choose") ? RENDEZVOUS_HASHER_CRUSH_CHOOSE
+      : rendezvous__crush_word(&p, "emit") ? RENDEZVOUS_HASHER_CRUSH_EMIT
+      : -1;
+    if (step.op == RENDEZVOUS_HASHER_CRUSH_TAKE)
+    {
+      if (!rendezvous__text_number(&p, &a))
+        return RENDEZVOUS_HASHER_ERROR_INVALID;
+      step.id = (RendezvousHasherId) a;
+    }
+    else if (step.op == RENDEZVOUS_HASHER_CRUSH_CHOOSE
+             || step.op == RENDEZVOUS_HASHER_CRUSH_CHOOSE_LEAF)
+    {
+      if (!rendezvous__text_number(&p, &a) || a == 0
+          || a > RENDEZVOUS_HASHER_CRUSH_MAX_SELECT
+          || !rendezvous__crush_word(&p, "type")
+          || !rendezvous__text_number(&p, &b) || b > UINT_MAX)
+        return RENDEZVOUS_HASHER_ERROR_INVALID;
+      step.count = (size_t) a;
+      step.type = (unsigned int) b;
+    }
+    else if (step.op != RENDEZVOUS_HASHER_CRUSH_EMIT)
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+    p = rendezvous__text_skip(p);
+    if ((*p != ';' && *p != '\n' && *p != '\0') || n == capacity)
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+    steps[n++] = step;
+  }
+  *step_count = n;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Straw2 score of the item at [position] for [item_id] in attempt [r]
+static RendezvousHasherHash
+rendezvous__crush_draw(const RendezvousHasherCrush *crush,
+                       size_t position,
+                       RendezvousHasherId item_id,
+                       unsigned int r)
+{
+  RendezvousHasherHash hash = rendezvous__score(crush->ids[position], item_id);
+  if (r)
+    hash = (RendezvousHasherHash) (unsigned int)
+      (rendezvous__mix64((unsigned long long) hash
+                         + r * 0x9e3779b97f4a7c15ULL) >> 32);
+  return rendezvous__weighted_score(hash, crush->log2_weights[position]);
+}
+
+// Descend from [position] to an item of [type] in attempt [r]. Returns
+// RENDEZVOUS__POSITION_NONE if a leaf or a bucket without weight is
+// reached first
+static RendezvousHasherPosition
+rendezvous__crush_descend(const RendezvousHasherCrush *crush,
+                          RendezvousHasherPosition position,
+                          unsigned int type,
+                          RendezvousHasherId item_id,
+                          unsigned int r)
+{
+  while (crush->types[position] != type)
+  {
+    RendezvousHasherPosition first = crush->first_child[position];
+    RendezvousHasherPosition end = first + crush->child_count[position];
+    RendezvousHasherPosition best = RENDEZVOUS__POSITION_NONE;
+    RendezvousHasherHash best_score = 0;
+    for (RendezvousHasherPosition c = first; c < end; ++c)
+    {
+      if (crush->log2_weights[c] == RENDEZVOUS__LOG2_ZERO) continue;
+      RendezvousHasherHash score = rendezvous__crush_draw(crush, c, item_id, r);
+      if (best == RENDEZVOUS__POSITION_NONE
+          || RENDEZVOUS_HASHER_BEATS(score, crush->ids[c],
+                                     best_score, crush->ids[best]))
+      {
+        best = c;
+        best_score = score;
+      }
+    }
+    if (best == RENDEZVOUS__POSITION_NONE) return best;
+    position = best;
+  }
+  return position;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_crush_select(const RendezvousHasherCrush *crush,
+                        const RendezvousHasherCrushStep *steps,
+                        size_t step_count,
+                        RendezvousHasherId item_id,
+                        RendezvousHasherId *ids,
+                        size_t capacity,
+                        size_t *count)
+{
+  if (!crush) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!steps || !ids || !count) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (crush->size == 0) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  // The current items, and for a chooseleaf the buckets they are in,
+  // which must be distinct
+  RendezvousHasherPosition current[RENDEZVOUS_HASHER_CRUSH_MAX_SELECT];
+  RendezvousHasherPosition next[RENDEZVOUS_HASHER_CRUSH_MAX_SELECT];
+  RendezvousHasherPosition chosen[RENDEZVOUS_HASHER_CRUSH_MAX_SELECT];
+  size_t current_count = 0;
+  *count = 0;
+
+  for (size_t s = 0; s < step_count; ++s)
+  {
+    const RendezvousHasherCrushStep *step = &steps[s];
+    int leaf = step->op == RENDEZVOUS_HASHER_CRUSH_CHOOSE_LEAF;
+    switch (step->op)
+    {
+    case RENDEZVOUS_HASHER_CRUSH_TAKE:
+    {
+      size_t position = rendezvous__crush_find(crush, step->id);
+      if (position == crush->size
+          || crush->types[position] == RENDEZVOUS_HASHER_CRUSH_LEAF)
+        return RENDEZVOUS_HASHER_ERROR_INVALID;
+      current[0] = (RendezvousHasherPosition) position;
+      current_count = 1;
+      break;
+    }
+    case RENDEZVOUS_HASHER_CRUSH_CHOOSE:
+    case RENDEZVOUS_HASHER_CRUSH_CHOOSE_LEAF:
+    {
+      if (step->count > RENDEZVOUS_HASHER_CRUSH_MAX_SELECT
+          || current_count * step->count > RENDEZVOUS_HASHER_CRUSH_MAX_SELECT)
+        return RENDEZVOUS_HASHER_ERROR_INVALID;
+      size_t next_count = 0;
+      for (size_t w = 0; w < current_count; ++w)
+        for (unsigned int rep = 0; rep < step->count; ++rep)
+          for (unsigned int r = rep; r < rep + RENDEZVOUS__CRUSH_TRIES; ++r)
+          {
+            RendezvousHasherPosition pick =
+              rendezvous__crush_descend(crush, current[w], step->type,
+                                        item_id, r);
+            if (pick == RENDEZVOUS__POSITION_NONE) continue;
+            size_t k = 0;
+            while (k < next_count && chosen[k] != pick) k++;
+            if (k < next_count) continue;
+            RendezvousHasherPosition item = leaf
+              ? rendezvous__crush_descend(crush, pick,
+                                          RENDEZVOUS_HASHER_CRUSH_LEAF,
+                                          item_id, r)
+              : pick;
+            if (item == RENDEZVOUS__POSITION_NONE) continue;
+            chosen[next_count] = pick;
+            next[next_count++] = item;
+            break;
+          }
+      memcpy(current, next, next_count * sizeof(RendezvousHasherPosition));
+      current_count = next_count;
+      break;
+    }
+    case RENDEZVOUS_HASHER_CRUSH_EMIT:
+      if (current_count > capacity - *count)
+        return RENDEZVOUS_HASHER_ERROR_INVALID;
+      for (size_t i = 0; i < current_count; ++i)
+        ids[(*count)++] = crush->ids[current[i]];
+      current_count = 0;
+      break;
+    default:
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+    }
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+#ifdef RENDEZVOUS_HASHER_HASHES
 
 RENDEZVOUS_HASHER_DEF unsigned int
 rendezvous_hasher_hash_uint32(unsigned int a)
 {
-    a = (a ^ 61) ^ (a >> 16);
-    a = a + (a << 3);
-    a = a ^ (a >> 4);
-    a = a * 0x27d4eb2d;
-    a = a ^ (a >> 15);
-    return a;
+    a = (a ^ 61) ^ (a >> 16);
+    a = a + (a << 3);
+    a = a ^ (a >> 4);
+    a = a * 0x27d4eb2d;
+    a = a ^ (a >> 15);
+    return a;
+}
+
+#ifdef RENDEZVOUS_HASHER_X86_SIMD
+
+// SSE2 has no 32 bit low multiplication, the even and odd lanes are
+// multiplied separately and interleaved back
+__attribute__((target("sse2")))
+static __m128i rendezvous__mullo_sse2(__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                            _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+__attribute__((target("sse2")))
+static size_t rendezvous__hash_uint32_n_sse2(const unsigned int *in,
+                                             unsigned int *out,
+                                             size_t n)
+{
+  const __m128i k61 = _mm_set1_epi32(61);
+  const __m128i mul = _mm_set1_epi32(0x27d4eb2d);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+    a = _mm_xor_si128(_mm_xor_si128(a, k61), _mm_srli_epi32(a, 16));
+    a = _mm_add_epi32(a, _mm_slli_epi32(a, 3));
+    a = _mm_xor_si128(a, _mm_srli_epi32(a, 4));
+    a = rendezvous__mullo_sse2(a, mul);
+    a = _mm_xor_si128(a, _mm_srli_epi32(a, 15));
+    _mm_storeu_si128((__m128i *)(out + i), a);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t rendezvous__hash_uint32_n_avx2(const unsigned int *in,
+                                             unsigned int *out,
+                                             size_t n)
+{
+  const __m256i k61 = _mm256_set1_epi32(61);
+  const __m256i mul = _mm256_set1_epi32(0x27d4eb2d);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+    a = _mm256_xor_si256(_mm256_xor_si256(a, k61), _mm256_srli_epi32(a, 16));
+    a = _mm256_add_epi32(a, _mm256_slli_epi32(a, 3));
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 4));
+    a = _mm256_mullo_epi32(a, mul);
+    a = _mm256_xor_si256(a, _mm256_srli_epi32(a, 15));
+    _mm256_storeu_si256((__m256i *)(out + i), a);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t rendezvous__hash_uint32_n_avx512(const unsigned int *in,
+                                               unsigned int *out,
+                                               size_t n)
+{
+  const __m512i k61 = _mm512_set1_epi32(61);
+  const __m512i mul = _mm512_set1_epi32(0x27d4eb2d);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m512i a = _mm512_loadu_si512((const void *)(in + i));
+    a = _mm512_xor_si512(_mm512_xor_si512(a, k61), _mm512_srli_epi32(a, 16));
+    a = _mm512_add_epi32(a, _mm512_slli_epi32(a, 3));
+    a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 4));
+    a = _mm512_mullo_epi32(a, mul);
+    a = _mm512_xor_si512(a, _mm512_srli_epi32(a, 15));
+    _mm512_storeu_si512((void *)(out + i), a);
+  }
+  return i;
+}
+
+#endif // RENDEZVOUS_HASHER_X86_SIMD
+
+RENDEZVOUS_HASHER_DEF void
+rendezvous_hasher_hash_uint32_n(const unsigned int *in,
+                                unsigned int *out,
+                                size_t n)
+{
+  size_t i = 0;
+
+#ifdef RENDEZVOUS_HASHER_X86_SIMD
+  if (sizeof(unsigned int) == 4)
+  {
+    if (__builtin_cpu_supports("avx512f"))
+      i = rendezvous__hash_uint32_n_avx512(in, out, n);
+    else if (__builtin_cpu_supports("avx2"))
+      i = rendezvous__hash_uint32_n_avx2(in, out, n);
+    else if (__builtin_cpu_supports("sse2"))
+      i = rendezvous__hash_uint32_n_sse2(in, out, n);
+  }
+#endif // RENDEZVOUS_HASHER_X86_SIMD
+
+  // Scalar tail
+  for (; i < n; ++i)
+    out[i] = rendezvous_hasher_hash_uint32(in[i]);
+}
+
+RENDEZVOUS_HASHER_DEF unsigned int
+rendezvous_hasher_hash_fmix32(unsigned int h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifdef RENDEZVOUS_HASHER_X86_SIMD
+
+__attribute__((target("sse2")))
+static size_t rendezvous__hash_fmix32_n_sse2(const unsigned int *in,
+                                             unsigned int *out,
+                                             size_t n)
+{
+  const __m128i mul1 = _mm_set1_epi32((int) 0x85ebca6bu);
+  const __m128i mul2 = _mm_set1_epi32((int) 0xc2b2ae35u);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128i h = _mm_loadu_si128((const __m128i *)(in + i));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    h = rendezvous__mullo_sse2(h, mul1);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 13));
+    h = rendezvous__mullo_sse2(h, mul2);
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 16));
+    _mm_storeu_si128((__m128i *)(out + i), h);
+  }
+  return i;
+}
+
+__attribute__((target("avx2")))
+static size_t rendezvous__hash_fmix32_n_avx2(const unsigned int *in,
+                                             unsigned int *out,
+                                             size_t n)
+{
+  const __m256i mul1 = _mm256_set1_epi32((int) 0x85ebca6bu);
+  const __m256i mul2 = _mm256_set1_epi32((int) 0xc2b2ae35u);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    __m256i h = _mm256_loadu_si256((const __m256i *)(in + i));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    h = _mm256_mullo_epi32(h, mul1);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 13));
+    h = _mm256_mullo_epi32(h, mul2);
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 16));
+    _mm256_storeu_si256((__m256i *)(out + i), h);
+  }
+  return i;
+}
+
+__attribute__((target("avx512f")))
+static size_t rendezvous__hash_fmix32_n_avx512(const unsigned int *in,
+                                               unsigned int *out,
+                                               size_t n)
+{
+  const __m512i mul1 = _mm512_set1_epi32((int) 0x85ebca6bu);
+  const __m512i mul2 = _mm512_set1_epi32((int) 0xc2b2ae35u);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    __m512i h = _mm512_loadu_si512((const void *)(in + i));
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+    h = _mm512_mullo_epi32(h, mul1);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+    h = _mm512_mullo_epi32(h, mul2);
+    h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+    _mm512_storeu_si512((void *)(out + i), h);
+  }
+  return i;
+}
+
+#endif // RENDEZVOUS_HASHER_X86_SIMD
+
+RENDEZVOUS_HASHER_DEF void
+rendezvous_hasher_hash_fmix32_n(const unsigned int *in,
+                                unsigned int *out,
+                                size_t n)
+{
+  size_t i = 0;
+
+#ifdef RENDEZVOUS_HASHER_X86_SIMD
+  if (sizeof(unsigned int) == 4)
+  {
+    if (__builtin_cpu_supports("avx512f"))
+      i = rendezvous__hash_fmix32_n_avx512(in, out, n);
+    else if (__builtin_cpu_supports("avx2"))
+      i = rendezvous__hash_fmix32_n_avx2(in, out, n);
+    else if (__builtin_cpu_supports("sse2"))
+      i = rendezvous__hash_fmix32_n_sse2(in, out, n);
+  }
+#endif // RENDEZVOUS_HASHER_X86_SIMD
+
+  // Scalar tail
+  for (; i < n; ++i)
+    out[i] = rendezvous_hasher_hash_fmix32(in[i]);
+}
+
+#endif // RENDEZVOUS_HASHER_HASHES
+
+#ifdef RENDEZVOUS_HASHER_REPLICAS
+
+static void rendezvous__spin_lock(int *lock)
+{
+  while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE)) ;
+}
+
+static void rendezvous__spin_unlock(int *lock)
+{
+  __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_init(RendezvousHasherReplicas *replicas,
+                         size_t count)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (count == 0) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  rendezvous_init(&replicas->master);
+  replicas->replicas = (RendezvousHasherReplica **)
+    RENDEZVOUS_HASHER_MALLOC(count * sizeof(RendezvousHasherReplica *));
+  if (!replicas->replicas) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  for (size_t i = 0; i < count; ++i) replicas->replicas[i] = NULL;
+  replicas->count = count;
+  replicas->lock = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_free(RendezvousHasherReplicas *replicas)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  for (size_t i = 0; i < replicas->count; ++i)
+  {
+    if (!replicas->replicas[i]) continue;
+    rendezvous_free(&replicas->replicas[i]->rh);
+    RENDEZVOUS_HASHER_FREE(replicas->replicas[i]);
+  }
+  if (replicas->replicas) RENDEZVOUS_HASHER_FREE(replicas->replicas);
+  replicas->replicas = NULL;
+  replicas->count = 0;
+  return rendezvous_free(&replicas->master);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_attach(RendezvousHasherReplicas *replicas,
+                           size_t core)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (core >= replicas->count || replicas->replicas[core])
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherReplica *replica = (RendezvousHasherReplica *)
+    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherReplica));
+  if (!replica) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  memset(replica, 0, sizeof(RendezvousHasherReplica));
+  rendezvous_init(&replica->rh);
+
+  // A deep copy rather than a clone, the chunks must be written by
+  // this core to be local to it
+  int err = RENDEZVOUS_HASHER_OK;
+  rendezvous__spin_lock(&replicas->lock);
+  for (size_t i = 0; i < replicas->master.node_count
+         && err == RENDEZVOUS_HASHER_OK; ++i)
+    err = rendezvous_add_node(&replica->rh,
+                              rendezvous_node_at(&replicas->master, i));
+  if (err == RENDEZVOUS_HASHER_OK)
+    __atomic_store_n(&replicas->replicas[core], replica, __ATOMIC_RELEASE);
+  rendezvous__spin_unlock(&replicas->lock);
+
+  if (err != RENDEZVOUS_HASHER_OK)
+  {
+    rendezvous_free(&replica->rh);
+    RENDEZVOUS_HASHER_FREE(replica);
+  }
+  return err;
+}
+
+static int rendezvous__replicas_broadcast(RendezvousHasherReplicas *replicas,
+                                          int op,
+                                          RendezvousHasherId id)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  rendezvous__spin_lock(&replicas->lock);
+
+  // Check every queue first, so that an update reaches all the
+  // replicas or none
+  int err = RENDEZVOUS_HASHER_OK;
+  for (size_t i = 0; i < replicas->count; ++i)
+  {
+    RendezvousHasherReplica *replica = replicas->replicas[i];
+    if (replica && replica->queue.tail
+        - __atomic_load_n(&replica->queue.head, __ATOMIC_ACQUIRE)
+        == RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE)
+      err = RENDEZVOUS_HASHER_ERROR_BUSY;
+  }
+
+  if (err == RENDEZVOUS_HASHER_OK)
+  {
+    if (op == RENDEZVOUS_HASHER_CHANGE_ADD)
+      err = rendezvous_add_node(&replicas->master, id);
+    else
+      err = rendezvous_remove_node(&replicas->master, id);
+  }
+
+  for (size_t i = 0; i < replicas->count && err == RENDEZVOUS_HASHER_OK; ++i)
+  {
+    RendezvousHasherReplicaQueue *queue = replicas->replicas[i]
+      ? &replicas->replicas[i]->queue : NULL;
+    if (!queue) continue;
+    RendezvousHasherChange *change =
+      &queue->ops[queue->tail & (RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE - 1)];
+    change->op = op;
+    change->id = id;
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
+  }
+
+  rendezvous__spin_unlock(&replicas->lock);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_add_node(RendezvousHasherReplicas *replicas,
+                             RendezvousHasherId id)
+{
+  return rendezvous__replicas_broadcast(replicas,
+                                        RENDEZVOUS_HASHER_CHANGE_ADD, id);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_remove_node(RendezvousHasherReplicas *replicas,
+                                RendezvousHasherId id)
+{
+  return rendezvous__replicas_broadcast(replicas,
+                                        RENDEZVOUS_HASHER_CHANGE_REMOVE, id);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_quiesce(RendezvousHasherReplicas *replicas,
+                            size_t core)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (core >= replicas->count || !replicas->replicas[core])
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherReplica *replica = replicas->replicas[core];
+  RendezvousHasherReplicaQueue *queue = &replica->queue;
+  size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+  size_t head = queue->head;
+  size_t first = head;
+  int err = RENDEZVOUS_HASHER_OK;
+  for (; head != tail && err == RENDEZVOUS_HASHER_OK; ++head)
+  {
+    const RendezvousHasherChange *change =
+      &queue->ops[head & (RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE - 1)];
+    if (change->op == RENDEZVOUS_HASHER_CHANGE_ADD)
+      err = rendezvous_add_node(&replica->rh, change->id);
+    else
+      err = rendezvous_remove_node(&replica->rh, change->id);
+  }
+  // A failed update is retried on the next call
+  if (err != RENDEZVOUS_HASHER_OK) head--;
+  __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+  RENDEZVOUS__PROBE3(replica_quiesce, replicas, core, head - first);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_replicas_get_node_for(RendezvousHasherReplicas *replicas,
+                                 size_t core,
+                                 RendezvousHasherId item_id,
+                                 RendezvousHasherId *node_id)
+{
+  if (!replicas) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (core >= replicas->count || !replicas->replicas[core])
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  return rendezvous_get_node_for(&replicas->replicas[core]->rh,
+                                 item_id, node_id);
+}
+
+#endif // RENDEZVOUS_HASHER_REPLICAS
+
+#ifdef RENDEZVOUS__ARENA
+
+// From linux/mempolicy.h, to stay away from libnuma
+#define RENDEZVOUS__MPOL_PREFERRED       1
+#define RENDEZVOUS__MPOL_F_MEMS_ALLOWED  (1 << 2)
+#define RENDEZVOUS__NUMA_MAX_NODES       1024
+#define RENDEZVOUS__NUMA_MASK_BITS       (8 * sizeof(unsigned long))
+#define RENDEZVOUS__NUMA_MASK_WORDS \
+  (RENDEZVOUS__NUMA_MAX_NODES / RENDEZVOUS__NUMA_MASK_BITS)
+
+// Chunks are carved from the slabs at cache line boundaries
+#define RENDEZVOUS__ARENA_SLOT(weighted)                                   \
+  ((RENDEZVOUS_HASHER_CHUNK_BYTES(weighted) + RENDEZVOUS_HASHER_CACHE_LINE - 1) \
+   / RENDEZVOUS_HASHER_CACHE_LINE * RENDEZVOUS_HASHER_CACHE_LINE)
+
+// Nodes the process can allocate memory on, returns the highest one
+// plus one or 0 on error
+static size_t rendezvous__numa_allowed(unsigned long *mask)
+{
+  memset(mask, 0, RENDEZVOUS__NUMA_MASK_WORDS * sizeof(unsigned long));
+  if (syscall(SYS_get_mempolicy, NULL, mask,
+              (unsigned long) RENDEZVOUS__NUMA_MAX_NODES, NULL,
+              RENDEZVOUS__MPOL_F_MEMS_ALLOWED) != 0)
+    return 0;
+
+  size_t count = 0;
+  for (size_t n = 0; n < RENDEZVOUS__NUMA_MAX_NODES; ++n)
+    if ((mask[n / RENDEZVOUS__NUMA_MASK_BITS]
+         >> (n % RENDEZVOUS__NUMA_MASK_BITS)) & 1ul)
+      count = n + 1;
+  return count;
+}
+
+static int rendezvous__numa_is_allowed(const unsigned long *mask, int node)
+{
+  return node >= 0 && node < RENDEZVOUS__NUMA_MAX_NODES
+    && ((mask[node / RENDEZVOUS__NUMA_MASK_BITS]
+         >> (node % RENDEZVOUS__NUMA_MASK_BITS)) & 1ul);
+}
+
+static size_t rendezvous__page_round(size_t size)
+{
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+// Allocate the pages of the mapping [p] on [numa_node] at the first
+// touch, they fall back to other nodes only when it is out of memory
+static int rendezvous__pages_bind(void *p, size_t size, int numa_node)
+{
+  if (numa_node < 0) return 1;
+
+  unsigned long mask[RENDEZVOUS__NUMA_MASK_WORDS];
+  memset(mask, 0, sizeof(mask));
+  mask[numa_node / RENDEZVOUS__NUMA_MASK_BITS] |=
+    1ul << (numa_node % RENDEZVOUS__NUMA_MASK_BITS);
+  return syscall(SYS_mbind, p, size, RENDEZVOUS__MPOL_PREFERRED, mask,
+                 (unsigned long) RENDEZVOUS__NUMA_MAX_NODES, 0) == 0;
+}
+
+// Map [size] bytes of pages allocated on [numa_node], -1 for any
+static void *rendezvous__pages_map(int numa_node, size_t size)
+{
+  size = rendezvous__page_round(size);
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  if (!rendezvous__pages_bind(p, size, numa_node))
+  {
+    munmap(p, size);
+    return NULL;
+  }
+  return p;
+}
+
+#ifdef RENDEZVOUS_HASHER_HUGE_PAGES
+
+// Whether the mapping holding [p] is all backed by transparent huge
+// pages, according to /proc/self/smaps
+static int rendezvous__thp_backed(const void *p)
+{
+  FILE *f = fopen("/proc/self/smaps", "r");
+  if (!f) return 0;
+
+  char line[4096];
+  unsigned long a, b, kb, size = 0;
+  unsigned long addr = (unsigned long) p;
+  int inside = 0, backed = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "%lx-%lx ", &a, &b) == 2)
+    {
+      if (inside) break;
+      inside = addr >= a && addr < b;
+      size = b - a;
+    }
+    else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+    {
+      backed = kb * 1024 >= size;
+      break;
+    }
+  }
+  fclose(f);
+  return backed;
+}
+
+// Map a huge page aligned slab, from hugetlbfs if pages are reserved
+// or as transparent huge pages. [page_size] is set to the size of the
+// pages obtained
+static void *rendezvous__huge_map(int numa_node, size_t size,
+                                  size_t *page_size)
+{
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (p != MAP_FAILED)
+  {
+    if (rendezvous__pages_bind(p, size, numa_node))
+    {
+      *page_size = RENDEZVOUS_HASHER_HUGE_PAGE_SIZE;
+      return p;
+    }
+    munmap(p, size);
+  }
+
+  // Transparent huge pages need an aligned range, map twice the size
+  // and trim the ends
+  char *raw = (char *) mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) return NULL;
+  size_t align = RENDEZVOUS_HASHER_HUGE_PAGE_SIZE;
+  char *slab = (char *) (((unsigned long) raw + align - 1)
+                         / align * align);
+  if (slab > raw) munmap(raw, (size_t) (slab - raw));
+  munmap(slab + size, (size_t) (raw + size - slab));
+
+  if (!rendezvous__pages_bind(slab, size, numa_node))
+  {
+    munmap(slab, size);
+    return NULL;
+  }
+  *page_size = rendezvous__page_round(1);
+  if (madvise(slab, size, MADV_HUGEPAGE) == 0)
+  {
+    // Fault the first page in, the kernel picks its size now
+    *(volatile char *) slab = 0;
+    if (rendezvous__thp_backed(slab))
+      *page_size = RENDEZVOUS_HASHER_HUGE_PAGE_SIZE;
+  }
+  return slab;
+}
+
+#endif // RENDEZVOUS_HASHER_HUGE_PAGES
+
+static int rendezvous__arena_create(RendezvousHasherArena **arena,
+                                    const RendezvousHasherOptions *options)
+{
+  int numa_node = -1;
+#ifndef RENDEZVOUS_HASHER_NUMA
+  if (options->flags & RENDEZVOUS_HASHER_OPTION_NUMA)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+#endif
+#ifndef RENDEZVOUS_HASHER_HUGE_PAGES
+  if (options->flags & RENDEZVOUS_HASHER_OPTION_HUGE_PAGES)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+#endif
+  if (options->flags & RENDEZVOUS_HASHER_OPTION_NUMA)
+  {
+    unsigned long mask[RENDEZVOUS__NUMA_MASK_WORDS];
+    if (rendezvous__numa_allowed(mask) == 0
+        || !rendezvous__numa_is_allowed(mask, options->numa_node))
+      return RENDEZVOUS_HASHER_ERROR_INVALID;
+    numa_node = options->numa_node;
+  }
+
+  RendezvousHasherArena *a = (RendezvousHasherArena *)
+    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherArena));
+  if (!a) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  a->refs = 1;
+  a->numa_node = numa_node;
+  a->huge_pages = (options->flags & RENDEZVOUS_HASHER_OPTION_HUGE_PAGES) != 0;
+  a->slab_size = a->huge_pages ? RENDEZVOUS_HASHER_HUGE_PAGE_SIZE
+                               : RENDEZVOUS_HASHER_ARENA_SLAB_SIZE;
+  a->slot_size = RENDEZVOUS__ARENA_SLOT(
+    (options->flags & RENDEZVOUS_HASHER_OPTION_WEIGHTED) != 0);
+  a->page_size = 0;
+  a->slabs = NULL;
+  a->free_chunks = NULL;
+  *arena = a;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static void rendezvous__arena_release(RendezvousHasherArena *arena)
+{
+  if (--arena->refs != 0) return;
+
+  void *slab = arena->slabs;
+  while (slab)
+  {
+    void *next = *(void **) slab;
+    munmap(slab, arena->slab_size);
+    slab = next;
+  }
+  RENDEZVOUS_HASHER_FREE(arena);
+}
+
+static RendezvousHasherChunk *
+rendezvous__arena_chunk_alloc(RendezvousHasherArena *arena)
+{
+  if (!arena->free_chunks)
+  {
+    char *slab;
+    size_t page_size = rendezvous__page_round(1);
+#ifdef RENDEZVOUS_HASHER_HUGE_PAGES
+    if (arena->huge_pages)
+      slab = (char *) rendezvous__huge_map(arena->numa_node,
+                                           arena->slab_size, &page_size);
+    else
+#endif
+      slab = (char *) rendezvous__pages_map(arena->numa_node,
+                                            arena->slab_size);
+    if (!slab) return NULL;
+    if (arena->page_size == 0 || page_size < arena->page_size)
+      arena->page_size = page_size;
+    *(void **) slab = arena->slabs;
+    arena->slabs = slab;
+
+    // The first cache line holds the link to the next slab
+    for (size_t off = RENDEZVOUS_HASHER_CACHE_LINE;
+         off + arena->slot_size <= arena->slab_size;
+         off += arena->slot_size)
+    {
+      *(void **) (slab + off) = arena->free_chunks;
+      arena->free_chunks = slab + off;
+    }
+  }
+
+  void *chunk = arena->free_chunks;
+  arena->free_chunks = *(void **) chunk;
+  arena->refs++;
+  return (RendezvousHasherChunk *) chunk;
+}
+
+static void rendezvous__arena_chunk_free(RendezvousHasherArena *arena,
+                                         RendezvousHasherChunk *chunk)
+{
+  *(void **) chunk = arena->free_chunks;
+  arena->free_chunks = chunk;
+  rendezvous__arena_release(arena);
+}
+
+static void *rendezvous__arena_alloc(RendezvousHasherArena *arena,
+                                     size_t size)
+{
+  return rendezvous__pages_map(arena->numa_node, size);
+}
+
+static void rendezvous__arena_free(void *p, size_t size)
+{
+  munmap(p, rendezvous__page_round(size));
+}
+
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_page_size(const RendezvousHasher *rh)
+{
+  if (!rh || rh->node_count == 0) return 0;
+  // Chunks from RENDEZVOUS_HASHER_MALLOC, huge pages are up to malloc
+  // and the kernel
+  if (!rh->arena) return rendezvous__page_round(1);
+  return rh->arena->page_size;
+}
+
+#endif // RENDEZVOUS__ARENA
+
+#ifdef RENDEZVOUS_HASHER_NUMA
+
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_numa_node_count(void)
+{
+  unsigned long mask[RENDEZVOUS__NUMA_MASK_WORDS];
+  size_t count = rendezvous__numa_allowed(mask);
+  return count ? count : 1;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_init(RendezvousHasherNuma *numa)
+{
+  if (!numa) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  unsigned long mask[RENDEZVOUS__NUMA_MASK_WORDS];
+  size_t count = rendezvous__numa_allowed(mask);
+  if (count == 0) return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+
+  numa->replicas = (RendezvousHasher **)
+    RENDEZVOUS_HASHER_MALLOC(count * sizeof(RendezvousHasher *));
+  if (!numa->replicas) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  numa->count = count;
+  for (size_t n = 0; n < count; ++n) numa->replicas[n] = NULL;
+
+  for (size_t n = 0; n < count; ++n)
+  {
+    if (!rendezvous__numa_is_allowed(mask, (int) n)) continue;
+
+    // The hasher itself is read on every lookup, it goes on the same
+    // NUMA node as its table
+    RendezvousHasherOptions options;
+    memset(&options, 0, sizeof(options));
+    options.flags = RENDEZVOUS_HASHER_OPTION_NUMA;
+    options.numa_node = (int) n;
+    RendezvousHasher *rh = (RendezvousHasher *)
+      rendezvous__pages_map((int) n, sizeof(RendezvousHasher));
+    int err = rh ? rendezvous_init_options(rh, &options)
+                 : RENDEZVOUS_HASHER_ERROR_ALLOC;
+    if (err != RENDEZVOUS_HASHER_OK)
+    {
+      if (rh) rendezvous__arena_free(rh, sizeof(RendezvousHasher));
+      rendezvous_numa_free(numa);
+      return err;
+    }
+    numa->replicas[n] = rh;
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_free(RendezvousHasherNuma *numa)
+{
+  if (!numa) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  for (size_t n = 0; n < numa->count; ++n)
+  {
+    if (!numa->replicas[n]) continue;
+    rendezvous_free(numa->replicas[n]);
+    rendezvous__arena_free(numa->replicas[n], sizeof(RendezvousHasher));
+  }
+  if (numa->replicas) RENDEZVOUS_HASHER_FREE(numa->replicas);
+  numa->replicas = NULL;
+  numa->count = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_add_node(RendezvousHasherNuma *numa,
+                         RendezvousHasherId id)
+{
+  if (!numa) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  for (size_t n = 0; n < numa->count; ++n)
+  {
+    if (!numa->replicas[n]) continue;
+    int err = rendezvous_add_node(numa->replicas[n], id);
+    if (err == RENDEZVOUS_HASHER_OK) continue;
+
+    // The node is the last one of the replicas that got it, so the
+    // removal does not allocate
+    while (n-- > 0)
+      if (numa->replicas[n]) rendezvous_remove_node(numa->replicas[n], id);
+    return err;
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_remove_node(RendezvousHasherNuma *numa,
+                            RendezvousHasherId id)
+{
+  if (!numa) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  // Replicas do not share chunks, removals do not allocate
+  for (size_t n = 0; n < numa->count; ++n)
+    if (numa->replicas[n]) rendezvous_remove_node(numa->replicas[n], id);
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF RendezvousHasher *
+rendezvous_numa_local(RendezvousHasherNuma *numa)
+{
+  if (!numa || numa->count == 0) return NULL;
+
+  unsigned int cpu, node;
+  if (getcpu(&cpu, &node) == 0 && node < numa->count
+      && numa->replicas[node])
+    return numa->replicas[node];
+
+  // A CPU on a node without usable memory
+  for (size_t n = 0; n < numa->count; ++n)
+    if (numa->replicas[n]) return numa->replicas[n];
+  return NULL;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_numa_get_node_for(RendezvousHasherNuma *numa,
+                             RendezvousHasherId item_id,
+                             RendezvousHasherId *node_id)
+{
+  if (!numa) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  return rendezvous_get_node_for(rendezvous_numa_local(numa),
+                                 item_id, node_id);
+}
+
+#endif // RENDEZVOUS_HASHER_NUMA
+
+#ifdef RENDEZVOUS_HASHER_JOURNAL
+
+// Both files start with a magic number, the size of the ids and
+// whether the hasher is weighted. Integers are in host byte order
+#define RENDEZVOUS__JOURNAL_MAGIC  0x314a4852u // "RHJ1"
+#define RENDEZVOUS__SNAPSHOT_MAGIC 0x31534852u // "RHS1"
+
+// Journal: the kind, then the checksum of the header
+#define RENDEZVOUS__JOURNAL_HEADER 16
+// Record: sequence number (8), op (4), weight (4), id, then the
+// checksum of the record
+#define RENDEZVOUS__JOURNAL_RECORD (20 + sizeof(RendezvousHasherId))
+// Snapshot: the kind, the engine (4), the sequence number of the last
+// record it includes (8), the node count (8), the checksum of the
+// body, then the checksum of the header
+#define RENDEZVOUS__SNAPSHOT_HEADER 40
+// Body: an entry for each node, in the order of the node table, then
+// the state of the engine
+// Entry: id, log2 weight (4)
+#define RENDEZVOUS__SNAPSHOT_ENTRY (sizeof(RendezvousHasherId) + 4)
+// AnchorHash state: buckets (8), working (8), removed (8), then the
+// A, K, W, L and R arrays and the bucket of each node. Adding the
+// nodes again would not give the same buckets
+#define RENDEZVOUS__SNAPSHOT_ANCHOR(buckets, count) \
+  (24 + (5 * (size_t) (buckets) + (size_t) (count)) * sizeof(unsigned int))
+
+#define RENDEZVOUS__JOURNAL_ADD    0
+#define RENDEZVOUS__JOURNAL_REMOVE 1
+#define RENDEZVOUS__JOURNAL_WEIGHT 2
+
+// CRC-32C, four bits at a time
+static const unsigned int rendezvous__crc32c_table[16] = {
+  0x00000000u, 0x105ec76fu, 0x20bd8edeu, 0x30e349b1u,
+  0x417b1dbcu, 0x5125dad3u, 0x61c69362u, 0x7198540du,
+  0x82f63b78u, 0x92a8fc17u, 0xa24bb5a6u, 0xb21572c9u,
+  0xc38d26c4u, 0xd3d3e1abu, 0xe330a81au, 0xf36e6f75u
+};
+
+// Checksum of [n] bytes at [p], continuing from [crc] (0 to start)
+static unsigned int rendezvous__crc32c(unsigned int crc,
+                                       const unsigned char *p,
+                                       size_t n)
+{
+  crc = ~crc;
+  for (size_t i = 0; i < n; ++i)
+  {
+    crc = rendezvous__crc32c_table[(crc ^ p[i]) & 15] ^ (crc >> 4);
+    crc = rendezvous__crc32c_table[(crc ^ (p[i] >> 4)) & 15] ^ (crc >> 4);
+  }
+  return ~crc;
+}
+
+static unsigned long long rendezvous__now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000
+    + (unsigned long long) ts.tv_nsec / 1000000;
+}
+
+// Write [n] bytes at [offset] of [fd]. Writing again at the same
+// offset replaces a partial write
+static int rendezvous__write_all(int fd,
+                                 const unsigned char *p,
+                                 size_t n,
+                                 off_t offset)
+{
+  while (n > 0)
+  {
+    ssize_t written = pwrite(fd, p, n, offset);
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return RENDEZVOUS_HASHER_ERROR_IO;
+    p += written;
+    n -= (size_t) written;
+    offset += written;
+  }
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Map the whole file [fd] for reading, [map] is NULL if it is empty
+static int rendezvous__map_file(int fd,
+                                const unsigned char **map,
+                                size_t *size)
+{
+  struct stat st;
+  *map = NULL;
+  if (fstat(fd, &st) != 0) return RENDEZVOUS_HASHER_ERROR_IO;
+  *size = (size_t) st.st_size;
+  if (*size == 0) return RENDEZVOUS_HASHER_OK;
+  void *p = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) return RENDEZVOUS_HASHER_ERROR_IO;
+  *map = (const unsigned char *) p;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+static void rendezvous__journal_put_kind(const RendezvousHasher *rh,
+                                         unsigned char *p,
+                                         unsigned int magic)
+{
+  unsigned int words[3];
+  words[0] = magic;
+  words[1] = (unsigned int) sizeof(RendezvousHasherId);
+  words[2] = (unsigned int) rh->weighted;
+  memcpy(p, words, sizeof(words));
+}
+
+// Whether the header at [p] was written for a hasher like [rh]
+static int rendezvous__journal_kind(const RendezvousHasher *rh,
+                                    const unsigned char *p,
+                                    unsigned int magic)
+{
+  unsigned char expected[12];
+  rendezvous__journal_put_kind(rh, expected, magic);
+  return memcmp(p, expected, sizeof(expected)) == 0;
+}
+
+static int rendezvous__journal_apply(RendezvousHasher *rh,
+                                     unsigned int op,
+                                     RendezvousHasherId id,
+                                     unsigned int weight)
+{
+  switch (op)
+  {
+  case RENDEZVOUS__JOURNAL_ADD:
+    return rh->weighted ? rendezvous_add_weighted_node(rh, id, weight)
+                        : rendezvous_add_node(rh, id);
+  case RENDEZVOUS__JOURNAL_REMOVE:
+    return rendezvous_remove_node(rh, id);
+  case RENDEZVOUS__JOURNAL_WEIGHT:
+    return rendezvous_set_weight(rh, id, weight);
+  }
+  return RENDEZVOUS_HASHER_ERROR_INVALID;
+}
+
+// Add the nodes of the snapshot of [journal] to its hasher
+static int rendezvous__snapshot_load(RendezvousHasherJournal *journal)
+{
+  int fd = open(journal->snapshot_path, O_RDONLY);
+  if (fd < 0)
+    return errno == ENOENT ? RENDEZVOUS_HASHER_OK : RENDEZVOUS_HASHER_ERROR_IO;
+  const unsigned char *map;
+  size_t size;
+  int err = rendezvous__map_file(fd, &map, &size);
+  close(fd);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  RendezvousHasher *rh = journal->rh;
+  unsigned long long seq, count;
+  unsigned int engine, crc[2];
+  err = RENDEZVOUS_HASHER_ERROR_INVALID;
+  if (size < RENDEZVOUS__SNAPSHOT_HEADER
+      || !rendezvous__journal_kind(rh, map, RENDEZVOUS__SNAPSHOT_MAGIC))
+    goto done;
+  memcpy(&engine, map + 12, sizeof(engine));
+  memcpy(&seq, map + 16, sizeof(seq));
+  memcpy(&count, map + 24, sizeof(count));
+  memcpy(crc, map + 32, sizeof(crc));
+  size_t body = size - RENDEZVOUS__SNAPSHOT_HEADER;
+  if (crc[1] != rendezvous__crc32c(0, map, RENDEZVOUS__SNAPSHOT_HEADER - 4)
+      || engine != (unsigned int) rh->engine
+      || count > body / RENDEZVOUS__SNAPSHOT_ENTRY
+      || crc[0] != rendezvous__crc32c(0, map + RENDEZVOUS__SNAPSHOT_HEADER, body))
+    goto done;
+
+  // The AnchorHash state gets the size it was written with, the nodes
+  // then fill it like when it was new and it is overwritten below
+  const unsigned char *entry = map + RENDEZVOUS__SNAPSHOT_HEADER;
+  const unsigned char *state = entry + count * RENDEZVOUS__SNAPSHOT_ENTRY;
+  size_t buckets = 0;
+  if (rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+  {
+    unsigned long long counts[3];
+    size_t left = body - (size_t) count * RENDEZVOUS__SNAPSHOT_ENTRY;
+    if (left < sizeof(counts)) goto done;
+    memcpy(counts, state, sizeof(counts));
+    if (counts[0] < count || counts[0] > UINT_MAX || counts[1] != count
+        || counts[2] != counts[0] - count
+        || left != RENDEZVOUS__SNAPSHOT_ANCHOR(counts[0], count))
+      goto done;
+    buckets = (size_t) counts[0];
+    state += sizeof(counts);
+    for (size_t w = 0; w < 5 * buckets + count; ++w)
+    {
+      unsigned int word;
+      memcpy(&word, state + w * sizeof(word), sizeof(word));
+      if (word >= buckets) goto done;
+    }
+    RendezvousHasherEngineState *fresh = rendezvous__anchor_create(buckets);
+    if (!fresh)
+    {
+      err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+      goto done;
+    }
+    rendezvous__state_free(rh->engine_state);
+    rh->engine_state = fresh;
+  }
+
+  err = rendezvous_reserve(rh, (size_t) count);
+  for (size_t i = 0; i < count && err == RENDEZVOUS_HASHER_OK; ++i)
+  {
+    RendezvousHasherId id;
+    int log2_weight;
+    memcpy(&id, entry, sizeof(id));
+    memcpy(&log2_weight, entry + sizeof(id), sizeof(log2_weight));
+    err = rendezvous__add(rh, id, log2_weight);
+    entry += RENDEZVOUS__SNAPSHOT_ENTRY;
+  }
+  if (err == RENDEZVOUS_HASHER_OK && buckets)
+  {
+    RendezvousHasherEngineState *anchor = rh->engine_state;
+    memcpy(anchor->words, state,
+           (5 * buckets + (size_t) count) * sizeof(unsigned int));
+    anchor->working = (size_t) count;
+    anchor->removed = buckets - (size_t) count;
+    const unsigned int *bucket = RENDEZVOUS__ANCHOR_BUCKET(anchor);
+    for (size_t i = 0; i < count; ++i)
+      anchor->ids[bucket[i]] = rendezvous_node_at(rh, i);
+  }
+  journal->seq = seq;
+
+done:
+  if (map) munmap((void *) map, size);
+  return err;
+}
+
+// Apply the records of the journal that are newer than the snapshot,
+// then cut the journal after its last whole record. Only the last
+// group can be torn, a damaged record before it is corruption
+static int rendezvous__journal_replay(RendezvousHasherJournal *journal)
+{
+  const unsigned char *map;
+  size_t size, end = 0;
+  int err = rendezvous__map_file(journal->fd, &map, &size);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  if (size >= RENDEZVOUS__JOURNAL_HEADER)
+  {
+    unsigned int crc;
+    memcpy(&crc, map + 12, sizeof(crc));
+    if (!rendezvous__journal_kind(journal->rh, map, RENDEZVOUS__JOURNAL_MAGIC)
+        || crc != rendezvous__crc32c(0, map, 12))
+    {
+      err = RENDEZVOUS_HASHER_ERROR_INVALID;
+      goto done;
+    }
+    end = RENDEZVOUS__JOURNAL_HEADER;
+  }
+  while (end && end + RENDEZVOUS__JOURNAL_RECORD <= size)
+  {
+    const unsigned char *record = map + end;
+    unsigned long long seq;
+    unsigned int crc, op, weight;
+    RendezvousHasherId id;
+    memcpy(&crc, record + RENDEZVOUS__JOURNAL_RECORD - 4, sizeof(crc));
+    if (crc != rendezvous__crc32c(0, record, RENDEZVOUS__JOURNAL_RECORD - 4))
+    {
+      if ((size - end) / RENDEZVOUS__JOURNAL_RECORD
+            > journal->config.group_size)
+        err = RENDEZVOUS_HASHER_ERROR_INVALID;
+      break;
+    }
+    memcpy(&seq, record, sizeof(seq));
+    memcpy(&op, record + 8, sizeof(op));
+    memcpy(&weight, record + 12, sizeof(weight));
+    memcpy(&id, record + 16, sizeof(id));
+    // Older records are in the snapshot, if the journal was not
+    // emptied after the last compaction
+    if (seq > journal->seq)
+    {
+      err = rendezvous__journal_apply(journal->rh, op, id, weight);
+      if (err != RENDEZVOUS_HASHER_OK) goto done;
+      journal->seq = seq;
+    }
+    journal->records++;
+    end += RENDEZVOUS__JOURNAL_RECORD;
+  }
+
+done:
+  if (map) munmap((void *) map, size);
+  if (err != RENDEZVOUS_HASHER_OK || (end && end == size)) return err;
+
+  // A new journal, or a torn record from a crash
+  if (end == 0)
+  {
+    unsigned char header[RENDEZVOUS__JOURNAL_HEADER];
+    rendezvous__journal_put_kind(journal->rh, header, RENDEZVOUS__JOURNAL_MAGIC);
+    unsigned int crc = rendezvous__crc32c(0, header, 12);
+    memcpy(header + 12, &crc, sizeof(crc));
+    if (ftruncate(journal->fd, 0) != 0
+        || rendezvous__write_all(journal->fd, header, sizeof(header), 0)
+           != RENDEZVOUS_HASHER_OK
+        || fsync(journal->dir_fd) != 0)
+      return RENDEZVOUS_HASHER_ERROR_IO;
+  }
+  else if (ftruncate(journal->fd, (off_t) end) != 0)
+    return RENDEZVOUS_HASHER_ERROR_IO;
+  return fsync(journal->fd) == 0 ? RENDEZVOUS_HASHER_OK
+                                 : RENDEZVOUS_HASHER_ERROR_IO;
+}
+
+static void rendezvous__journal_release(RendezvousHasherJournal *journal)
+{
+  if (journal->fd >= 0) close(journal->fd);
+  if (journal->dir_fd >= 0) close(journal->dir_fd);
+  if (journal->snapshot_path) RENDEZVOUS_HASHER_FREE(journal->snapshot_path);
+  if (journal->group) RENDEZVOUS_HASHER_FREE(journal->group);
+  memset(journal, 0, sizeof(*journal));
+  journal->fd = -1;
+  journal->dir_fd = -1;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_open(RendezvousHasherJournal *journal,
+                        RendezvousHasher *rh,
+                        const char *path,
+                        const RendezvousHasherJournalConfig *config)
+{
+  if (!journal) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!rh || !path) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (rh->node_count != 0) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherJournalConfig c = {0};
+  if (config) c = *config;
+  if (c.group_size == 0) c.group_size = 64;
+  if (c.group_delay_ms == 0) c.group_delay_ms = 10;
+  if (c.compact_records == 0) c.compact_records = 65536;
+
+  memset(journal, 0, sizeof(*journal));
+  journal->fd = -1;
+  journal->dir_fd = -1;
+  journal->rh = rh;
+  journal->config = c;
+
+  size_t len = strlen(path);
+  journal->snapshot_path = (char *) RENDEZVOUS_HASHER_MALLOC(2 * len + 16);
+  journal->group = (unsigned char *)
+    RENDEZVOUS_HASHER_MALLOC(c.group_size * RENDEZVOUS__JOURNAL_RECORD);
+  if (!journal->snapshot_path || !journal->group)
+  {
+    rendezvous__journal_release(journal);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  journal->temp_path = journal->snapshot_path + len + 6;
+
+  // The directory of the files, in the space of [temp_path]
+  const char *slash = strrchr(path, '/');
+  if (!slash) strcpy(journal->temp_path, ".");
+  else if (slash == path) strcpy(journal->temp_path, "/");
+  else
+  {
+    memcpy(journal->temp_path, path, (size_t) (slash - path));
+    journal->temp_path[slash - path] = '\0';
+  }
+  journal->dir_fd = open(journal->temp_path, O_RDONLY);
+  memcpy(journal->snapshot_path, path, len);
+  strcpy(journal->snapshot_path + len, ".snap");
+  memcpy(journal->temp_path, path, len);
+  strcpy(journal->temp_path + len, ".snap.tmp");
+
+  int err = RENDEZVOUS_HASHER_ERROR_IO;
+  rendezvous__engine_defer(rh);
+  if (journal->dir_fd >= 0) err = rendezvous__snapshot_load(journal);
+  if (err == RENDEZVOUS_HASHER_OK)
+  {
+    journal->fd = open(path, O_RDWR | O_CREAT, 0644);
+    err = journal->fd >= 0 ? rendezvous__journal_replay(journal)
+                           : RENDEZVOUS_HASHER_ERROR_IO;
+  }
+  rendezvous__engine_build(rh);
+  if (err != RENDEZVOUS_HASHER_OK) rendezvous__journal_release(journal);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_close(RendezvousHasherJournal *journal)
+{
+  if (!journal) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  int err = journal->rh ? rendezvous_journal_sync(journal)
+                        : RENDEZVOUS_HASHER_OK;
+  rendezvous__journal_release(journal);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_sync(RendezvousHasherJournal *journal)
+{
+  if (!journal) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!journal->rh) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  if (journal->pending == 0) return RENDEZVOUS_HASHER_OK;
+
+  // On error the group is written again, over what was written of it
+  off_t end = (off_t) (RENDEZVOUS__JOURNAL_HEADER
+                       + journal->records * RENDEZVOUS__JOURNAL_RECORD);
+  if (rendezvous__write_all(journal->fd, journal->group,
+                            journal->pending * RENDEZVOUS__JOURNAL_RECORD, end)
+        != RENDEZVOUS_HASHER_OK
+      || fsync(journal->fd) != 0)
+    return RENDEZVOUS_HASHER_ERROR_IO;
+  journal->records += journal->pending;
+  journal->pending = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_flush(RendezvousHasherJournal *journal)
+{
+  if (!journal) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!journal->rh) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  if (journal->pending == 0
+      || rendezvous__now_ms() - journal->since < journal->config.group_delay_ms)
+    return RENDEZVOUS_HASHER_OK;
+  return rendezvous_journal_sync(journal);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_compact(RendezvousHasherJournal *journal)
+{
+  int err = rendezvous_journal_sync(journal);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  const RendezvousHasher *rh = journal->rh;
+  const RendezvousHasherEngineState *anchor =
+    rh->engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR ? rh->engine_state : NULL;
+  size_t size = RENDEZVOUS__SNAPSHOT_HEADER
+    + rh->node_count * RENDEZVOUS__SNAPSHOT_ENTRY
+    + (anchor ? RENDEZVOUS__SNAPSHOT_ANCHOR(anchor->size, rh->node_count) : 0);
+  unsigned char *buffer = (unsigned char *) RENDEZVOUS_HASHER_MALLOC(size);
+  if (!buffer) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+
+  unsigned char *entry = buffer + RENDEZVOUS__SNAPSHOT_HEADER;
+  for (size_t i = 0; i < rh->node_count; ++i)
+  {
+    const RendezvousHasherChunk *chunk =
+      rh->chunks[i / RENDEZVOUS_HASHER_CHUNK_SIZE];
+    memcpy(entry, &chunk->ids[i % RENDEZVOUS_HASHER_CHUNK_SIZE],
+           sizeof(RendezvousHasherId));
+    int log2_weight = rh->weighted
+      ? chunk->log2_weights[i % RENDEZVOUS_HASHER_CHUNK_SIZE] : 0;
+    memcpy(entry + sizeof(RendezvousHasherId), &log2_weight, sizeof(int));
+    entry += RENDEZVOUS__SNAPSHOT_ENTRY;
+  }
+  if (anchor)
+  {
+    unsigned long long counts[3] = {
+      anchor->size, anchor->working, anchor->removed
+    };
+    memcpy(entry, counts, sizeof(counts));
+    memcpy(entry + sizeof(counts), anchor->words,
+           (5 * anchor->size + rh->node_count) * sizeof(unsigned int));
+  }
+  unsigned long long count = rh->node_count;
+  unsigned int engine = (unsigned int) rh->engine;
+  unsigned int crc[2];
+  rendezvous__journal_put_kind(rh, buffer, RENDEZVOUS__SNAPSHOT_MAGIC);
+  memcpy(buffer + 12, &engine, sizeof(engine));
+  memcpy(buffer + 16, &journal->seq, sizeof(journal->seq));
+  memcpy(buffer + 24, &count, sizeof(count));
+  crc[0] = rendezvous__crc32c(0, buffer + RENDEZVOUS__SNAPSHOT_HEADER,
+                              size - RENDEZVOUS__SNAPSHOT_HEADER);
+  memcpy(buffer + 32, &crc[0], sizeof(crc[0]));
+  crc[1] = rendezvous__crc32c(0, buffer, RENDEZVOUS__SNAPSHOT_HEADER - 4);
+  memcpy(buffer + 36, &crc[1], sizeof(crc[1]));
+
+  err = RENDEZVOUS_HASHER_ERROR_IO;
+  int fd = open(journal->temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd >= 0)
+  {
+    if (rendezvous__write_all(fd, buffer, size, 0) == RENDEZVOUS_HASHER_OK
+        && fsync(fd) == 0)
+      err = RENDEZVOUS_HASHER_OK;
+    if (close(fd) != 0) err = RENDEZVOUS_HASHER_ERROR_IO;
+  }
+  RENDEZVOUS_HASHER_FREE(buffer);
+  if (err != RENDEZVOUS_HASHER_OK
+      || rename(journal->temp_path, journal->snapshot_path) != 0
+      || fsync(journal->dir_fd) != 0)
+    return RENDEZVOUS_HASHER_ERROR_IO;
+
+  // Until the journal is emptied, the sequence numbers tell which of
+  // its records are in the snapshot
+  if (ftruncate(journal->fd, RENDEZVOUS__JOURNAL_HEADER) != 0
+      || fsync(journal->fd) != 0)
+    return RENDEZVOUS_HASHER_ERROR_IO;
+  journal->records = 0;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// Apply a change to the hasher of [journal] and record it
+static int rendezvous__journal_record(RendezvousHasherJournal *journal,
+                                      unsigned int op,
+                                      RendezvousHasherId id,
+                                      unsigned int weight)
+{
+  if (!journal) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!journal->rh) return RENDEZVOUS_HASHER_ERROR_INVALID;
+  // The last sync failed with a full group
+  if (journal->pending == journal->config.group_size
+      && rendezvous_journal_sync(journal) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_IO;
+  int err = rendezvous__journal_apply(journal->rh, op, id, weight);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  unsigned char *record = journal->group
+    + journal->pending * RENDEZVOUS__JOURNAL_RECORD;
+  unsigned long long seq = ++journal->seq;
+  memcpy(record, &seq, sizeof(seq));
+  memcpy(record + 8, &op, sizeof(op));
+  memcpy(record + 12, &weight, sizeof(weight));
+  memcpy(record + 16, &id, sizeof(id));
+  unsigned int crc =
+    rendezvous__crc32c(0, record, RENDEZVOUS__JOURNAL_RECORD - 4);
+  memcpy(record + RENDEZVOUS__JOURNAL_RECORD - 4, &crc, sizeof(crc));
+
+  if (journal->pending++ == 0) journal->since = rendezvous__now_ms();
+  if ((journal->pending == journal->config.group_size
+       || (journal->pending > 1
+           && rendezvous__now_ms() - journal->since
+              >= journal->config.group_delay_ms))
+      && rendezvous_journal_sync(journal) != RENDEZVOUS_HASHER_OK)
+    return RENDEZVOUS_HASHER_ERROR_UNSYNCED;
+  // Unless the sync of the compaction failed the change is recorded,
+  // the compaction is tried again on the next change
+  if (journal->records + journal->pending >= journal->config.compact_records
+      && rendezvous_journal_compact(journal) != RENDEZVOUS_HASHER_OK
+      && journal->pending > 0)
+    return RENDEZVOUS_HASHER_ERROR_UNSYNCED;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_add_node(RendezvousHasherJournal *journal,
+                            RendezvousHasherId id)
+{
+  // Nodes added without a weight weigh 1 in a weighted hasher
+  return rendezvous__journal_record(journal, RENDEZVOUS__JOURNAL_ADD, id, 1);
 }
 
-#endif // RENDEZVOUS_HASHER_HASHES
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_add_weighted_node(RendezvousHasherJournal *journal,
+                                     RendezvousHasherId id,
+                                     unsigned int weight)
+{
+  if (journal && journal->rh && !journal->rh->weighted)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  return rendezvous__journal_record(journal, RENDEZVOUS__JOURNAL_ADD,
+                                    id, weight);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_remove_node(RendezvousHasherJournal *journal,
+                               RendezvousHasherId id)
+{
+  return rendezvous__journal_record(journal, RENDEZVOUS__JOURNAL_REMOVE,
+                                    id, 0);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_journal_set_weight(RendezvousHasherJournal *journal,
+                              RendezvousHasherId id,
+                              unsigned int weight)
+{
+  return rendezvous__journal_record(journal, RENDEZVOUS__JOURNAL_WEIGHT,
+                                    id, weight);
+}
+
+#endif // RENDEZVOUS_HASHER_JOURNAL
+
+#ifdef RENDEZVOUS_HASHER_RELOAD
+
+// Whole content of [path], NUL terminated
+static int rendezvous__read_file(const char *path, char **text)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return RENDEZVOUS_HASHER_ERROR_IO;
+  struct stat st;
+  int err = RENDEZVOUS_HASHER_ERROR_IO;
+  char *buffer = NULL;
+  size_t size = 0;
+  if (fstat(fd, &st) != 0) goto done;
+  buffer = (char *) RENDEZVOUS_HASHER_MALLOC((size_t) st.st_size + 1);
+  if (!buffer)
+  {
+    err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+    goto done;
+  }
+  // The file may be growing, it is read up to its size at the start
+  while (size < (size_t) st.st_size)
+  {
+    ssize_t n = read(fd, buffer + size, (size_t) st.st_size - size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) goto done;
+    if (n == 0) break;
+    size += (size_t) n;
+  }
+  buffer[size] = '\0';
+  *text = buffer;
+  buffer = NULL;
+  err = RENDEZVOUS_HASHER_OK;
+
+done:
+  if (buffer) RENDEZVOUS_HASHER_FREE(buffer);
+  close(fd);
+  return err;
+}
+
+// Build a snapshot from the membership file of [reload]
+static int rendezvous__reload_build(RendezvousHasherReload *reload,
+                                    RendezvousHasherSnapshot **snapshot)
+{
+  char *text;
+  int err = rendezvous__read_file(reload->path, &text);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  RendezvousHasherSnapshot *s = (RendezvousHasherSnapshot *)
+    RENDEZVOUS_HASHER_MALLOC(sizeof(RendezvousHasherSnapshot));
+  if (!s)
+  {
+    RENDEZVOUS_HASHER_FREE(text);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  err = rendezvous_init_options(&s->rh, &reload->options);
+  if (err != RENDEZVOUS_HASHER_OK)
+  {
+    RENDEZVOUS_HASHER_FREE(s);
+    RENDEZVOUS_HASHER_FREE(text);
+    return err;
+  }
+
+  // One pass to size the table, one to fill it
+  size_t lines = 1;
+  for (const char *c = text; *c; ++c) lines += *c == '\n';
+  err = rendezvous_reserve(&s->rh, lines);
+  rendezvous__engine_defer(&s->rh);
+
+  const char *p = text;
+  while (err == RENDEZVOUS_HASHER_OK && *p)
+  {
+    unsigned long long id, weight = 1;
+    size_t position;
+    p = rendezvous__text_skip(p);
+    if (rendezvous__text_number(&p, &id))
+    {
+      p = rendezvous__text_skip(p);
+      if (*p >= '0' && *p <= '9'
+          && (!rendezvous__text_number(&p, &weight) || weight > UINT_MAX))
+        err = RENDEZVOUS_HASHER_ERROR_INVALID;
+      // The file is refused rather than changed
+      else if ((unsigned long long) (RendezvousHasherId) id != id
+               || rendezvous_find_node(&s->rh, (RendezvousHasherId) id,
+                                       &position) == RENDEZVOUS_HASHER_OK)
+        err = RENDEZVOUS_HASHER_ERROR_INVALID;
+      else if (s->rh.weighted)
+        err = rendezvous_add_weighted_node(&s->rh, (RendezvousHasherId) id,
+                                           (unsigned int) weight);
+      else
+        err = rendezvous_add_node(&s->rh, (RendezvousHasherId) id);
+      p = rendezvous__text_skip(p);
+    }
+    if (err == RENDEZVOUS_HASHER_OK && *p && *p != '\n' && *p != '#')
+      err = RENDEZVOUS_HASHER_ERROR_INVALID;
+    while (*p && *p != '\n') p++;
+    if (*p) p++;
+  }
+  RENDEZVOUS_HASHER_FREE(text);
+  rendezvous__engine_build(&s->rh);
+
+  if (err != RENDEZVOUS_HASHER_OK)
+  {
+    rendezvous_free(&s->rh);
+    RENDEZVOUS_HASHER_FREE(s);
+    return err;
+  }
+  s->version = 0;
+  s->retired = 0;
+  s->next = NULL;
+  *snapshot = s;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+// The nodes of [rh] with their weights, sorted by id
+static RendezvousHasherPackEntry *
+rendezvous__reload_entries(const RendezvousHasher *rh)
+{
+  RendezvousHasherPackEntry *entries = (RendezvousHasherPackEntry *)
+    RENDEZVOUS_HASHER_MALLOC((rh->node_count + 1) * sizeof(RendezvousHasherPackEntry));
+  if (!entries) return NULL;
+  for (size_t i = 0; i < rh->node_count; ++i)
+  {
+    const RendezvousHasherChunk *chunk =
+      rh->chunks[i / RENDEZVOUS_HASHER_CHUNK_SIZE];
+    entries[i].id = chunk->ids[i % RENDEZVOUS_HASHER_CHUNK_SIZE];
+    entries[i].log2_weight = rh->weighted
+      ? chunk->log2_weights[i % RENDEZVOUS_HASHER_CHUNK_SIZE] : 0;
+  }
+  qsort(entries, rh->node_count, sizeof(RendezvousHasherPackEntry),
+        rendezvous__compare_pack);
+  return entries;
+}
+
+// Fill [diff] from its hashers, [ids] and [slots] are set to the
+// memory the caller frees after using it
+static int rendezvous__reload_diff(const RendezvousHasherReload *reload,
+                                   RendezvousHasherReloadDiff *diff,
+                                   RendezvousHasherId **ids,
+                                   size_t **slots)
+{
+  size_t a_n = diff->before->node_count, b_n = diff->after->node_count;
+  size_t slot_count = reload->config.slot_count;
+  RendezvousHasherPackEntry *a = rendezvous__reload_entries(diff->before);
+  RendezvousHasherPackEntry *b = rendezvous__reload_entries(diff->after);
+  *ids = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC((2 * (a_n + b_n) + 1) * sizeof(RendezvousHasherId));
+  *slots = (size_t *) RENDEZVOUS_HASHER_MALLOC(slot_count * sizeof(size_t) + 1);
+  // Items, then the nodes before and after, of each slot
+  RendezvousHasherId *owners = (RendezvousHasherId *)
+    RENDEZVOUS_HASHER_MALLOC(3 * slot_count * sizeof(RendezvousHasherId) + 1);
+  int err = RENDEZVOUS_HASHER_ERROR_ALLOC;
+  if (!a || !b || !*ids || !*slots || !owners) goto done;
+
+  RendezvousHasherId *added = *ids;
+  RendezvousHasherId *removed = added + b_n;
+  RendezvousHasherId *reweighted = removed + a_n;
+  diff->added_count = diff->removed_count = diff->reweighted_count = 0;
+  for (size_t i = 0, j = 0; i < a_n || j < b_n;)
+  {
+    if (j == b_n || (i < a_n && b[j].id > a[i].id))
+      removed[diff->removed_count++] = a[i++].id;
+    else if (i == a_n || a[i].id > b[j].id)
+      added[diff->added_count++] = b[j++].id;
+    else
+    {
+      if (a[i].log2_weight != b[j].log2_weight)
+        reweighted[diff->reweighted_count++] = a[i].id;
+      i++;
+      j++;
+    }
+  }
+  diff->added = added;
+  diff->removed = removed;
+  diff->reweighted = reweighted;
+
+  diff->moved_slot_count = 0;
+  diff->moved_slots = *slots;
+  if (slot_count && a_n && b_n)
+  {
+    for (size_t s = 0; s < slot_count; ++s)
+      owners[s] = (RendezvousHasherId) s;
+    rendezvous_get_nodes_for(diff->before, owners, owners + slot_count, slot_count);
+    rendezvous_get_nodes_for(diff->after, owners, owners + 2 * slot_count, slot_count);
+    for (size_t s = 0; s < slot_count; ++s)
+      if (!(owners[slot_count + s] == owners[2 * slot_count + s]))
+        (*slots)[diff->moved_slot_count++] = s;
+  }
+  else if (slot_count && (a_n || b_n))
+  {
+    // Every slot moves from or to no node
+    for (size_t s = 0; s < slot_count; ++s) (*slots)[s] = s;
+    diff->moved_slot_count = slot_count;
+  }
+  err = RENDEZVOUS_HASHER_OK;
+
+done:
+  if (a) RENDEZVOUS_HASHER_FREE(a);
+  if (b) RENDEZVOUS_HASHER_FREE(b);
+  if (owners) RENDEZVOUS_HASHER_FREE(owners);
+  return err;
+}
+
+// Free the replaced snapshots that no reader can hold. A reader that
+// announced an epoch at least the one of the replacement read
+// [current] after it was swapped
+static void rendezvous__reload_reclaim(RendezvousHasherReload *reload)
+{
+  unsigned long oldest = ULONG_MAX;
+  for (size_t i = 0; i < reload->config.max_readers; ++i)
+  {
+    unsigned long epoch =
+      __atomic_load_n(&reload->slots[i].epoch, __ATOMIC_SEQ_CST);
+    if (epoch != 0 && epoch < oldest) oldest = epoch;
+  }
+  RendezvousHasherSnapshot **p = &reload->retired;
+  while (*p)
+  {
+    RendezvousHasherSnapshot *s = *p;
+    if (s->retired > oldest)
+    {
+      p = &s->next;
+      continue;
+    }
+    *p = s->next;
+    rendezvous_free(&s->rh);
+    RENDEZVOUS_HASHER_FREE(s);
+  }
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_init(RendezvousHasherReload *reload,
+                       const char *path,
+                       const RendezvousHasherOptions *options,
+                       const RendezvousHasherReloadConfig *config)
+{
+  if (!reload) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!path) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+
+  memset(reload, 0, sizeof(*reload));
+  reload->inotify_fd = -1;
+  if (options) reload->options = *options;
+  if (config) reload->config = *config;
+  if (reload->config.max_readers == 0) reload->config.max_readers = 64;
+  // The slots start on a cache line
+  size_t slots = reload->config.max_readers * sizeof(RendezvousHasherReloadSlot);
+  reload->slot_memory =
+    RENDEZVOUS_HASHER_MALLOC(slots + RENDEZVOUS_HASHER_CACHE_LINE);
+  if (!reload->slot_memory) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  reload->slots = (RendezvousHasherReloadSlot *)
+    (((uintptr_t) reload->slot_memory + RENDEZVOUS_HASHER_CACHE_LINE - 1)
+     / RENDEZVOUS_HASHER_CACHE_LINE * RENDEZVOUS_HASHER_CACHE_LINE);
+  memset(reload->slots, 0, slots);
+  // The path, then its directory
+  size_t len = strlen(path);
+  reload->path = (char *) RENDEZVOUS_HASHER_MALLOC(2 * len + 3);
+  if (!reload->path)
+  {
+    rendezvous_reload_free(reload);
+    return RENDEZVOUS_HASHER_ERROR_ALLOC;
+  }
+  memcpy(reload->path, path, len + 1);
+  char *dir = reload->path + len + 1;
+  const char *slash = strrchr(reload->path, '/');
+  reload->name = slash ? slash + 1 : reload->path;
+  if (!slash) strcpy(dir, ".");
+  else if (slash == reload->path) strcpy(dir, "/");
+  else
+  {
+    memcpy(dir, reload->path, (size_t) (slash - reload->path));
+    dir[slash - reload->path] = '\0';
+  }
+
+  int err = rendezvous__reload_build(reload, &reload->current);
+  if (err != RENDEZVOUS_HASHER_OK) goto fail;
+  reload->current->version = reload->version = 1;
+  reload->epoch = 1;
+
+  // Watch the directory: editors and config management often write
+  // a new file and rename it over the old one
+  reload->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  err = RENDEZVOUS_HASHER_ERROR_IO;
+  if (reload->inotify_fd < 0) goto fail;
+  if (inotify_add_watch(reload->inotify_fd, dir,
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    goto fail;
+  return RENDEZVOUS_HASHER_OK;
+
+fail:
+  rendezvous_reload_free(reload);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_free(RendezvousHasherReload *reload)
+{
+  if (!reload) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+
+  if (reload->current)
+  {
+    reload->current->next = reload->retired;
+    reload->retired = reload->current;
+  }
+  while (reload->retired)
+  {
+    RendezvousHasherSnapshot *s = reload->retired;
+    reload->retired = s->next;
+    rendezvous_free(&s->rh);
+    RENDEZVOUS_HASHER_FREE(s);
+  }
+  if (reload->inotify_fd >= 0) close(reload->inotify_fd);
+  if (reload->path) RENDEZVOUS_HASHER_FREE(reload->path);
+  if (reload->slot_memory) RENDEZVOUS_HASHER_FREE(reload->slot_memory);
+  memset(reload, 0, sizeof(*reload));
+  reload->inotify_fd = -1;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_now(RendezvousHasherReload *reload)
+{
+  if (!reload) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!reload->current) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  RendezvousHasherSnapshot *next;
+  int err = rendezvous__reload_build(reload, &next);
+  if (err != RENDEZVOUS_HASHER_OK) return err;
+
+  RendezvousHasherSnapshot *prev = reload->current;
+  RendezvousHasherReloadDiff diff;
+  RendezvousHasherId *ids = NULL;
+  size_t *slots = NULL;
+  memset(&diff, 0, sizeof(diff));
+  diff.before = &prev->rh;
+  diff.after = &next->rh;
+  err = rendezvous__reload_diff(reload, &diff, &ids, &slots);
+  if (err != RENDEZVOUS_HASHER_OK
+      || (diff.added_count == 0 && diff.removed_count == 0
+          && diff.reweighted_count == 0))
+  {
+    // Nothing to publish
+    rendezvous_free(&next->rh);
+    RENDEZVOUS_HASHER_FREE(next);
+    goto done;
+  }
+
+  diff.version = next->version = ++reload->version;
+  __atomic_store_n(&reload->current, next, __ATOMIC_SEQ_CST);
+  prev->retired = __atomic_add_fetch(&reload->epoch, 1, __ATOMIC_SEQ_CST);
+  RENDEZVOUS__PROBE4(snapshot_publish, reload, next->version,
+                     next->rh.node_count, diff.moved_slot_count);
+  if (reload->config.on_reload)
+    reload->config.on_reload(&diff, reload->config.user);
+
+  prev->next = reload->retired;
+  reload->retired = prev;
+  rendezvous__reload_reclaim(reload);
+
+done:
+  if (ids) RENDEZVOUS_HASHER_FREE(ids);
+  if (slots) RENDEZVOUS_HASHER_FREE(slots);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_poll(RendezvousHasherReload *reload,
+                       int timeout_ms)
+{
+  if (!reload) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  rendezvous__reload_reclaim(reload);
+
+  struct pollfd pfd;
+  pfd.fd = reload->inotify_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  int ready = poll(&pfd, 1, timeout_ms);
+  if (ready < 0)
+    return errno == EINTR ? RENDEZVOUS_HASHER_OK : RENDEZVOUS_HASHER_ERROR_IO;
+
+  int changed = 0;
+  union {
+    struct inotify_event event;
+    char bytes[4096];
+  } buffer;
+  ssize_t n;
+  while ((n = read(reload->inotify_fd, buffer.bytes, sizeof(buffer))) > 0)
+    for (ssize_t off = 0; off < n;)
+    {
+      const struct inotify_event *event =
+        (const struct inotify_event *) (buffer.bytes + off);
+      // Dropped events may have been about the file
+      if (event->mask & IN_Q_OVERFLOW) changed = 1;
+      if (event->len && strcmp(event->name, reload->name) == 0) changed = 1;
+      off += (ssize_t) (sizeof(struct inotify_event) + event->len);
+    }
+  return changed ? rendezvous_reload_now(reload) : RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_reader_init(RendezvousHasherReloadReader *reader,
+                              RendezvousHasherReload *reload)
+{
+  if (!reader) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!reload) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+
+  for (size_t i = 0; i < reload->config.max_readers; ++i)
+  {
+    int unused = 0;
+    if (!__atomic_compare_exchange_n(&reload->slots[i].used, &unused, 1, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      continue;
+    reader->reload = reload;
+    reader->slot = &reload->slots[i];
+    return RENDEZVOUS_HASHER_OK;
+  }
+  return RENDEZVOUS_HASHER_ERROR_BUSY;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_reader_free(RendezvousHasherReloadReader *reader)
+{
+  if (!reader) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!reader->slot) return RENDEZVOUS_HASHER_OK;
+
+  __atomic_store_n(&reader->slot->epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&reader->slot->used, 0, __ATOMIC_RELEASE);
+  reader->reload = NULL;
+  reader->slot = NULL;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF RendezvousHasherSnapshot *
+rendezvous_reload_acquire(RendezvousHasherReloadReader *reader)
+{
+  if (!reader || !reader->slot) return NULL;
+  RendezvousHasherReload *reload = reader->reload;
+  // The epoch is announced before [current] is read: either the
+  // publisher sees it and keeps what was current, or the reader sees
+  // the new snapshot
+  unsigned long epoch = __atomic_load_n(&reload->epoch, __ATOMIC_ACQUIRE);
+  __atomic_store_n(&reader->slot->epoch, epoch, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&reload->current, __ATOMIC_SEQ_CST);
+}
+
+RENDEZVOUS_HASHER_DEF void
+rendezvous_reload_release(RendezvousHasherReloadReader *reader)
+{
+  if (reader && reader->slot)
+    __atomic_store_n(&reader->slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_get_node_for(RendezvousHasherReloadReader *reader,
+                               RendezvousHasherId item_id,
+                               RendezvousHasherId *node_id)
+{
+  if (!reader || !reader->slot) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  RendezvousHasherSnapshot *s = rendezvous_reload_acquire(reader);
+  int err = rendezvous_get_node_for(&s->rh, item_id, node_id);
+  rendezvous_reload_release(reader);
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_reload_moved(const RendezvousHasherReloadDiff *diff,
+                        RendezvousHasherId item_id)
+{
+  if (!diff) return 0;
+  RendezvousHasherId before, after;
+  int a = rendezvous_get_node_for(diff->before, item_id, &before);
+  int b = rendezvous_get_node_for(diff->after, item_id, &after);
+  if (a != RENDEZVOUS_HASHER_OK || b != RENDEZVOUS_HASHER_OK) return a != b;
+  return !(before == after);
+}
+
+#endif // RENDEZVOUS_HASHER_RELOAD
+
+#ifdef RENDEZVOUS_HASHER_SHARED
+
+#define RENDEZVOUS__SHARED_MAGIC 0x52485348u // "RHSH"
+#define RENDEZVOUS__SHARED_LINE 64
+
+// Header of a segment, followed by its two tables
+typedef struct {
+  unsigned int magic;         // Written last by rendezvous_shared_create
+  unsigned int id_size;
+  unsigned long long capacity;
+  unsigned long long slot_count;
+  unsigned long long generation; // The current table is generation & 1
+} RendezvousHasherSharedHeader;
+
+// Header of a table, in its own cache line, followed by the ids, the
+// log2 weights and the slots of its nodes
+typedef struct {
+  unsigned long long seq;     // Odd while the publisher writes the table
+  unsigned long long node_count;
+  unsigned int weighted;
+  unsigned int hrw;           // Published from a hasher with the HRW engine
+} RendezvousHasherSharedTable;
+
+static size_t rendezvous__shared_align(size_t size)
+{
+  return (size + RENDEZVOUS__SHARED_LINE - 1)
+    & ~(size_t) (RENDEZVOUS__SHARED_LINE - 1);
+}
+
+static size_t rendezvous__shared_table_size(size_t capacity,
+                                            size_t slot_count)
+{
+  return RENDEZVOUS__SHARED_LINE
+    + rendezvous__shared_align(capacity * sizeof(RendezvousHasherId))
+    + rendezvous__shared_align(capacity * sizeof(int))
+    + rendezvous__shared_align(slot_count * sizeof(RendezvousHasherId));
+}
+
+static RendezvousHasherSharedTable *
+rendezvous__shared_table(const RendezvousHasherShared *shared,
+                         unsigned long long index)
+{
+  return (RendezvousHasherSharedTable *) (shared->base
+    + RENDEZVOUS__SHARED_LINE + (size_t) index
+    * rendezvous__shared_table_size(shared->capacity, shared->slot_count));
+}
+
+static RendezvousHasherId *
+rendezvous__shared_ids(const RendezvousHasherShared *shared,
+                       const RendezvousHasherSharedTable *table)
+{
+  (void) shared;
+  return (RendezvousHasherId *) ((unsigned char *) table
+                                 + RENDEZVOUS__SHARED_LINE);
+}
+
+static int *
+rendezvous__shared_log2_weights(const RendezvousHasherShared *shared,
+                                const RendezvousHasherSharedTable *table)
+{
+  return (int *) ((unsigned char *) rendezvous__shared_ids(shared, table)
+    + rendezvous__shared_align(shared->capacity * sizeof(RendezvousHasherId)));
+}
+
+static RendezvousHasherId *
+rendezvous__shared_slots(const RendezvousHasherShared *shared,
+                         const RendezvousHasherSharedTable *table)
+{
+  return (RendezvousHasherId *) ((unsigned char *)
+    rendezvous__shared_log2_weights(shared, table)
+    + rendezvous__shared_align(shared->capacity * sizeof(int)));
+}
+
+// The current table of [shared] and its [seq], read before using it
+static const RendezvousHasherSharedTable *
+rendezvous__shared_begin(const RendezvousHasherShared *shared,
+                         unsigned long long *seq)
+{
+  const RendezvousHasherSharedHeader *header =
+    (const RendezvousHasherSharedHeader *) shared->base;
+  for (;;)
+  {
+    unsigned long long generation =
+      __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+    const RendezvousHasherSharedTable *table =
+      rendezvous__shared_table(shared, generation & 1);
+    *seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+    // Odd if two publishes happened since [generation] was loaded
+    if ((*seq & 1) == 0) return table;
+  }
+}
+
+// Returns 1 if [table] was rewritten since rendezvous__shared_begin,
+// then what was read from it must be discarded
+static int rendezvous__shared_retry(const RendezvousHasherSharedTable *table,
+                                    unsigned long long seq)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return __atomic_load_n(&table->seq, __ATOMIC_RELAXED) != seq;
+}
+
+// The node count of [table], which may be garbage while it is
+// rewritten: it is clamped so that reads stay in the mapping
+static size_t
+rendezvous__shared_node_count(const RendezvousHasherShared *shared,
+                              const RendezvousHasherSharedTable *table)
+{
+  unsigned long long n = table->node_count;
+  return n > shared->capacity ? shared->capacity : (size_t) n;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_create(RendezvousHasherShared *shared,
+                         const char *path,
+                         size_t capacity,
+                         size_t slot_count)
+{
+  if (!shared) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  memset(shared, 0, sizeof(*shared));
+  shared->fd = -1;
+  if (capacity == 0
+      || capacity > ((size_t) -1 >> 4) / sizeof(RendezvousHasherId)
+      || slot_count > ((size_t) -1 >> 4) / sizeof(RendezvousHasherId))
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  shared->capacity = capacity;
+  shared->slot_count = slot_count;
+  shared->size = RENDEZVOUS__SHARED_LINE
+    + 2 * rendezvous__shared_table_size(capacity, slot_count);
+  shared->fd = path
+    ? open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)
+    : memfd_create("rendezvous-hasher", MFD_CLOEXEC);
+  if (shared->fd < 0) goto fail;
+  shared->owned = 1;
+  // Zero filled, both tables are empty
+  if (ftruncate(shared->fd, (off_t) shared->size) != 0) goto fail;
+  void *base = mmap(NULL, shared->size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, shared->fd, 0);
+  if (base == MAP_FAILED) goto fail;
+  shared->base = (unsigned char *) base;
+  shared->writable = 1;
+
+  RendezvousHasherSharedHeader *header =
+    (RendezvousHasherSharedHeader *) shared->base;
+  header->id_size = sizeof(RendezvousHasherId);
+  header->capacity = capacity;
+  header->slot_count = slot_count;
+  __atomic_store_n(&header->magic, RENDEZVOUS__SHARED_MAGIC, __ATOMIC_RELEASE);
+  return RENDEZVOUS_HASHER_OK;
+
+fail:
+  if (shared->fd >= 0) close(shared->fd);
+  memset(shared, 0, sizeof(*shared));
+  shared->fd = -1;
+  return RENDEZVOUS_HASHER_ERROR_IO;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_attach(RendezvousHasherShared *shared,
+                         int fd)
+{
+  if (!shared) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  memset(shared, 0, sizeof(*shared));
+  shared->fd = fd;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) return RENDEZVOUS_HASHER_ERROR_IO;
+  if ((unsigned long long) st.st_size < RENDEZVOUS__SHARED_LINE)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  void *base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) return RENDEZVOUS_HASHER_ERROR_IO;
+
+  const RendezvousHasherSharedHeader *header =
+    (const RendezvousHasherSharedHeader *) base;
+  if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != RENDEZVOUS__SHARED_MAGIC
+      || header->id_size != sizeof(RendezvousHasherId)
+      || header->capacity == 0
+      || header->capacity > ((size_t) -1 >> 4) / sizeof(RendezvousHasherId)
+      || header->slot_count > ((size_t) -1 >> 4) / sizeof(RendezvousHasherId)
+      || (unsigned long long) st.st_size != RENDEZVOUS__SHARED_LINE
+         + 2 * rendezvous__shared_table_size((size_t) header->capacity,
+                                             (size_t) header->slot_count))
+  {
+    munmap(base, (size_t) st.st_size);
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  }
+
+  shared->base = (unsigned char *) base;
+  shared->size = (size_t) st.st_size;
+  shared->capacity = (size_t) header->capacity;
+  shared->slot_count = (size_t) header->slot_count;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_open(RendezvousHasherShared *shared,
+                       const char *path)
+{
+  if (!shared) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!path) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return RENDEZVOUS_HASHER_ERROR_IO;
+  int err = rendezvous_shared_attach(shared, fd);
+  if (err != RENDEZVOUS_HASHER_OK)
+  {
+    close(fd);
+    shared->fd = -1;
+    return err;
+  }
+  shared->owned = 1;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_close(RendezvousHasherShared *shared)
+{
+  if (!shared) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (shared->base) munmap(shared->base, shared->size);
+  if (shared->owned && shared->fd >= 0) close(shared->fd);
+  memset(shared, 0, sizeof(*shared));
+  shared->fd = -1;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_publish(RendezvousHasherShared *shared,
+                          RendezvousHasher *rh)
+{
+  if (!shared || !rh) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!shared->writable || rh->node_count > shared->capacity)
+    return RENDEZVOUS_HASHER_ERROR_INVALID;
+  int hrw = rh->engine == RENDEZVOUS_HASHER_ENGINE_HRW;
+  if (!hrw && shared->slot_count == 0)
+    return RENDEZVOUS_HASHER_ERROR_UNSUPPORTED;
+
+  RendezvousHasherId *items = NULL;
+  if (shared->slot_count && rh->node_count)
+  {
+    items = (RendezvousHasherId *)
+      RENDEZVOUS_HASHER_MALLOC(shared->slot_count * sizeof(RendezvousHasherId));
+    if (!items) return RENDEZVOUS_HASHER_ERROR_ALLOC;
+    for (size_t s = 0; s < shared->slot_count; ++s)
+      items[s] = (RendezvousHasherId) s;
+  }
+
+  RendezvousHasherSharedHeader *header =
+    (RendezvousHasherSharedHeader *) shared->base;
+  unsigned long long generation =
+    __atomic_load_n(&header->generation, __ATOMIC_RELAXED);
+  const RendezvousHasherSharedTable *current =
+    rendezvous__shared_table(shared, generation & 1);
+  RendezvousHasherSharedTable *next =
+    rendezvous__shared_table(shared, (generation + 1) & 1);
+
+  // Readers still on [next], two publishes behind, will retry
+  unsigned long long seq = next->seq;
+  __atomic_store_n(&next->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  RendezvousHasherId *ids = rendezvous__shared_ids(shared, next);
+  int *log2_weights = rendezvous__shared_log2_weights(shared, next);
+  for (size_t c = 0; c < rh->chunk_count; ++c)
+  {
+    size_t count = rh->node_count - c * RENDEZVOUS_HASHER_CHUNK_SIZE;
+    if (count > RENDEZVOUS_HASHER_CHUNK_SIZE)
+      count = RENDEZVOUS_HASHER_CHUNK_SIZE;
+    size_t at = c * RENDEZVOUS_HASHER_CHUNK_SIZE;
+    memcpy(ids + at, rh->chunks[c]->ids, count * sizeof(RendezvousHasherId));
+    if (rh->weighted)
+      memcpy(log2_weights + at, rh->chunks[c]->log2_weights,
+             count * sizeof(int));
+  }
+  next->node_count = rh->node_count;
+  next->weighted = (unsigned int) rh->weighted;
+  next->hrw = (unsigned int) hrw;
+
+  // Slots moved since the current table, for the probe
+  size_t moved = 0;
+  if (items)
+  {
+    RendezvousHasherId *slots = rendezvous__shared_slots(shared, next);
+    const RendezvousHasherId *before = rendezvous__shared_slots(shared, current);
+    rendezvous_get_nodes_for(rh, items, slots, shared->slot_count);
+    for (size_t s = 0; s < shared->slot_count; ++s)
+      moved += current->node_count == 0 || !(before[s] == slots[s]);
+    RENDEZVOUS_HASHER_FREE(items);
+  }
+
+  __atomic_store_n(&next->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n(&header->generation, generation + 1, __ATOMIC_RELEASE);
+  RENDEZVOUS__PROBE4(shared_publish, shared, generation + 1,
+                     rh->node_count, moved);
+  return RENDEZVOUS_HASHER_OK;
+}
+
+RENDEZVOUS_HASHER_DEF unsigned long long
+rendezvous_shared_generation(const RendezvousHasherShared *shared)
+{
+  if (!shared || !shared->base) return 0;
+  const RendezvousHasherSharedHeader *header =
+    (const RendezvousHasherSharedHeader *) shared->base;
+  return __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+}
+
+RENDEZVOUS_HASHER_DEF size_t
+rendezvous_shared_node_count(const RendezvousHasherShared *shared)
+{
+  if (!shared || !shared->base) return 0;
+  const RendezvousHasherSharedTable *table;
+  unsigned long long seq;
+  size_t n;
+  do {
+    table = rendezvous__shared_begin(shared, &seq);
+    n = rendezvous__shared_node_count(shared, table);
+  } while (rendezvous__shared_retry(table, seq));
+  return n;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_get_node_for(const RendezvousHasherShared *shared,
+                               RendezvousHasherId item_id,
+                               RendezvousHasherId *node_id)
+{
+  if (!shared || !shared->base) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+
+  const RendezvousHasherSharedTable *table;
+  unsigned long long seq;
+  RendezvousHasherId chosen_node_id = 0;
+  int err;
+  do {
+    table = rendezvous__shared_begin(shared, &seq);
+    size_t n = rendezvous__shared_node_count(shared, table);
+    err = n == 0 ? RENDEZVOUS_HASHER_ERROR_EMPTY
+      : !table->hrw ? RENDEZVOUS_HASHER_ERROR_UNSUPPORTED
+      : RENDEZVOUS_HASHER_OK;
+    if (err != RENDEZVOUS_HASHER_OK) continue;
+
+    const RendezvousHasherId *ids = rendezvous__shared_ids(shared, table);
+    const int *log2_weights = rendezvous__shared_log2_weights(shared, table);
+    int weighted = table->weighted != 0;
+    RendezvousHasherHash max_hash = 0;
+    chosen_node_id = ids[0];
+    for (size_t i = 0; i < n; ++i)
+    {
+      RendezvousHasherHash hash = rendezvous__score(ids[i], item_id);
+      if (weighted) hash = rendezvous__weighted_score(hash, log2_weights[i]);
+      if (i == 0 || RENDEZVOUS_HASHER_BEATS(hash, ids[i],
+                                            max_hash, chosen_node_id))
+      {
+        max_hash = hash;
+        chosen_node_id = ids[i];
+      }
+    }
+  } while (rendezvous__shared_retry(table, seq));
+
+  if (err == RENDEZVOUS_HASHER_OK) *node_id = chosen_node_id;
+  return err;
+}
+
+RENDEZVOUS_HASHER_DEF int
+rendezvous_shared_get_node_for_slot(const RendezvousHasherShared *shared,
+                                    size_t slot,
+                                    RendezvousHasherId *node_id)
+{
+  if (!shared || !shared->base) return RENDEZVOUS_HASHER_ERROR_IS_NULL;
+  if (!node_id) return RENDEZVOUS_HASHER_ERROR_ARGUMENT_NULL;
+  if (slot >= shared->slot_count) return RENDEZVOUS_HASHER_ERROR_INVALID;
+
+  const RendezvousHasherSharedTable *table;
+  unsigned long long seq;
+  RendezvousHasherId chosen_node_id = 0;
+  size_t n;
+  do {
+    table = rendezvous__shared_begin(shared, &seq);
+    n = rendezvous__shared_node_count(shared, table);
+    chosen_node_id = rendezvous__shared_slots(shared, table)[slot];
+  } while (rendezvous__shared_retry(table, seq));
+
+  if (n == 0) return RENDEZVOUS_HASHER_ERROR_EMPTY;
+  *node_id = chosen_node_id;
+  return RENDEZVOUS_HASHER_OK;
+}
+
+#endif // RENDEZVOUS_HASHER_SHARED
 
 #endif // RENDEZVOUS_HASHER_IMPLEMENTATION
 
@@ -0,0 +1,54 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Checks a build with 64 bit ids and the default hash, which takes
+// the scalar paths instead of the batch hash of unsigned int arrays
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#define RENDEZVOUS_HASHER_ID_T unsigned long long
+#include "rendezvous-hasher.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+void check_id64(void)
+{
+  printf("========================================================\n");
+  printf("Checking 64 bit ids\n");
+
+  // Ids above 2^32, across the small kernels and the chunked lookup
+  RendezvousHasherId items[1000], nodes[1000];
+  for (size_t i = 0; i < 1000; ++i)
+    items[i] = (RendezvousHasherId) i * 0x9e3779b97f4a7c15ULL;
+
+  for (size_t count = 1; count <= 200; count += 19)
+  {
+    RendezvousHasher rh;
+    assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+    for (size_t n = 0; n < count; ++n)
+      assert(rendezvous_add_node(&rh, (1ULL << 40) + n * 977) == RENDEZVOUS_HASHER_OK);
+
+    assert(rendezvous_get_nodes_for(&rh, items, nodes, 1000) == RENDEZVOUS_HASHER_OK);
+    for (size_t i = 0; i < 1000; ++i)
+    {
+      RendezvousHasherId node_id;
+      assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+      assert(node_id == nodes[i]);
+      assert(node_id >= (1ULL << 40));
+    }
+    assert(rendezvous_remove_node(&rh, 1ULL << 40) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_node_count(&rh) == count - 1);
+    assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  }
+
+  printf("Test successful\n");
+  return;
+}
+
+int main(void)
+{
+  check_id64();
+  return 0;
+}
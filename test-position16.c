@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Checks a build with 16 bit positions across 2^16 nodes, where the
+// last position equals the empty slot marker of the id map
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#define RENDEZVOUS_HASHER_POSITION_T unsigned short
+#include "rendezvous-hasher.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+#define NODES 65536
+
+static RendezvousHasherId node_id_of(size_t n)
+{
+  return (RendezvousHasherId) (n * 3 + 1);
+}
+
+// The node of [id] is at [position], or missing
+static void check_find(RendezvousHasher *rh, RendezvousHasherId id)
+{
+  size_t position;
+  assert(rendezvous_find_node(rh, id, &position) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_node_at(rh, position) == id);
+}
+
+void check_position16(void)
+{
+  printf("========================================================\n");
+  printf("Checking 16 bit positions at 2^16 nodes\n");
+
+  // Grown one node at a time and with a reservation, the map is built
+  // before the boundary in both cases
+  for (int reserve = 0; reserve <= 1; ++reserve)
+  {
+    RendezvousHasher rh;
+    assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+    if (reserve) assert(rendezvous_reserve(&rh, NODES) == RENDEZVOUS_HASHER_OK);
+    for (size_t n = 0; n < NODES; ++n)
+    {
+      assert(rendezvous_add_node(&rh, node_id_of(n)) == RENDEZVOUS_HASHER_OK);
+      if (n == 1000) check_find(&rh, node_id_of(0));
+    }
+    assert(rendezvous_node_count(&rh) == NODES);
+
+    // The nodes at the last positions are found and removed
+    size_t position;
+    check_find(&rh, node_id_of(NODES - 1));
+    check_find(&rh, node_id_of(NODES - 2));
+    for (size_t n = 0; n < NODES; n += 4099) check_find(&rh, node_id_of(n));
+    assert(rendezvous_remove_node(&rh, node_id_of(NODES - 1)) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_node_count(&rh) == NODES - 1);
+    assert(rendezvous_find_node(&rh, node_id_of(NODES - 1), &position)
+           == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+    // Below the boundary the map is back, the moved nodes are found
+    assert(rendezvous_remove_node(&rh, node_id_of(7)) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_remove_node(&rh, node_id_of(8)) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_node_count(&rh) == NODES - 3);
+    check_find(&rh, node_id_of(NODES - 2));
+    check_find(&rh, node_id_of(NODES - 3));
+    assert(rendezvous_find_node(&rh, node_id_of(7), &position)
+           == RENDEZVOUS_HASHER_ERROR_INVALID);
+    for (size_t n = 9; n < NODES - 1; n += 4099) check_find(&rh, node_id_of(n));
+
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, 42, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  }
+
+  printf("Test successful\n");
+  return;
+}
+
+int main(void)
+{
+  check_position16();
+  return 0;
+}
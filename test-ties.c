@@ -0,0 +1,106 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+
+// Checks the canonical order of tied scores. The default hash is
+// bijective, so distinct nodes never tie: here the combine drops the
+// two low bits of the node id, and the four nodes 4g..4g+3 always get
+// the same score. The highest node id of the best group must win
+
+static unsigned int tie_hash(unsigned int x);
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#define RENDEZVOUS_HASHER_HASH tie_hash
+#define RENDEZVOUS_HASHER_COMBINE(node_id, item_id) \
+  (((node_id) >> 2) + (item_id))
+#include "rendezvous-hasher.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+static unsigned int tie_hash(unsigned int x)
+{
+  return rendezvous_hasher_hash_uint32(x);
+}
+
+// The canonical winner for [item_id] among [ids]
+static RendezvousHasherId expected_winner(const RendezvousHasherId *ids,
+                                          size_t count,
+                                          RendezvousHasherId item_id)
+{
+  RendezvousHasherId best = ids[0];
+  for (size_t i = 1; i < count; ++i)
+  {
+    unsigned int a = tie_hash(RENDEZVOUS_HASHER_COMBINE(ids[i], item_id));
+    unsigned int b = tie_hash(RENDEZVOUS_HASHER_COMBINE(best, item_id));
+    if (a > b || (a == b && ids[i] > best)) best = ids[i];
+  }
+  return best;
+}
+
+void check_ties(void)
+{
+  printf("========================================================\n");
+  printf("Checking the canonical winner of tied scores\n");
+
+  // Sizes below and above the small kernels, added in a scrambled
+  // order so that the insertion order cannot decide the ties
+  RendezvousHasherId ids[100];
+  RendezvousHasherId items[500], nodes[500];
+  for (RendezvousHasherId i = 0; i < 500; ++i) items[i] = i * 2654435761u;
+
+  for (size_t count = 1; count <= 100; count += 11)
+  {
+    RendezvousHasher rh;
+    assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+    for (size_t i = 0; i < count; ++i)
+    {
+      ids[i] = (RendezvousHasherId) ((i * 37) % 101);
+      assert(rendezvous_add_node(&rh, ids[i]) == RENDEZVOUS_HASHER_OK);
+    }
+
+    size_t ties = 0;
+    assert(rendezvous_get_nodes_for(&rh, items, nodes, 500) == RENDEZVOUS_HASHER_OK);
+    for (size_t i = 0; i < 500; ++i)
+    {
+      RendezvousHasherId node_id, top[2];
+      RendezvousHasherId expected = expected_winner(ids, count, items[i]);
+      assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+      assert(node_id == expected);
+      assert(nodes[i] == expected);
+      if (count < 2) continue;
+      assert(rendezvous_get_top_nodes(&rh, items[i], 2, top) == RENDEZVOUS_HASHER_OK);
+      assert(top[0] == expected);
+      // The runner up ties with the winner when it is in its group
+      ties += top[1] >> 2 == top[0] >> 2;
+    }
+    // Ties were actually exercised
+    assert(count < 8 || ties > 0);
+    assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  }
+
+  // Equal weights give equal scores too
+  RendezvousHasher rh;
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0, 0, 0 };
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 40; n-- > 0;)
+    assert(rendezvous_add_weighted_node(&rh, n, 3) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < 500; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+    // Every group is full, the winner is the highest id of its group
+    assert(node_id % 4 == 3);
+  }
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+int main(void)
+{
+  check_ties();
+  return 0;
+}
@@ -3,10 +3,36 @@
 // Mail:    giovanni.santini@proton.me
 // Github:  @San7o
 
+// Needed by the NUMA, huge pages, journal and reload modules
+#define _GNU_SOURCE
+
 #define RENDEZVOUS_HASHER_IMPLEMENTATION
+#define RENDEZVOUS_HASHER_REPLICAS
+#define RENDEZVOUS_HASHER_NUMA
+#define RENDEZVOUS_HASHER_HUGE_PAGES
+#define RENDEZVOUS_HASHER_JOURNAL
+#define RENDEZVOUS_HASHER_RELOAD
+#define RENDEZVOUS_HASHER_SHARED
+#define RENDEZVOUS_HASHER_MALLOC test_malloc
+#include <stdlib.h>
+
+// The allocation that makes the countdown reach zero fails
+static size_t malloc_countdown = 0;
+
+static void *test_malloc(size_t size)
+{
+  if (malloc_countdown && --malloc_countdown == 0) return NULL;
+  return malloc(size);
+}
+
 #include "rendezvous-hasher.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <stdio.h>
 
@@ -20,21 +46,21 @@ void print_and_check(RendezvousHasher *rh, RendezvousHasherId item_id)
 
   printf("Assigned node id: %u\n", chosen_node_id);
   printf("Node ids and the hash of node_id + item_id:\n");
-  RendezvousHasherNodeList *it = rh->nodes;
   RendezvousHasherId max_id = {0};
   RendezvousHasherHash max_hash = {0};
-  while (it)
+  for (size_t i = 0; i < rendezvous_node_count(rh); ++i)
   {
-    RendezvousHasherId id_sum = it->id + item_id;
+    RendezvousHasherId id = rendezvous_node_at(rh, i);
+    RendezvousHasherId id_sum = RENDEZVOUS_HASHER_COMBINE(id, item_id);
     RendezvousHasherHash id_sum_hash = RENDEZVOUS_HASHER_HASH(id_sum);
-    printf("  - node_id: %-7u id_sum_hash: %u\n", it->id, id_sum_hash);
+    printf("  - node_id: %-7u id_sum_hash: %u\n", id, id_sum_hash);
 
-    if (id_sum_hash > max_hash)
+    if (i == 0 || RENDEZVOUS_HASHER_BEATS(id_sum_hash, id,
+                                          max_hash, max_id))
     {
       max_hash = id_sum_hash;
-      max_id = it->id;
+      max_id = id;
     }
-    it = it->next;
   }
   assert(chosen_node_id == max_id);
 
@@ -42,8 +68,1846 @@ void print_and_check(RendezvousHasher *rh, RendezvousHasherId item_id)
   return;
 }
 
+void check_hash_n(void)
+{
+  printf("========================================================\n");
+  printf("Checking the batch versions of the built-in hashes\n");
+
+  unsigned int in[1000], out[1000];
+  unsigned int x = 12345;
+  for (size_t i = 0; i < 1000; ++i)
+  {
+    x = x * 1103515245u + 12345u;
+    in[i] = x;
+  }
+
+  unsigned int (*hashes[2])(unsigned int) = {
+    rendezvous_hasher_hash_uint32,
+    rendezvous_hasher_hash_fmix32,
+  };
+  void (*batches[2])(const unsigned int *, unsigned int *, size_t) = {
+    rendezvous_hasher_hash_uint32_n,
+    rendezvous_hasher_hash_fmix32_n,
+  };
+  assert(rendezvous_hasher_hash_fmix32(0) == 0);
+  assert(rendezvous_hasher_hash_fmix32(1) == 0x514e28b7u);
+
+  for (size_t h = 0; h < 2; ++h)
+  {
+    for (size_t n = 0; n < 1000; n += 37)
+    {
+      batches[h](in, out, n);
+      for (size_t i = 0; i < n; ++i)
+        assert(out[i] == hashes[h](in[i]));
+    }
+
+#ifdef RENDEZVOUS_HASHER_X86_SIMD
+    // Every compiled kernel, not only the one picked by the dispatch.
+    // Each hashes the largest multiple of its width and leaves the tail
+    size_t (*kernels[2][3])(const unsigned int *, unsigned int *, size_t) = {
+      { rendezvous__hash_uint32_n_sse2,
+        rendezvous__hash_uint32_n_avx2,
+        rendezvous__hash_uint32_n_avx512 },
+      { rendezvous__hash_fmix32_n_sse2,
+        rendezvous__hash_fmix32_n_avx2,
+        rendezvous__hash_fmix32_n_avx512 },
+    };
+    size_t widths[3] = { 4, 8, 16 };
+    int supported[3] = {
+      __builtin_cpu_supports("sse2"),
+      __builtin_cpu_supports("avx2"),
+      __builtin_cpu_supports("avx512f"),
+    };
+    for (size_t k = 0; k < 3; ++k)
+    {
+      if (!supported[k]) continue;
+      for (size_t n = 0; n < 1000; n += 37)
+      {
+        size_t done = kernels[h][k](in, out, n);
+        assert(done == n / widths[k] * widths[k]);
+        for (size_t i = 0; i < done; ++i)
+          assert(out[i] == hashes[h](in[i]));
+      }
+      printf("Hash %zu, kernel %zu bits checked\n", h, widths[k] * 32);
+    }
+#endif
+  }
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_defined_results(void)
+{
+  printf("========================================================\n");
+  printf("Checking empty hasher, zero scores and insertion order\n");
+
+  RendezvousHasher rh;
+  RendezvousHasherId node_id = 1234;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_node_for(&rh, 0, &node_id)
+         == RENDEZVOUS_HASHER_ERROR_EMPTY);
+  assert(node_id == 1234);
+
+  // rendezvous_hasher_hash_uint32(61) == 0
+  assert(rendezvous_add_node(&rh, 61) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_node_for(&rh, 0, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == 61);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  RendezvousHasher forward, backward;
+  assert(rendezvous_init(&forward) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init(&backward) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId i = 0; i < 50; ++i)
+  {
+    assert(rendezvous_add_node(&forward, i * 7) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_add_node(&backward, (49 - i) * 7) == RENDEZVOUS_HASHER_OK);
+  }
+  for (RendezvousHasherId item_id = 0; item_id < 10000; ++item_id)
+  {
+    RendezvousHasherId a, b;
+    assert(rendezvous_get_node_for(&forward, item_id, &a) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_node_for(&backward, item_id, &b) == RENDEZVOUS_HASHER_OK);
+    assert(a == b);
+  }
+  assert(rendezvous_free(&forward) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&backward) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_clone(void)
+{
+  printf("========================================================\n");
+  printf("Checking copy-on-write clones\n");
+
+  RendezvousHasher rh, clone;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId i = 0; i < 1000; ++i)
+    assert(rendezvous_add_node(&rh, i * 3) == RENDEZVOUS_HASHER_OK);
+
+  assert(rendezvous_clone(&clone, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(clone.chunks[0] == rh.chunks[0]);
+  assert(rendezvous_remove_node(&clone, 300) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_node_count(&clone) == 999);
+  assert(rendezvous_node_count(&rh) == 1000);
+
+  // Only the chunk of the removed node is copied
+  size_t copied = 0;
+  for (size_t c = 0; c < clone.chunk_count; ++c)
+    copied += clone.chunks[c] != rh.chunks[c];
+  assert(copied == 1);
+
+  for (RendezvousHasherId item_id = 0; item_id < 10000; ++item_id)
+  {
+    RendezvousHasherId before, after;
+    assert(rendezvous_get_node_for(&rh, item_id, &before) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_node_for(&clone, item_id, &after) == RENDEZVOUS_HASHER_OK);
+    assert(before == after || before == 300);
+    assert(after != 300);
+  }
+
+  // Removing every node empties the clone without touching [rh]
+  for (RendezvousHasherId i = 0; i < 1000; ++i)
+    assert(rendezvous_remove_node(&clone, i * 3) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_node_count(&clone) == 0);
+  assert(rendezvous_node_count(&rh) == 1000);
+  assert(rendezvous_node_at(&rh, 999) == 999 * 3);
+
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&clone) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_estimate(void)
+{
+  printf("========================================================\n");
+  printf("Checking batch lookups and change estimates\n");
+
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId i = 1; i <= 9; ++i)
+    assert(rendezvous_add_node(&rh, i * 1000) == RENDEZVOUS_HASHER_OK);
+
+  RendezvousHasherId items[5000], nodes[5000];
+  for (size_t i = 0; i < 5000; ++i) items[i] = (RendezvousHasherId) (i * 31);
+  assert(rendezvous_get_nodes_for(&rh, items, nodes, 5000) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < 5000; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(nodes[i] == node_id);
+  }
+
+  // Batches spanning several chunks and groups
+  RendezvousHasher big;
+  assert(rendezvous_init(&big) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId i = 0; i < 300; ++i)
+    assert(rendezvous_add_node(&big, i * 2654435761u) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_nodes_for(&big, items, nodes, 5000) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < 5000; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&big, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(nodes[i] == node_id);
+  }
+  assert(rendezvous_free(&big) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_nodes_for(&rh, items, nodes, 5000) == RENDEZVOUS_HASHER_OK);
+
+  // Adding a tenth node moves about a tenth of the items, all to it
+  RendezvousHasherChange add = { RENDEZVOUS_HASHER_CHANGE_ADD, 10000 };
+  RendezvousHasherEstimate estimate = {0};
+  assert(rendezvous_estimate_change(&rh, &add, 1, 100000, 42, &estimate)
+         == RENDEZVOUS_HASHER_OK);
+  printf("Moved: %f [%f, %f] in %zu samples\n", estimate.moved,
+         estimate.moved_low, estimate.moved_high, estimate.samples);
+  assert(estimate.samples == 100000);
+  assert(estimate.moved_low < estimate.moved && estimate.moved < estimate.moved_high);
+  assert(estimate.moved > 0.09 && estimate.moved < 0.11);
+  assert(estimate.load_count == 10);
+  assert(estimate.loads[9].id == 10000 && estimate.loads[9].before == 0);
+  assert(estimate.loads[9].after == estimate.moved);
+  assert(rendezvous_node_count(&rh) == 9);
+  assert(rendezvous_estimate_free(&estimate) == RENDEZVOUS_HASHER_OK);
+
+  // Early termination
+  estimate.target_half_width = 0.01;
+  assert(rendezvous_estimate_change(&rh, &add, 1, 100000, 42, &estimate)
+         == RENDEZVOUS_HASHER_OK);
+  assert(estimate.samples < 100000);
+  assert((estimate.moved_high - estimate.moved_low) / 2 <= 0.01);
+  assert(rendezvous_estimate_free(&estimate) == RENDEZVOUS_HASHER_OK);
+
+  // With all the keys the estimate is exact
+  RendezvousHasherChange remove = { RENDEZVOUS_HASHER_CHANGE_REMOVE, 3000 };
+  size_t owned = 0;
+  for (size_t i = 0; i < 5000; ++i) owned += nodes[i] == 3000;
+  estimate = (RendezvousHasherEstimate) {0};
+  estimate.keys = items;
+  estimate.key_count = 5000;
+  assert(rendezvous_estimate_change(&rh, &remove, 1, 10000, 0, &estimate)
+         == RENDEZVOUS_HASHER_OK);
+  assert(estimate.samples == 5000);
+  assert(estimate.moved == (double) owned / 5000);
+  assert(estimate.moved_low == estimate.moved);
+  assert(estimate.loads[2].id == 3000 && estimate.loads[2].after == 0);
+  assert(rendezvous_estimate_free(&estimate) == RENDEZVOUS_HASHER_OK);
+
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+typedef struct {
+  size_t moves;
+  RendezvousHasherId last_to;
+} MoveCounter;
+
+void count_move(RendezvousHasherId item_id, RendezvousHasherId from,
+                RendezvousHasherId to, void *user)
+{
+  MoveCounter *counter = user;
+  (void) item_id;
+  assert(!(from == to));
+  counter->moves++;
+  counter->last_to = to;
+}
+
+// Every item is in the list of its owner, once
+static int index_consistent(const RendezvousHasherIndex *index)
+{
+  size_t linked = 0, owners = 0;
+  for (size_t slot = 0; slot < index->owner_capacity; ++slot)
+  {
+    size_t i = index->owners[slot].head;
+    if (i == (size_t) -1) continue;
+    owners++;
+    size_t prev = (size_t) -1;
+    for (; i != (size_t) -1; prev = i, i = index->items[i].next)
+    {
+      if (!(index->items[i].owner == index->owners[slot].id)) return 0;
+      if (index->items[i].prev != prev) return 0;
+      linked++;
+    }
+  }
+  return linked == index->count && owners == index->owner_count;
+}
+
+void check_index(void)
+{
+  printf("========================================================\n");
+  printf("Checking the reverse index of items\n");
+
+  RendezvousHasher rh;
+  RendezvousHasherIndex index;
+  MoveCounter counter = {0};
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_index_init(&index, &rh, count_move, &counter) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_index_register(&index, 1, NULL) == RENDEZVOUS_HASHER_ERROR_EMPTY);
+
+  for (RendezvousHasherId i = 1; i <= 8; ++i)
+    assert(rendezvous_add_node(&rh, i * 100) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < 2000; ++item_id)
+    assert(rendezvous_index_register(&index, item_id, NULL) == RENDEZVOUS_HASHER_OK);
+
+  // Every move to the new node is notified, and nothing else moves
+  assert(rendezvous_index_add_node(&index, 900) == RENDEZVOUS_HASHER_OK);
+  assert(counter.moves > 0 && counter.last_to == 900);
+  size_t owned = 0;
+  for (size_t i = 0; i < index.count; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, index.items[i].item_id, &node_id)
+           == RENDEZVOUS_HASHER_OK);
+    assert(index.items[i].owner == node_id);
+    owned += node_id == 900;
+  }
+  assert(owned == counter.moves);
+
+  // Removing a node moves exactly the items it owned
+  owned = 0;
+  for (size_t i = 0; i < index.count; ++i) owned += index.items[i].owner == 300;
+  counter.moves = 0;
+  assert(rendezvous_index_remove_node(&index, 300) == RENDEZVOUS_HASHER_OK);
+  assert(counter.moves == owned);
+  assert(index_consistent(&index));
+  for (size_t i = 0; i < index.count; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, index.items[i].item_id, &node_id)
+           == RENDEZVOUS_HASHER_OK);
+    assert(index.items[i].owner == node_id);
+  }
+
+  assert(rendezvous_index_unregister(&index, 5) == RENDEZVOUS_HASHER_OK);
+  assert(index.count == 1999);
+  assert(rendezvous_index_unregister(&index, 5) == RENDEZVOUS_HASHER_OK);
+  assert(index.count == 1999);
+
+  // Duplicates are rejected, with the current owner
+  RendezvousHasherId owner, node_id;
+  assert(rendezvous_index_owner(&index, 5, &owner) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_index_owner(&index, 6, &owner) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_index_register(&index, 6, &node_id) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(node_id == owner && index.count == 1999);
+
+  // Unregister in a scrambled order, the map and the owner lists stay
+  // consistent while items move around
+  for (RendezvousHasherId k = 0; k < 1500; ++k)
+  {
+    RendezvousHasherId item_id = (k * 7919) % 2000;
+    assert(rendezvous_index_unregister(&index, item_id) == RENDEZVOUS_HASHER_OK);
+    if (k == 700)
+      assert(rendezvous_index_remove_node(&index, 500) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(index_consistent(&index));
+  for (RendezvousHasherId item_id = 0; item_id < 2000; ++item_id)
+  {
+    int registered = rendezvous_index_owner(&index, item_id, &owner) == RENDEZVOUS_HASHER_OK;
+    if (!registered) continue;
+    assert(rendezvous_get_node_for(&rh, item_id, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(owner == node_id);
+  }
+
+  assert(rendezvous_index_free(&index) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+unsigned int rack_of(RendezvousHasherId id, void *user)
+{
+  (void) user;
+  return id / 100;
+}
+
+void check_placement(void)
+{
+  printf("========================================================\n");
+  printf("Checking shard placement\n");
+
+  // 6 racks of 5 nodes
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId rack = 0; rack < 6; ++rack)
+    for (RendezvousHasherId node = 0; node < 5; ++node)
+      assert(rendezvous_add_node(&rh, rack * 100 + node) == RENDEZVOUS_HASHER_OK);
+
+  RendezvousHasherId top[30];
+  assert(rendezvous_get_top_nodes(&rh, 77, 30, top) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherId winner;
+  assert(rendezvous_get_node_for(&rh, 77, &winner) == RENDEZVOUS_HASHER_OK);
+  assert(top[0] == winner);
+  for (size_t i = 1; i < 30; ++i)
+    assert(RENDEZVOUS_HASHER_BEATS(RENDEZVOUS_HASHER_HASH(RENDEZVOUS_HASHER_COMBINE(top[i - 1], 77)), top[i - 1],
+                                   RENDEZVOUS_HASHER_HASH(RENDEZVOUS_HASHER_COMBINE(top[i], 77)), top[i]));
+
+  // 8 + 3 shards over 6 racks: at most 2 per rack
+  RendezvousHasherPlacement rule = { 11, rack_of, NULL };
+  RendezvousHasherId items[100], shards[100 * 11];
+  for (RendezvousHasherId i = 0; i < 100; ++i) items[i] = i * 7919;
+  assert(rendezvous_place_batch(&rh, &rule, items, 100, shards) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < 100; ++i)
+  {
+    RendezvousHasherId single[11];
+    assert(rendezvous_place(&rh, &rule, items[i], single) == RENDEZVOUS_HASHER_OK);
+    size_t per_rack[6] = {0};
+    for (size_t j = 0; j < 11; ++j)
+    {
+      assert(single[j] == shards[i * 11 + j]);
+      assert(++per_rack[rack_of(single[j], NULL)] <= 2);
+      for (size_t k = 0; k < j; ++k) assert(!(single[k] == single[j]));
+    }
+  }
+
+  // Losing a node moves only its shard
+  RendezvousHasherId *placement = &shards[0];
+  RendezvousHasherId before[11];
+  for (size_t j = 0; j < 11; ++j) before[j] = placement[j];
+  RendezvousHasherId lost = placement[4];
+  assert(rendezvous_remove_node(&rh, lost) == RENDEZVOUS_HASHER_OK);
+  size_t shard;
+  assert(rendezvous_place_repair(&rh, &rule, items[0], placement, lost, &shard)
+         == RENDEZVOUS_HASHER_OK);
+  assert(shard == 4);
+  size_t per_rack[6] = {0};
+  for (size_t j = 0; j < 11; ++j)
+  {
+    assert((j == 4) == !(placement[j] == before[j]));
+    assert(!(placement[j] == lost));
+    assert(++per_rack[rack_of(placement[j], NULL)] <= 2);
+  }
+
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_replicas(void)
+{
+  printf("========================================================\n");
+  printf("Checking per-core replicas\n");
+
+  RendezvousHasherReplicas replicas;
+  RendezvousHasherId node_id;
+  assert(rendezvous_replicas_init(&replicas, 2) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_add_node(&replicas, 10) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_attach(&replicas, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_attach(&replicas, 0) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_replicas_get_node_for(&replicas, 1, 5, &node_id)
+         == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_replicas_get_node_for(&replicas, 0, 5, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == 10);
+
+  // Updates are seen by a core only after it quiesces
+  assert(rendezvous_replicas_remove_node(&replicas, 10) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_add_node(&replicas, 20) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_attach(&replicas, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_get_node_for(&replicas, 0, 5, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == 10);
+  assert(rendezvous_replicas_get_node_for(&replicas, 1, 5, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == 20);
+  assert(rendezvous_replicas_quiesce(&replicas, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_get_node_for(&replicas, 0, 5, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == 20);
+
+  // A full queue rejects the update for every core
+  size_t accepted = 0;
+  while (rendezvous_replicas_add_node(&replicas, 100 + accepted) == RENDEZVOUS_HASHER_OK)
+    accepted++;
+  assert(accepted == RENDEZVOUS_HASHER_REPLICA_QUEUE_SIZE);
+  assert(rendezvous_node_count(&replicas.master) == accepted + 1);
+  assert(rendezvous_replicas_quiesce(&replicas, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_replicas_quiesce(&replicas, 1) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < 1000; ++item_id)
+  {
+    RendezvousHasherId a, b, expected;
+    assert(rendezvous_get_node_for(&replicas.master, item_id, &expected) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_replicas_get_node_for(&replicas, 0, item_id, &a) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_replicas_get_node_for(&replicas, 1, item_id, &b) == RENDEZVOUS_HASHER_OK);
+    assert(a == expected && b == expected);
+  }
+
+  assert(rendezvous_replicas_free(&replicas) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_numa(void)
+{
+  printf("========================================================\n");
+  printf("Checking NUMA placement\n");
+
+  RendezvousHasher plain, bound, what_if;
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_NUMA, 0 };
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&bound, &options) == RENDEZVOUS_HASHER_OK);
+  assert(bound.arena != NULL);
+
+  // Enough nodes to need more than one slab of chunks
+  for (RendezvousHasherId id = 0; id < 20000; ++id)
+  {
+    assert(rendezvous_add_node(&plain, id * 7) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_add_node(&bound, id * 7) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(rendezvous_clone(&what_if, &bound) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId id = 0; id < 20000; id += 3)
+  {
+    assert(rendezvous_remove_node(&plain, id * 7) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_remove_node(&bound, id * 7) == RENDEZVOUS_HASHER_OK);
+  }
+  for (RendezvousHasherId item_id = 0; item_id < 200; ++item_id)
+  {
+    RendezvousHasherId a, b;
+    assert(rendezvous_get_node_for(&plain, item_id, &a) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_node_for(&bound, item_id, &b) == RENDEZVOUS_HASHER_OK);
+    assert(a == b);
+  }
+  // The arena outlives the hasher while the clone uses it
+  assert(rendezvous_free(&bound) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_node_count(&what_if) == 20000);
+  assert(rendezvous_free(&what_if) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+
+  options.numa_node = 4096;
+  assert(rendezvous_init_options(&bound, &options) == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+  // Every replica gives the same results, whichever is local
+  RendezvousHasherNuma numa;
+  RendezvousHasherId node_id;
+  assert(rendezvous_numa_init(&numa) == RENDEZVOUS_HASHER_OK);
+  assert(numa.count == rendezvous_numa_node_count());
+  assert(rendezvous_numa_get_node_for(&numa, 1, &node_id) == RENDEZVOUS_HASHER_ERROR_EMPTY);
+  for (RendezvousHasherId id = 1; id <= 100; ++id)
+    assert(rendezvous_numa_add_node(&numa, id) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_numa_remove_node(&numa, 50) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_numa_local(&numa) != NULL);
+  for (RendezvousHasherId item_id = 0; item_id < 200; ++item_id)
+  {
+    RendezvousHasherId expected;
+    assert(rendezvous_numa_get_node_for(&numa, item_id, &expected) == RENDEZVOUS_HASHER_OK);
+    assert(expected != 50);
+    for (size_t n = 0; n < numa.count; ++n)
+    {
+      if (!numa.replicas[n]) continue;
+      assert(rendezvous_get_node_for(numa.replicas[n], item_id, &node_id) == RENDEZVOUS_HASHER_OK);
+      assert(node_id == expected);
+    }
+  }
+  assert(rendezvous_numa_free(&numa) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_huge_pages(void)
+{
+  printf("========================================================\n");
+  printf("Checking huge pages\n");
+
+  RendezvousHasher plain, huge;
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_HUGE_PAGES
+                                      | RENDEZVOUS_HASHER_OPTION_NUMA, 0 };
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&huge, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_page_size(&huge) == 0);
+
+  for (RendezvousHasherId id = 0; id < 100000; ++id)
+  {
+    assert(rendezvous_add_node(&plain, id) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_add_node(&huge, id) == RENDEZVOUS_HASHER_OK);
+  }
+  size_t page_size = rendezvous_page_size(&huge);
+  printf("Page size: %zu\n", page_size);
+  assert(page_size == rendezvous_page_size(&plain)
+         || page_size == RENDEZVOUS_HASHER_HUGE_PAGE_SIZE);
+  for (RendezvousHasherId item_id = 0; item_id < 50; ++item_id)
+  {
+    RendezvousHasherId a, b;
+    assert(rendezvous_get_node_for(&plain, item_id, &a) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_node_for(&huge, item_id, &b) == RENDEZVOUS_HASHER_OK);
+    assert(a == b);
+  }
+  assert(rendezvous_free(&huge) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_small_kernels(void)
+{
+  printf("========================================================\n");
+  printf("Checking the small node count kernels\n");
+
+  // Grow to past the largest kernel and shrink back, every count must
+  // agree with the generic scan of rendezvous__lookup
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rh.lookup == NULL);
+  for (int pass = 0; pass < 2; ++pass)
+    for (RendezvousHasherId n = 1; n <= 40; ++n)
+    {
+      if (pass == 0)
+        assert(rendezvous_add_node(&rh, n * 2654435761u) == RENDEZVOUS_HASHER_OK);
+      else
+        assert(rendezvous_remove_node(&rh, n * 2654435761u) == RENDEZVOUS_HASHER_OK);
+      if (rendezvous_node_count(&rh) == 0) break;
+
+      for (RendezvousHasherId item_id = 0; item_id < 500; ++item_id)
+      {
+        RendezvousHasherId fast, slow;
+        assert(rendezvous_get_node_for(&rh, item_id, &fast) == RENDEZVOUS_HASHER_OK);
+        rendezvous__lookup(&rh, item_id, &slow, NULL);
+        assert(fast == slow);
+      }
+    }
+  assert(rh.lookup == NULL);
+
+  // Equal scores: the highest id wins in every kernel
+  for (RendezvousHasherId n = 0; n < 5; ++n)
+    assert(rendezvous_add_node(&rh, 7) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_node(&rh, 3) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherId node_id;
+  assert(rendezvous_get_node_for(&rh, 0, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == (rendezvous__score(7, 0) >= rendezvous__score(3, 0) ? 7u : 3u));
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_weighted(void)
+{
+  printf("========================================================\n");
+  printf("Checking weighted nodes\n");
+
+  RendezvousHasher plain;
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&plain, 1, 2) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_set_weight(&plain, 1, 2) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+
+  // The share of each node follows its weight
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0 };
+  RendezvousHasher rh;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 1; n <= 4; ++n)
+    assert(rendezvous_add_weighted_node(&rh, n * 1000, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&rh, 5000, 0) == RENDEZVOUS_HASHER_OK);
+
+  enum { ITEMS = 100000 };
+  static RendezvousHasherId items[ITEMS], before[ITEMS], after[ITEMS];
+  size_t counts[6] = {0};
+  for (size_t i = 0; i < ITEMS; ++i) items[i] = (RendezvousHasherId) (i * 7919 + 13);
+  assert(rendezvous_get_nodes_for(&rh, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < ITEMS; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(node_id == before[i]);
+    counts[node_id / 1000]++;
+  }
+  assert(counts[5] == 0);
+  for (size_t n = 1; n <= 4; ++n)
+  {
+    double expected = ITEMS * n / 10.0;
+    printf("node %zu: %zu items, %.0f expected\n", n * 1000, counts[n], expected);
+    assert(counts[n] > expected * 0.95 && counts[n] < expected * 1.05);
+  }
+
+  // A node that is not there has no weight to change
+  unsigned long version = rh.version;
+  assert(rendezvous_set_weight(&rh, 1001, 3) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rh.version == version);
+
+  // Raising a weight only moves items to that node
+  assert(rendezvous_set_weight(&rh, 1000, 3) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_nodes_for(&rh, items, after, ITEMS) == RENDEZVOUS_HASHER_OK);
+  size_t moved = 0;
+  for (size_t i = 0; i < ITEMS; ++i)
+  {
+    if (after[i] == before[i]) continue;
+    assert(after[i] == 1000);
+    moved++;
+  }
+  assert(moved > 0);
+
+  // The weights follow the nodes on removal and copy on write
+  RendezvousHasher copy;
+  assert(rendezvous_clone(&copy, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_remove_node(&copy, 2000) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < ITEMS; ++i)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&copy, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+    if (after[i] != 2000) assert(node_id == after[i]);
+    assert(node_id != 5000);
+  }
+  assert(rendezvous_free(&copy) == RENDEZVOUS_HASHER_OK);
+
+  // A weight is applied to every copy of an id or to none: the chunks
+  // are shared with a clone, the copy on write of the second fails
+  RendezvousHasher dup;
+  assert(rendezvous_init_options(&dup, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&dup, 7, 2) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 1; n < RENDEZVOUS_HASHER_CHUNK_SIZE; ++n)
+    assert(rendezvous_add_weighted_node(&dup, 100 + n, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&dup, 7, 2) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_clone(&copy, &dup) == RENDEZVOUS_HASHER_OK);
+  // The id map is built by the first lookup, not by the set below
+  size_t position;
+  assert(rendezvous_find_node(&dup, 7, &position) == RENDEZVOUS_HASHER_OK);
+  int log2_weight = dup.chunks[0]->log2_weights[0];
+  version = dup.version;
+  malloc_countdown = 2;
+  assert(rendezvous_set_weight(&dup, 7, 9) == RENDEZVOUS_HASHER_ERROR_ALLOC);
+  malloc_countdown = 0;
+  assert(dup.chunks[0]->log2_weights[0] == log2_weight);
+  assert(dup.chunks[1]->log2_weights[0] == log2_weight);
+  assert(dup.version == version);
+  assert(rendezvous_set_weight(&dup, 7, 9) == RENDEZVOUS_HASHER_OK);
+  assert(dup.chunks[0]->log2_weights[0] != log2_weight);
+  assert(dup.chunks[1]->log2_weights[0] == dup.chunks[0]->log2_weights[0]);
+  assert(copy.chunks[1]->log2_weights[0] == log2_weight);
+  assert(dup.version != version);
+  assert(rendezvous_free(&copy) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&dup) == RENDEZVOUS_HASHER_OK);
+
+  // Scores are integers only, so they are the same everywhere
+  assert(rendezvous__weighted_score(0, 0) == 49586839);
+  assert(rendezvous__weighted_score(0xffffffffu, 0) == 678994629);
+  assert(rendezvous__weighted_score(0x80000000u, 1 << 24) == 150994947);
+
+  // Only weighted chunks carry the weights
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 1; n <= 5; ++n)
+    assert(rendezvous_add_node(&plain, n * 1000) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_memory_size(&plain) < rendezvous_memory_size(&rh));
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+
+  // The index follows weight changes both ways
+  RendezvousHasherIndex index;
+  MoveCounter counter = {0};
+  assert(rendezvous_index_init(&index, &rh, count_move, &counter) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < 2000; ++item_id)
+    assert(rendezvous_index_register(&index, item_id, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_index_set_weight(&index, 42, 1) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  unsigned int weights[] = { 8, 1, 0, 4 };
+  for (size_t w = 0; w < 4; ++w)
+  {
+    counter.moves = 0;
+    assert(rendezvous_index_set_weight(&index, 3000, weights[w]) == RENDEZVOUS_HASHER_OK);
+    assert(counter.moves > 0);
+    assert(index_consistent(&index));
+    for (size_t i = 0; i < index.count; ++i)
+    {
+      RendezvousHasherId node_id;
+      assert(rendezvous_get_node_for(&rh, index.items[i].item_id, &node_id)
+             == RENDEZVOUS_HASHER_OK);
+      assert(index.items[i].owner == node_id);
+    }
+  }
+  assert(rendezvous_index_free(&index) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_id_map(void)
+{
+  printf("========================================================\n");
+  printf("Checking the id map\n");
+
+  // Random removals from a large hasher, checked against a plain list
+  enum { NODES = 3000 };
+  static RendezvousHasherId alive[NODES];
+  size_t alive_count = 0;
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < NODES; ++n)
+  {
+    assert(rendezvous_add_node(&rh, n * 40503u) == RENDEZVOUS_HASHER_OK);
+    alive[alive_count++] = n * 40503u;
+  }
+
+  size_t index;
+  assert(rendezvous_find_node(&rh, 1, &index) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rh.id_map != NULL);
+
+  RendezvousHasher before;
+  assert(rendezvous_clone(&before, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(before.id_map == NULL);
+
+  unsigned int rng = 12345;
+  for (int round = 0; round < 4000; ++round)
+  {
+    rng = rng * 1103515245u + 12345u;
+    if (alive_count > 0 && (rng >> 16) % 3 != 0)
+    {
+      size_t victim = (rng >> 8) % alive_count;
+      assert(rendezvous_remove_node(&rh, alive[victim]) == RENDEZVOUS_HASHER_OK);
+      alive[victim] = alive[--alive_count];
+    }
+    else if (alive_count < NODES)
+    {
+      RendezvousHasherId id = (RendezvousHasherId) round * 7u + 1u;
+      assert(rendezvous_add_node(&rh, id) == RENDEZVOUS_HASHER_OK);
+      alive[alive_count++] = id;
+    }
+    assert(rendezvous_node_count(&rh) == alive_count);
+  }
+  for (size_t i = 0; i < alive_count; ++i)
+  {
+    assert(rendezvous_find_node(&rh, alive[i], &index) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_node_at(&rh, index) == alive[i]);
+  }
+
+  // The clone kept its nodes
+  assert(rendezvous_node_count(&before) == NODES);
+  for (RendezvousHasherId n = 0; n < NODES; ++n)
+    assert(rendezvous_find_node(&before, n * 40503u, &index) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&before) == RENDEZVOUS_HASHER_OK);
+
+  // Duplicates are removed one at a time
+  for (int i = 0; i < 3; ++i)
+    assert(rendezvous_add_node(&rh, 424242) == RENDEZVOUS_HASHER_OK);
+  for (int i = 0; i < 3; ++i)
+  {
+    assert(rendezvous_find_node(&rh, 424242, &index) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_remove_node(&rh, 424242) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(rendezvous_find_node(&rh, 424242, &index) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_node_count(&rh) == alive_count);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  // Every copy of a duplicate gets the new weight
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0 };
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 200; ++n)
+    assert(rendezvous_add_node(&rh, n % 150) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_set_weight(&rh, 5, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rh.id_map != NULL);
+  assert(rendezvous_set_weight(&rh, 120, 0) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < 20000; ++item_id)
+  {
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, item_id, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(node_id != 5 && node_id != 120);
+  }
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_reserve_shrink(void)
+{
+  printf("========================================================\n");
+  printf("Checking reserve and shrink to fit\n");
+
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0 };
+  RendezvousHasher rh;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shrink_to_fit(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reserve(&rh, 5000) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherChunk **chunks = rh.chunks;
+  for (RendezvousHasherId n = 0; n < 5000; ++n)
+    assert(rendezvous_add_weighted_node(&rh, n * 2654435761u, 1 + n % 3) == RENDEZVOUS_HASHER_OK);
+  assert(rh.chunks == chunks);
+
+  for (RendezvousHasherId n = 0; n < 5000; n += 1 + n % 4)
+    assert(rendezvous_remove_node(&rh, n * 2654435761u) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasher shared;
+  assert(rendezvous_clone(&shared, &rh) == RENDEZVOUS_HASHER_OK);
+
+  enum { ITEMS = 5000 };
+  static RendezvousHasherId before[ITEMS], after[ITEMS], items[ITEMS];
+  for (size_t i = 0; i < ITEMS; ++i) items[i] = (RendezvousHasherId) i;
+  assert(rendezvous_get_nodes_for(&rh, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+  size_t count = rendezvous_node_count(&rh);
+  assert(rendezvous_shrink_to_fit(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_node_count(&rh) == count);
+  assert(rh.chunk_capacity == rh.chunk_count);
+  assert(rh.id_map_capacity < 4 * count);
+  for (size_t i = 1; i < count; ++i)
+    assert(rendezvous_node_at(&rh, i - 1) <= rendezvous_node_at(&rh, i));
+  assert(rendezvous_get_nodes_for(&rh, items, after, ITEMS) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < ITEMS; ++i) assert(before[i] == after[i]);
+
+  // The map was rebuilt, the clone did not change
+  size_t index;
+  assert(rendezvous_remove_node(&rh, 2 * 2654435761u) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_find_node(&rh, 2 * 2654435761u, &index) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_find_node(&shared, 2 * 2654435761u, &index) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_nodes_for(&shared, items, after, ITEMS) == RENDEZVOUS_HASHER_OK);
+  for (size_t i = 0; i < ITEMS; ++i) assert(before[i] == after[i]);
+  assert(rendezvous_free(&shared) == RENDEZVOUS_HASHER_OK);
+
+  while (rendezvous_node_count(&rh) > 0)
+    assert(rendezvous_remove_node(&rh, rendezvous_node_at(&rh, 0)) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shrink_to_fit(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rh.chunks == NULL && rh.chunk_capacity == 0);
+  assert(rendezvous_add_node(&rh, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_controller(void)
+{
+  printf("========================================================\n");
+  printf("Checking the weight controller\n");
+
+  RendezvousHasher plain;
+  RendezvousHasherController controller;
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_controller_init(&controller, &plain, NULL) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0 };
+  RendezvousHasher rh;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 8; ++n)
+    assert(rendezvous_add_weighted_node(&rh, n, 1000) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_controller_init(&controller, &rh, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_controller_report(&controller, 99, 1) == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+  // The keys of node 0 cost three times as much
+  enum { ITEMS = 40000 };
+  static RendezvousHasherId items[ITEMS], owners[ITEMS], previous[ITEMS];
+  for (size_t i = 0; i < ITEMS; ++i) items[i] = (RendezvousHasherId) (i * 2654435761u);
+  assert(rendezvous_get_nodes_for(&rh, items, owners, ITEMS) == RENDEZVOUS_HASHER_OK);
+  double imbalance = 0;
+  for (int step = 0; step < 60; ++step)
+  {
+    double load[8] = {0}, mean = 0, max = 0;
+    for (size_t i = 0; i < ITEMS; ++i) load[owners[i]] += owners[i] == 0 ? 3 : 1;
+    for (RendezvousHasherId n = 0; n < 8; ++n)
+    {
+      assert(rendezvous_controller_report(&controller, n, load[n]) == RENDEZVOUS_HASHER_OK);
+      mean += load[n] / 8;
+      max = load[n] > max ? load[n] : max;
+    }
+    imbalance = max / mean;
+    if (step == 0) assert(imbalance > 2);
+
+    double moved;
+    assert(rendezvous_controller_step(&controller, &moved) == RENDEZVOUS_HASHER_OK);
+    assert(moved <= 0.05 + 1e-9);
+    for (size_t i = 0; i < ITEMS; ++i) previous[i] = owners[i];
+    assert(rendezvous_get_nodes_for(&rh, items, owners, ITEMS) == RENDEZVOUS_HASHER_OK);
+    size_t changed = 0;
+    for (size_t i = 0; i < ITEMS; ++i) changed += owners[i] != previous[i];
+    assert(changed < ITEMS * 0.07);
+  }
+  printf("imbalance after 60 steps: %.3f\n", imbalance);
+  assert(imbalance < 1.1);
+  for (size_t i = 0; i < controller.node_count; ++i)
+    assert(controller.nodes[i].weight >= 100 && controller.nodes[i].weight <= 10000);
+
+  // A weight the hasher did not take is not committed: the chunks of a
+  // clone are shared, the copy on write of the second allocation fails
+  RendezvousHasher copy;
+  assert(rendezvous_clone(&copy, &rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 8; ++n)
+    assert(rendezvous_controller_report(&controller, n, n == 0 ? 1000 : 1)
+           == RENDEZVOUS_HASHER_OK);
+  double weight = controller.nodes[0].weight;
+  malloc_countdown = 2;
+  assert(rendezvous_controller_step(&controller, NULL) == RENDEZVOUS_HASHER_ERROR_ALLOC);
+  malloc_countdown = 0;
+  assert(controller.nodes[0].weight == weight);
+  assert(controller.nodes[0].samples == 1);
+  for (RendezvousHasherId n = 1; n < 8; ++n)
+    assert(rendezvous_controller_report(&controller, n, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_controller_step(&controller, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(controller.nodes[0].weight < weight);
+  assert(rendezvous_free(&copy) == RENDEZVOUS_HASHER_OK);
+
+  // Removed nodes are forgotten
+  assert(rendezvous_remove_node(&rh, 3) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_controller_step(&controller, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(controller.node_count == 7);
+  assert(rendezvous_controller_free(&controller) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+// The counters are a heap, found through the index, and the hot keys
+// point back to their counter
+static int hot_consistent(const RendezvousHasherHotKeys *hot)
+{
+  size_t indexed = 0;
+  for (size_t slot = 0; slot < hot->index_capacity; ++slot)
+    indexed += hot->index[slot] != 0;
+  if (indexed != hot->counter_count) return 0;
+  for (size_t i = 0; i < hot->counter_count; ++i)
+  {
+    const RendezvousHasherHotCounter *c = &hot->counters[i];
+    if (i > 0 && c->count < hot->counters[(i - 1) / 2].count) return 0;
+    if (!(rendezvous_hot_is_hot(hot, c->item_id) == (c->hot != 0))) return 0;
+    if (c->hot && hot->hot[c->hot - 1].item_id != c->item_id) return 0;
+  }
+  for (size_t h = 0; h < hot->hot_count; ++h)
+    if (!rendezvous_hot_is_hot(hot, hot->hot[h].item_id)) return 0;
+  return 1;
+}
+
+void check_hot_keys(void)
+{
+  printf("========================================================\n");
+  printf("Checking the hot key detector\n");
+
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 10; ++n)
+    assert(rendezvous_add_node(&rh, n * 7919) == RENDEZVOUS_HASHER_OK);
+
+  RendezvousHasherHotKeys hot;
+  RendezvousHasherHotKeysConfig config = { 0, 0, 0, RENDEZVOUS_HASHER_HOT_FAN_OUT_MAX + 1, 0 };
+  assert(rendezvous_hot_init(&hot, &rh, &config) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  config.fan_out = 3;
+  config.decay_period = 2048;
+  assert(rendezvous_hot_init(&hot, &rh, &config) == RENDEZVOUS_HASHER_OK);
+
+  // Key 42 is a fifth of the traffic
+  RendezvousHasherId node_id, top[3];
+  assert(rendezvous_get_top_nodes(&rh, 42, 3, top) == RENDEZVOUS_HASHER_OK);
+  size_t hits[3] = {0};
+  unsigned int rng = 1;
+  for (int i = 0; i < 50000; ++i)
+  {
+    rng = rng * 1103515245u + 12345u;
+    RendezvousHasherId item_id = i % 5 == 0 ? 42 : 1000 + (rng >> 8) % 100000;
+    assert(rendezvous_hot_get_node_for(&hot, item_id, &node_id) == RENDEZVOUS_HASHER_OK);
+    if (item_id != 42)
+    {
+      RendezvousHasherId expected;
+      assert(rendezvous_get_node_for(&rh, item_id, &expected) == RENDEZVOUS_HASHER_OK);
+      assert(node_id == expected);
+      assert(!rendezvous_hot_is_hot(&hot, item_id));
+    }
+    else if (i >= 25000)
+    {
+      size_t j = 0;
+      while (j < 3 && top[j] != node_id) j++;
+      assert(j < 3);
+      hits[j]++;
+    }
+    if (i % 5000 == 0) assert(hot_consistent(&hot));
+  }
+  assert(hot_consistent(&hot));
+  assert(rendezvous_hot_is_hot(&hot, 42));
+  for (size_t j = 0; j < 3; ++j) assert(hits[j] > 1500);
+
+  // The top nodes follow the membership
+  assert(rendezvous_remove_node(&rh, top[1]) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_get_top_nodes(&rh, 42, 3, top) == RENDEZVOUS_HASHER_OK);
+  for (int i = 0; i < 6; ++i)
+  {
+    assert(rendezvous_hot_get_node_for(&hot, 42, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(node_id == top[0] || node_id == top[1] || node_id == top[2]);
+  }
+
+  // Without its traffic the key cools down
+  for (int i = 0; i < 200000; ++i)
+  {
+    rng = rng * 1103515245u + 12345u;
+    assert(rendezvous_hot_get_node_for(&hot, 1000 + (rng >> 8) % 100000, &node_id) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(hot_consistent(&hot));
+  assert(!rendezvous_hot_is_hot(&hot, 42));
+  assert(rendezvous_hot_get_node_for(&hot, 42, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id == top[0]);
+
+  assert(rendezvous_hot_free(&hot) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+// Fraction of [count] items whose node differs
+static double moved_fraction(const RendezvousHasherId *a,
+                             const RendezvousHasherId *b,
+                             size_t count)
+{
+  size_t moved = 0;
+  for (size_t i = 0; i < count; ++i) moved += a[i] != b[i];
+  return (double) moved / count;
+}
+
+void check_engines(void)
+{
+  printf("========================================================\n");
+  printf("Checking the jump, AnchorHash and Maglev engines\n");
+
+  RendezvousHasher rh;
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0,
+                                      RENDEZVOUS_HASHER_ENGINE_JUMP, 0 };
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_ERROR_UNSUPPORTED);
+  options.flags = 0;
+  options.engine = 42;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  options.engine = RENDEZVOUS_HASHER_ENGINE_MAGLEV;
+  options.engine_size = 65535;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  options.engine_size = 7;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 6; ++n)
+    assert(rendezvous_add_node(&rh, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_node(&rh, 6) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_node_count(&rh) == 6);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  enum { ITEMS = 50000, NODES = 50 };
+  static RendezvousHasherId items[ITEMS], before[ITEMS], after[ITEMS];
+  for (size_t i = 0; i < ITEMS; ++i) items[i] = (RendezvousHasherId) (i * 40503u + 7);
+
+  int engines[3] = { RENDEZVOUS_HASHER_ENGINE_JUMP,
+                     RENDEZVOUS_HASHER_ENGINE_ANCHOR,
+                     RENDEZVOUS_HASHER_ENGINE_MAGLEV };
+  for (int e = 0; e < 3; ++e)
+  {
+    options.engine = engines[e];
+    // AnchorHash starts small to go through a rebuild
+    options.engine_size = engines[e] == RENDEZVOUS_HASHER_ENGINE_ANCHOR ? 16 : 0;
+    assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+    RendezvousHasherId node_id;
+    assert(rendezvous_get_node_for(&rh, 1, &node_id) == RENDEZVOUS_HASHER_ERROR_EMPTY);
+    for (RendezvousHasherId n = 0; n < NODES; ++n)
+      assert(rendezvous_add_node(&rh, 1000 + n * 13) == RENDEZVOUS_HASHER_OK);
+    if (engines[e] == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+      assert(rendezvous_reserve(&rh, 128) == RENDEZVOUS_HASHER_OK);
+
+    // Balanced, the batch agrees with single lookups
+    size_t load[NODES] = {0};
+    assert(rendezvous_get_nodes_for(&rh, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+    for (size_t i = 0; i < ITEMS; ++i)
+    {
+      assert(rendezvous_get_node_for(&rh, items[i], &node_id) == RENDEZVOUS_HASHER_OK);
+      assert(node_id == before[i]);
+      assert(node_id >= 1000 && (node_id - 1000) % 13 == 0);
+      load[(node_id - 1000) / 13]++;
+    }
+    for (size_t n = 0; n < NODES; ++n)
+      assert(load[n] > ITEMS / NODES * 0.7 && load[n] < ITEMS / NODES * 1.3);
+
+    // A new node only takes items
+    assert(rendezvous_add_node(&rh, 5) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_nodes_for(&rh, items, after, ITEMS) == RENDEZVOUS_HASHER_OK);
+    double moved = moved_fraction(before, after, ITEMS);
+    printf("engine %d: %.4f moved on add, ", engines[e], moved);
+    for (size_t i = 0; i < ITEMS; ++i)
+      if (engines[e] != RENDEZVOUS_HASHER_ENGINE_MAGLEV && before[i] != after[i])
+        assert(after[i] == 5);
+    assert(moved > 0.5 / (NODES + 1) && moved < 2.0 / (NODES + 1));
+
+    // A clone is independent
+    RendezvousHasher copy;
+    assert(rendezvous_clone(&copy, &rh) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_remove_node(&copy, 1000 + 20 * 13) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_nodes_for(&copy, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+    moved = moved_fraction(before, after, ITEMS);
+    printf("%.4f on remove\n", moved);
+    for (size_t i = 0; i < ITEMS; ++i)
+      if (engines[e] == RENDEZVOUS_HASHER_ENGINE_ANCHOR && before[i] != after[i])
+        assert(after[i] == 1000 + 20 * 13);
+    assert(moved < (engines[e] == RENDEZVOUS_HASHER_ENGINE_ANCHOR ? 1.5 : 3.0) / NODES);
+    assert(rendezvous_free(&copy) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_nodes_for(&rh, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+    assert(moved_fraction(before, after, ITEMS) == 0);
+
+    // The order of the nodes is kept
+    assert(rendezvous_shrink_to_fit(&rh) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_nodes_for(&rh, items, before, ITEMS) == RENDEZVOUS_HASHER_OK);
+    assert(moved_fraction(before, after, ITEMS) == 0);
+
+    // Only HRW has scores
+    RendezvousHasherId top[2];
+    RendezvousHasherIndex index;
+    RendezvousHasherHotKeys hot;
+    assert(rendezvous_get_top_nodes(&rh, 1, 2, top) == RENDEZVOUS_HASHER_ERROR_UNSUPPORTED);
+    assert(rendezvous_index_init(&index, &rh, NULL, NULL) == RENDEZVOUS_HASHER_ERROR_UNSUPPORTED);
+    assert(rendezvous_hot_init(&hot, &rh, NULL) == RENDEZVOUS_HASHER_ERROR_UNSUPPORTED);
+    assert(rendezvous_set_weight(&rh, 5, 2) == RENDEZVOUS_HASHER_ERROR_INVALID);
+    assert(rendezvous_memory_size(&rh) > 0);
+    assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  }
+
+  printf("Test successful\n");
+  return;
+}
+
+void check_crush(void)
+{
+  printf("========================================================\n");
+  printf("Checking hierarchical placement\n");
+
+  // Root 1000 of type 2, racks 100 to 102 of type 1, eight leaves per
+  // rack with ids 0 to 23. The leaves of rack 102 weigh twice as much
+  RendezvousHasherCrush crush;
+  assert(rendezvous_crush_init(&crush) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherId root = 1000;
+  for (RendezvousHasherId n = 0; n < 24; ++n)
+  {
+    RendezvousHasherId rack = 100 + n / 8;
+    assert(rendezvous_crush_add(&crush, &rack, n, RENDEZVOUS_HASHER_CRUSH_LEAF,
+                                n / 8 == 2 ? 2 : 1) == RENDEZVOUS_HASHER_OK);
+  }
+  for (RendezvousHasherId rack = 100; rack < 103; ++rack)
+    assert(rendezvous_crush_add(&crush, &root, rack, 1, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_crush_build(&crush) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_crush_add(&crush, NULL, root, 2, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_crush_build(&crush) == RENDEZVOUS_HASHER_OK);
+  assert(crush.size == 28 && crush.root_count == 1 && crush.weights[0] == 32);
+
+  RendezvousHasherCrushStep steps[4];
+  size_t step_count;
+  assert(rendezvous_crush_parse("take 1000; chooseleaf 3 type 1", steps, 1,
+                                &step_count) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_crush_parse("take 1000\nchoose 3 rack 1\nemit", steps, 4,
+                                &step_count) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_crush_parse("take 1000\nchoose 2 type 1; choose 1 type 0\nemit",
+                                steps, 4, &step_count) == RENDEZVOUS_HASHER_OK);
+  assert(step_count == 4 && steps[1].op == RENDEZVOUS_HASHER_CRUSH_CHOOSE
+         && steps[1].count == 2 && steps[2].type == 0);
+
+  // Three replicas in three distinct racks
+  RendezvousHasherId ids[4];
+  size_t count;
+  assert(rendezvous_crush_parse("take 1000; chooseleaf 3 type 1; emit", steps, 4,
+                                &step_count) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < 1000; ++item_id)
+  {
+    assert(rendezvous_crush_select(&crush, steps, step_count, item_id,
+                                   ids, 4, &count) == RENDEZVOUS_HASHER_OK);
+    assert(count == 3);
+    assert(ids[0] / 8 != ids[1] / 8 && ids[0] / 8 != ids[2] / 8
+           && ids[1] / 8 != ids[2] / 8);
+  }
+  assert(rendezvous_crush_select(&crush, steps, step_count, 0, ids, 2,
+                                 &count) == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+  // One replica: rack 102 weighs half of the tree. A weight change in
+  // rack 100 moves items only in and out of rack 100, and inside it
+  // only to the changed leaf
+  assert(rendezvous_crush_parse("take 1000; chooseleaf 1 type 1; emit", steps, 4,
+                                &step_count) == RENDEZVOUS_HASHER_OK);
+  enum { ITEMS = 20000 };
+  static RendezvousHasherId before[ITEMS];
+  size_t rack_load[3] = {0};
+  for (RendezvousHasherId item_id = 0; item_id < ITEMS; ++item_id)
+  {
+    assert(rendezvous_crush_select(&crush, steps, step_count, item_id,
+                                   &before[item_id], 1, &count) == RENDEZVOUS_HASHER_OK);
+    rack_load[before[item_id] / 8]++;
+  }
+  assert(rack_load[2] > ITEMS * 0.47 && rack_load[2] < ITEMS * 0.53);
+  assert(rack_load[0] > ITEMS * 0.22 && rack_load[0] < ITEMS * 0.28);
+
+  assert(rendezvous_crush_set_weight(&crush, 100, 5) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_crush_set_weight(&crush, 3, 5) == RENDEZVOUS_HASHER_OK);
+  assert(crush.weights[0] == 36);
+  size_t moved = 0;
+  for (RendezvousHasherId item_id = 0; item_id < ITEMS; ++item_id)
+  {
+    RendezvousHasherId after;
+    assert(rendezvous_crush_select(&crush, steps, step_count, item_id,
+                                   &after, 1, &count) == RENDEZVOUS_HASHER_OK);
+    if (after == before[item_id]) continue;
+    moved++;
+    assert(after / 8 == 0);
+    assert(before[item_id] / 8 != 0 || after == 3);
+  }
+  assert(moved > 0 && moved < ITEMS * 0.2);
+
+  // A leaf without weight is never picked
+  assert(rendezvous_crush_set_weight(&crush, 3, 0) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0; item_id < ITEMS; ++item_id)
+  {
+    assert(rendezvous_crush_select(&crush, steps, step_count, item_id,
+                                   ids, 1, &count) == RENDEZVOUS_HASHER_OK);
+    assert(count == 1 && ids[0] != 3);
+  }
+
+  assert(rendezvous_crush_add(&crush, &root, 7, 1, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_crush_build(&crush) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_crush_free(&crush) == RENDEZVOUS_HASHER_OK);
+
+  printf("Test successful\n");
+  return;
+}
+
+// Whether [a] and [b] have the same nodes in the same order and give
+// the same nodes to the items
+static int same_hashers(RendezvousHasher *a, RendezvousHasher *b)
+{
+  if (rendezvous_node_count(a) != rendezvous_node_count(b)) return 0;
+  for (size_t i = 0; i < rendezvous_node_count(a); ++i)
+    if (rendezvous_node_at(a, i) != rendezvous_node_at(b, i)) return 0;
+  for (RendezvousHasherId item_id = 0; item_id < 2000; ++item_id)
+  {
+    RendezvousHasherId x, y;
+    assert(rendezvous_get_node_for(a, item_id, &x) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_get_node_for(b, item_id, &y) == RENDEZVOUS_HASHER_OK);
+    if (x != y) return 0;
+  }
+  return 1;
+}
+
+static size_t file_size(const char *path)
+{
+  struct stat st;
+  return stat(path, &st) == 0 ? (size_t) st.st_size : 0;
+}
+
+static void flip_byte(const char *path, size_t offset)
+{
+  FILE *f = fopen(path, "r+b");
+  assert(f && fseek(f, (long) offset, SEEK_SET) == 0);
+  int c = fgetc(f);
+  assert(c != EOF && fseek(f, (long) offset, SEEK_SET) == 0);
+  assert(fputc(c ^ 0xff, f) != EOF && fclose(f) == 0);
+}
+
+void check_journal(void)
+{
+  printf("========================================================\n");
+  printf("Checking the membership journal\n");
+
+  const char *path = "/tmp/rendezvous-hasher-test.journal";
+  unlink(path);
+  unlink("/tmp/rendezvous-hasher-test.journal.snap");
+
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0, 0, 0 };
+  RendezvousHasher rh, restored, plain;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+
+  // Records are written four at a time
+  RendezvousHasherJournal journal;
+  RendezvousHasherJournalConfig config = { 4, 60000, 0 };
+  assert(rendezvous_journal_open(&journal, &rh, path, &config) == RENDEZVOUS_HASHER_OK);
+  size_t header = file_size(path);
+  assert(header > 0);
+  for (RendezvousHasherId n = 0; n < 3; ++n)
+    assert(rendezvous_journal_add_weighted_node(&journal, n, n + 1) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == header);
+  assert(rendezvous_journal_add_node(&journal, 3) == RENDEZVOUS_HASHER_OK);
+  size_t record = (file_size(path) - header) / 4;
+  assert(record > 0 && file_size(path) == header + 4 * record);
+
+  for (RendezvousHasherId n = 4; n < 200; ++n)
+    assert(rendezvous_journal_add_weighted_node(&journal, n, 1 + n % 5) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 200; n += 7)
+    assert(rendezvous_journal_remove_node(&journal, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_set_weight(&journal, 1, 9) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+
+  // Replay into a hasher of another kind, or with nodes, is refused
+  assert(rendezvous_init(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &plain, path, NULL) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_journal_open(&journal, &rh, path, NULL) == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&rh, &restored));
+
+  // Compaction: the journal is emptied, the snapshot has the nodes
+  assert(rendezvous_journal_compact(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == header);
+  assert(rendezvous_journal_remove_node(&journal, 100) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_remove_node(&rh, 100) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == header + record);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+
+  // A torn record at the end is dropped
+  FILE *f = fopen(path, "ab");
+  assert(f && fwrite("torn", 1, 4, f) == 4 && fclose(f) == 0);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == header + record);
+  assert(same_hashers(&rh, &restored));
+
+  // Automatic compaction after enough records
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  config.group_size = 1;
+  config.compact_records = 16;
+  assert(rendezvous_journal_open(&journal, &restored, path, &config) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 1000; n < 1040; ++n)
+  {
+    assert(rendezvous_journal_add_weighted_node(&journal, n, 2) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_add_weighted_node(&rh, n, 2) == RENDEZVOUS_HASHER_OK);
+    assert(file_size(path) < header + 16 * record);
+  }
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&rh, &restored));
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+
+  // A group waits for the next change, or for a flush once it is old
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  config.group_size = 4;
+  config.group_delay_ms = 1;
+  config.compact_records = 0;
+  assert(rendezvous_journal_open(&journal, &restored, path, &config) == RENDEZVOUS_HASHER_OK);
+  size_t synced = file_size(path);
+  assert(rendezvous_journal_flush(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_add_weighted_node(&journal, 2000, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&rh, 2000, 1) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == synced);
+  usleep(5000);
+  assert(rendezvous_journal_flush(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == synced + record);
+
+  // A failed sync keeps the change and its group, the next sync
+  // writes it
+  size_t position;
+  int saved = dup(journal.fd);
+  int readonly = open("/dev/null", O_RDONLY);
+  assert(saved >= 0 && readonly >= 0 && dup2(readonly, journal.fd) == journal.fd);
+  assert(rendezvous_journal_add_weighted_node(&journal, 2001, 1) == RENDEZVOUS_HASHER_OK);
+  usleep(5000);
+  assert(rendezvous_journal_add_weighted_node(&journal, 2002, 1) == RENDEZVOUS_HASHER_ERROR_UNSYNCED);
+  assert(rendezvous_find_node(&restored, 2002, &position) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_sync(&journal) == RENDEZVOUS_HASHER_ERROR_IO);
+  assert(dup2(saved, journal.fd) == journal.fd);
+  assert(close(saved) == 0 && close(readonly) == 0);
+  assert(rendezvous_journal_sync(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == synced + 3 * record);
+  assert(rendezvous_add_weighted_node(&rh, 2001, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_weighted_node(&rh, 2002, 1) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+
+  // A damaged record in the last group is a torn write, before it the
+  // journal is corrupt
+  size_t records = (file_size(path) - header) / record;
+  assert(records >= 3);
+  config.group_size = 1;
+  flip_byte(path, header + record / 2);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, &config) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(file_size(path) == header + records * record);
+  flip_byte(path, header + record / 2);
+  flip_byte(path, header + (records - 1) * record + 3);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, &config) == RENDEZVOUS_HASHER_OK);
+  assert(file_size(path) == header + (records - 1) * record);
+  assert(rendezvous_remove_node(&rh, 2002) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&rh, &restored));
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  unlink(path);
+  unlink("/tmp/rendezvous-hasher-test.journal.snap");
+
+  // The AnchorHash buckets survive a compaction, which depend on the
+  // order of the changes, and the snapshot needs the same engine
+  RendezvousHasherOptions anchor_options = { 0, 0, RENDEZVOUS_HASHER_ENGINE_ANCHOR, 16 };
+  RendezvousHasher anchor;
+  assert(rendezvous_init_options(&anchor, &anchor_options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &anchor, path, NULL) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 40; ++n)
+    assert(rendezvous_journal_add_node(&journal, n) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId k = 0; k < 40; ++k)
+    if ((k * 7) % 40 % 3 == 0)
+      assert(rendezvous_journal_remove_node(&journal, (k * 7) % 40) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 100; n < 105; ++n)
+    assert(rendezvous_journal_add_node(&journal, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_compact(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_add_node(&journal, 200) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &plain, path, NULL) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &anchor_options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&anchor, &restored));
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&anchor) == RENDEZVOUS_HASHER_OK);
+  unlink(path);
+  unlink("/tmp/rendezvous-hasher-test.journal.snap");
+
+  // The Maglev table is built once the snapshot and the records are
+  // loaded, and is the one built after each change
+  RendezvousHasherOptions maglev_options = { 0, 0, RENDEZVOUS_HASHER_ENGINE_MAGLEV, 1009 };
+  RendezvousHasher maglev;
+  assert(rendezvous_init_options(&maglev, &maglev_options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &maglev, path, NULL) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 100; ++n)
+    assert(rendezvous_journal_add_node(&journal, n * 3) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_compact(&journal) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 100; n += 7)
+    assert(rendezvous_journal_remove_node(&journal, n * 3) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_add_node(&journal, 1000) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init_options(&restored, &maglev_options) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_journal_open(&journal, &restored, path, NULL) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&maglev, &restored));
+  assert(rendezvous_journal_close(&journal) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&maglev) == RENDEZVOUS_HASHER_OK);
+
+  assert(rendezvous_free(&restored) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&plain) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  unlink(path);
+  unlink("/tmp/rendezvous-hasher-test.journal.snap");
+
+  printf("Test successful\n");
+  return;
+}
+
+static void write_file(const char *path, const char *text)
+{
+  FILE *f = fopen(path, "w");
+  assert(f && fputs(text, f) >= 0 && fclose(f) == 0);
+}
+
+// The last diff, its arrays are valid only during the callback
+static RendezvousHasherReloadDiff last_diff;
+static RendezvousHasherId last_added, last_removed, last_reweighted;
+static size_t reloads, slots_checked;
+
+static void on_reload(const RendezvousHasherReloadDiff *diff, void *user)
+{
+  (void) user;
+  reloads++;
+  last_diff = *diff;
+  if (diff->added_count) last_added = diff->added[0];
+  if (diff->removed_count) last_removed = diff->removed[0];
+  if (diff->reweighted_count) last_reweighted = diff->reweighted[0];
+  // Slots are item ids, the moved ones are the ones whose node changed
+  size_t m = 0;
+  for (size_t slot = 0; slot < 1024; ++slot)
+  {
+    int moved = m < diff->moved_slot_count && diff->moved_slots[m] == slot;
+    assert(rendezvous_reload_moved(diff, (RendezvousHasherId) slot) == moved);
+    m += moved;
+    slots_checked++;
+  }
+}
+
+#define RELOAD_READERS 4
+static int reload_stop;
+
+// Every snapshot has the nodes 100v..100v+3 of its version
+static void *reload_reader(void *arg)
+{
+  RendezvousHasherReloadReader reader;
+  assert(rendezvous_reload_reader_init(&reader, (RendezvousHasherReload *) arg)
+         == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId item_id = 0;
+       !__atomic_load_n(&reload_stop, __ATOMIC_RELAXED); ++item_id)
+  {
+    RendezvousHasherSnapshot *s = rendezvous_reload_acquire(&reader);
+    RendezvousHasherId node_id, base = rendezvous_node_at(&s->rh, 0) / 100;
+    assert(rendezvous_node_count(&s->rh) == 4);
+    assert(rendezvous_get_node_for(&s->rh, item_id, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(node_id / 100 == base);
+    rendezvous_reload_release(&reader);
+  }
+  assert(rendezvous_reload_reader_free(&reader) == RENDEZVOUS_HASHER_OK);
+  return NULL;
+}
+
+void check_reload(void)
+{
+  printf("========================================================\n");
+  printf("Checking the reload of a membership file\n");
+
+  const char *path = "/tmp/rendezvous-hasher-test.nodes";
+  const char *temp = "/tmp/rendezvous-hasher-test.nodes.tmp";
+  write_file(path, "# nodes\n1\n2 \n3 # third\n\n4\n");
+
+  RendezvousHasherReload reload;
+  RendezvousHasherReloadConfig config = { 1024, on_reload, NULL };
+  assert(rendezvous_reload_init(&reload, "/tmp/rendezvous-hasher-missing", NULL,
+                                &config) == RENDEZVOUS_HASHER_ERROR_IO);
+  assert(rendezvous_reload_init(&reload, path, NULL, &config) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherReloadReader reader, other;
+  assert(rendezvous_reload_reader_init(&reader, &reload) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_init(&other, &reload) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherSnapshot *held = rendezvous_reload_acquire(&reader);
+  assert(held->version == 1 && rendezvous_node_count(&held->rh) == 4);
+
+  // Replaced by a rename, as config management does
+  write_file(temp, "1\n2\n3\n5\n");
+  assert(rename(temp, path) == 0);
+  assert(rendezvous_reload_poll(&reload, 1000) == RENDEZVOUS_HASHER_OK);
+  assert(reloads == 1 && slots_checked == 1024 && reload.version == 2);
+  assert(last_diff.added_count == 1 && last_added == 5);
+  assert(last_diff.removed_count == 1 && last_removed == 4);
+  assert(last_diff.reweighted_count == 0);
+  assert(last_diff.moved_slot_count > 1024 / 8 && last_diff.moved_slot_count < 1024 / 2);
+
+  // The snapshot held by a reader stays valid until it is released
+  RendezvousHasherId node_id;
+  assert(rendezvous_node_count(&held->rh) == 4 && reload.retired == held);
+  assert(rendezvous_reload_get_node_for(&other, 42, &node_id) == RENDEZVOUS_HASHER_OK);
+  assert(node_id != 4);
+  assert(rendezvous_reload_poll(&reload, 0) == RENDEZVOUS_HASHER_OK);
+  assert(reload.retired == held);
+  rendezvous_reload_release(&reader);
+  assert(rendezvous_reload_poll(&reload, 0) == RENDEZVOUS_HASHER_OK);
+  assert(reload.retired == NULL);
+
+  // Rewritten in place with the same nodes: nothing is published
+  write_file(path, "5\n3\n2\n1\n");
+  assert(rendezvous_reload_poll(&reload, 1000) == RENDEZVOUS_HASHER_OK);
+  assert(reloads == 1 && reload.version == 2);
+
+  // A file that does not parse keeps the current snapshot
+  write_file(path, "1\n2\nthree\n");
+  assert(rendezvous_reload_poll(&reload, 1000) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(reload.version == 2 && rendezvous_node_count(&reload.current->rh) == 4);
+
+  // So does one with an id twice, or out of the range of the ids
+  write_file(path, "1\n2\n1\n");
+  assert(rendezvous_reload_now(&reload) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  write_file(path, "1\n4294967297\n");
+  assert(rendezvous_reload_now(&reload) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(reload.version == 2 && rendezvous_node_count(&reload.current->rh) == 4);
+
+  // The readers are limited
+  config.max_readers = 2;
+  RendezvousHasherReload small;
+  write_file(path, "1\n");
+  assert(rendezvous_reload_init(&small, path, NULL, &config) == RENDEZVOUS_HASHER_OK);
+  RendezvousHasherReloadReader readers[3];
+  assert(rendezvous_reload_reader_init(&readers[0], &small) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_init(&readers[1], &small) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_init(&readers[2], &small) == RENDEZVOUS_HASHER_ERROR_BUSY);
+  assert(rendezvous_reload_reader_free(&readers[0]) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_init(&readers[2], &small) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_free(&readers[1]) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_free(&readers[2]) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_free(&small) == RENDEZVOUS_HASHER_OK);
+  config.max_readers = 0;
+
+  assert(rendezvous_reload_reader_free(&reader) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_reader_free(&other) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_reload_free(&reload) == RENDEZVOUS_HASHER_OK);
+
+  // Weights
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0, 0, 0 };
+  write_file(path, "1 5\n2\n3 2\n");
+  assert(rendezvous_reload_init(&reload, path, &options, &config) == RENDEZVOUS_HASHER_OK);
+  write_file(path, "1 5\n2 3\n3 2\n");
+  assert(rendezvous_reload_now(&reload) == RENDEZVOUS_HASHER_OK);
+  assert(reloads == 2 && last_diff.reweighted_count == 1 && last_reweighted == 2);
+  assert(last_diff.added_count == 0 && last_diff.removed_count == 0);
+  assert(rendezvous_reload_free(&reload) == RENDEZVOUS_HASHER_OK);
+
+  // The Maglev table of a reloaded file is the one built node by node
+  RendezvousHasherOptions maglev_options = { 0, 0, RENDEZVOUS_HASHER_ENGINE_MAGLEV, 1009 };
+  RendezvousHasher maglev;
+  assert(rendezvous_init_options(&maglev, &maglev_options) == RENDEZVOUS_HASHER_OK);
+  FILE *f = fopen(path, "w");
+  assert(f);
+  for (RendezvousHasherId n = 0; n < 100; ++n)
+  {
+    assert(fprintf(f, "%u\n", (unsigned int) (n * 3)) > 0);
+    assert(rendezvous_add_node(&maglev, n * 3) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(fclose(f) == 0);
+  assert(rendezvous_reload_init(&reload, path, &maglev_options, &config) == RENDEZVOUS_HASHER_OK);
+  assert(same_hashers(&maglev, &reload.current->rh));
+  assert(rendezvous_reload_free(&reload) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_free(&maglev) == RENDEZVOUS_HASHER_OK);
+
+  // Readers keep looking up while snapshots are published, and the
+  // replaced ones are freed while they do
+  write_file(path, "0\n1\n2\n3\n");
+  assert(rendezvous_reload_init(&reload, path, NULL, NULL) == RENDEZVOUS_HASHER_OK);
+  pthread_t threads[RELOAD_READERS];
+  for (size_t t = 0; t < RELOAD_READERS; ++t)
+    assert(pthread_create(&threads[t], NULL, reload_reader, &reload) == 0);
+  char text[64];
+  for (int v = 1; v <= 200; ++v)
+  {
+    snprintf(text, sizeof(text), "%d\n%d\n%d\n%d\n",
+             v * 100, v * 100 + 1, v * 100 + 2, v * 100 + 3);
+    write_file(path, text);
+    assert(rendezvous_reload_now(&reload) == RENDEZVOUS_HASHER_OK);
+  }
+  size_t polls = 0;
+  while (reload.retired && polls++ < 10000)
+  {
+    usleep(100);
+    assert(rendezvous_reload_poll(&reload, 0) == RENDEZVOUS_HASHER_OK);
+  }
+  assert(reload.retired == NULL);
+  __atomic_store_n(&reload_stop, 1, __ATOMIC_RELAXED);
+  for (size_t t = 0; t < RELOAD_READERS; ++t)
+    assert(pthread_join(threads[t], NULL) == 0);
+  assert(rendezvous_reload_free(&reload) == RENDEZVOUS_HASHER_OK);
+  unlink(path);
+
+  printf("Test successful\n");
+  return;
+}
+
+// Every item and slot has the same node in [shared] as in [rh]
+static int same_as_shared(RendezvousHasher *rh,
+                          const RendezvousHasherShared *shared)
+{
+  RendezvousHasherId expected, node_id;
+  for (RendezvousHasherId item = 0; item < 2000; ++item)
+  {
+    assert(rendezvous_get_node_for(rh, item * 7919, &expected) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_shared_get_node_for(shared, item * 7919, &node_id) == RENDEZVOUS_HASHER_OK);
+    if (!(node_id == expected)) return 0;
+  }
+  for (size_t slot = 0; slot < shared->slot_count; ++slot)
+  {
+    assert(rendezvous_get_node_for(rh, (RendezvousHasherId) slot, &expected) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_shared_get_node_for_slot(shared, slot, &node_id) == RENDEZVOUS_HASHER_OK);
+    if (!(node_id == expected)) return 0;
+  }
+  return 1;
+}
+
+void check_shared(void)
+{
+  printf("========================================================\n");
+  printf("Checking the shared memory tables\n");
+
+  RendezvousHasherShared publisher, worker;
+  assert(rendezvous_shared_create(&publisher, NULL, 0, 0) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_shared_create(&publisher, NULL, 100, 256) == RENDEZVOUS_HASHER_OK);
+  // A second mapping of the same segment, as in a worker
+  assert(rendezvous_shared_attach(&worker, publisher.fd) == RENDEZVOUS_HASHER_OK);
+  assert(worker.base != publisher.base && worker.capacity == 100 && worker.slot_count == 256);
+
+  RendezvousHasherId node_id;
+  assert(rendezvous_shared_generation(&worker) == 0);
+  assert(rendezvous_shared_get_node_for(&worker, 1, &node_id) == RENDEZVOUS_HASHER_ERROR_EMPTY);
+  assert(rendezvous_shared_get_node_for_slot(&worker, 256, &node_id) == RENDEZVOUS_HASHER_ERROR_INVALID);
+
+  RendezvousHasher rh;
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 70; ++n)
+    assert(rendezvous_add_node(&rh, n * 31 + 5) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&worker, &rh) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_generation(&worker) == 1);
+  assert(rendezvous_shared_node_count(&worker) == 70);
+  assert(same_as_shared(&rh, &worker));
+
+  // A worker forked before the next publish sees it
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0)
+  {
+    for (int i = 0; i < 10000 && rendezvous_shared_generation(&worker) < 2; ++i)
+      usleep(1000);
+    assert(rendezvous_remove_node(&rh, 5) == RENDEZVOUS_HASHER_OK);
+    _exit(rendezvous_shared_generation(&worker) == 2 && same_as_shared(&rh, &worker) ? 0 : 1);
+  }
+  assert(rendezvous_remove_node(&rh, 5) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_OK);
+  int status;
+  assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(rendezvous_shared_node_count(&worker) == 69);
+
+  // Too many nodes
+  for (RendezvousHasherId n = 1000; n < 1040; ++n)
+    assert(rendezvous_add_node(&rh, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  assert(rendezvous_shared_generation(&worker) == 2);
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  // Weights
+  RendezvousHasherOptions options = { RENDEZVOUS_HASHER_OPTION_WEIGHTED, 0, 0, 0 };
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 40; ++n)
+    assert(rendezvous_add_weighted_node(&rh, n, 1 + n % 5) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_generation(&worker) == 3);
+  assert(same_as_shared(&rh, &worker));
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+
+  // Other engines are served from the slots only
+  options.flags = 0;
+  options.engine = RENDEZVOUS_HASHER_ENGINE_MAGLEV;
+  assert(rendezvous_init_options(&rh, &options) == RENDEZVOUS_HASHER_OK);
+  for (RendezvousHasherId n = 0; n < 10; ++n)
+    assert(rendezvous_add_node(&rh, n) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_get_node_for(&worker, 1, &node_id) == RENDEZVOUS_HASHER_ERROR_UNSUPPORTED);
+  RendezvousHasherId expected;
+  for (size_t slot = 0; slot < 256; ++slot)
+  {
+    assert(rendezvous_get_node_for(&rh, (RendezvousHasherId) slot, &expected) == RENDEZVOUS_HASHER_OK);
+    assert(rendezvous_shared_get_node_for_slot(&worker, slot, &node_id) == RENDEZVOUS_HASHER_OK);
+    assert(node_id == expected);
+  }
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_close(&worker) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_close(&publisher) == RENDEZVOUS_HASHER_OK);
+
+  // Named segment, opened by path
+  const char *path = "/tmp/rendezvous-hasher-test.shm";
+  assert(rendezvous_shared_open(&worker, path) == RENDEZVOUS_HASHER_ERROR_IO);
+  assert(rendezvous_shared_create(&publisher, path, 8, 0) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_open(&worker, path) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_node(&rh, 6969) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_add_node(&rh, 420) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_publish(&publisher, &rh) == RENDEZVOUS_HASHER_OK);
+  assert(same_as_shared(&rh, &worker));
+  assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_close(&worker) == RENDEZVOUS_HASHER_OK);
+  assert(rendezvous_shared_close(&publisher) == RENDEZVOUS_HASHER_OK);
+  write_file(path, "not a segment");
+  assert(rendezvous_shared_open(&worker, path) == RENDEZVOUS_HASHER_ERROR_INVALID);
+  unlink(path);
+
+  printf("Test successful\n");
+  return;
+}
+
 int main(void)
 {
+  check_hash_n();
+  check_defined_results();
+  check_small_kernels();
+  check_weighted();
+  check_controller();
+  check_hot_keys();
+  check_engines();
+  check_crush();
+  check_journal();
+  check_reload();
+  check_shared();
+  check_clone();
+  check_id_map();
+  check_reserve_shrink();
+  check_estimate();
+  check_index();
+  check_placement();
+  check_replicas();
+  check_numa();
+  check_huge_pages();
+
   RendezvousHasher rh;
   assert(rendezvous_init(&rh) == RENDEZVOUS_HASHER_OK);
   
@@ -61,6 +1925,6 @@ int main(void)
   print_and_check(&rh, item_id3); 
   
   assert(rendezvous_free(&rh) == RENDEZVOUS_HASHER_OK);
-  assert(rh.nodes == NULL);
+  assert(rendezvous_node_count(&rh) == 0);
   return 0;
 }
@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+//
+// engine-bench
+// ============
+//
+// Compare the engines of rendezvous-hasher.h (HRW, jump, AnchorHash
+// and Maglev) on the same node sets. For every engine and number of
+// nodes it reports:
+//
+//  - lookup: nanoseconds per rendezvous_get_node_for
+//  - memory: bytes allocated by the hasher, rendezvous_memory_size
+//  - add / remove: fraction of the items that change node when a
+//    node is added or a node from the middle of the table is removed,
+//    next to the minimum 1 / n
+//  - imbalance: items of the most loaded node over the mean
+//
+// Usage:
+//
+//   engine-bench [-i items] [-m max_nodes]
+//
+//   -i  number of items looked up and followed (default: 200000)
+//   -m  largest node count, starting from 10 and growing ten times
+//       at a step (default: 10000)
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#include "../rendezvous-hasher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static size_t item_count = 200000;
+static size_t max_nodes = 10000;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double moved(const RendezvousHasherId *a,
+                    const RendezvousHasherId *b)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < item_count; ++i) count += a[i] != b[i];
+  return (double) count / item_count;
+}
+
+// Items of the most loaded node over the mean, [owners] are node
+// indexes in [0, node_count)
+static double imbalance(const RendezvousHasherId *owners,
+                        size_t node_count)
+{
+  size_t *load = calloc(node_count, sizeof(size_t));
+  size_t max = 0;
+  if (!load) return 0;
+  for (size_t i = 0; i < item_count; ++i)
+    if (++load[owners[i]] > max) max = load[owners[i]];
+  free(load);
+  return max / ((double) item_count / node_count);
+}
+
+static void bench(int engine, const char *name, size_t node_count,
+                  RendezvousHasherId *items,
+                  RendezvousHasherId *before,
+                  RendezvousHasherId *after)
+{
+  RendezvousHasherOptions options = { 0, 0, engine, 0 };
+  if (engine == RENDEZVOUS_HASHER_ENGINE_ANCHOR)
+    options.engine_size = 2 * node_count;
+  RendezvousHasher rh;
+  if (rendezvous_init_options(&rh, &options) != RENDEZVOUS_HASHER_OK)
+    goto fail;
+  for (size_t n = 0; n < node_count; ++n)
+    if (rendezvous_add_node(&rh, (RendezvousHasherId) n) != RENDEZVOUS_HASHER_OK)
+      goto fail;
+
+  RendezvousHasherId node_id = 0, sum = 0;
+  double start = now();
+  for (size_t i = 0; i < item_count; ++i)
+  {
+    rendezvous_get_node_for(&rh, items[i], &node_id);
+    sum += node_id;
+  }
+  double lookup = (now() - start) * 1e9 / item_count;
+  // Keep the lookups alive
+  if (sum == 1) printf(" ");
+  size_t memory = rendezvous_memory_size(&rh);
+
+  rendezvous_get_nodes_for(&rh, items, before, item_count);
+  double balance = imbalance(before, node_count);
+  if (rendezvous_add_node(&rh, (RendezvousHasherId) node_count) != RENDEZVOUS_HASHER_OK)
+    goto fail;
+  rendezvous_get_nodes_for(&rh, items, after, item_count);
+  double added = moved(before, after);
+  if (rendezvous_remove_node(&rh, (RendezvousHasherId) node_count / 2) != RENDEZVOUS_HASHER_OK)
+    goto fail;
+  rendezvous_get_nodes_for(&rh, items, before, item_count);
+  double removed = moved(after, before);
+
+  printf("%-8s %8zu %10.1f %12zu %9.4f %9.4f %9.4f %9.3f\n", name,
+         node_count, lookup, memory, added, removed,
+         1.0 / (node_count + 1), balance);
+  rendezvous_free(&rh);
+  return;
+
+fail:
+  printf("%-8s %8zu   not supported with these options\n", name, node_count);
+  rendezvous_free(&rh);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "i:m:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'i': item_count = strtoul(optarg, NULL, 10); break;
+    case 'm': max_nodes = strtoul(optarg, NULL, 10); break;
+    default:
+      fprintf(stderr, "usage: engine-bench [-i items] [-m max_nodes]\n");
+      return 2;
+    }
+  }
+  if (item_count == 0 || max_nodes < 10)
+  {
+    fprintf(stderr, "engine-bench: need items > 0 and max_nodes >= 10\n");
+    return 2;
+  }
+
+  RendezvousHasherId *items = malloc(item_count * sizeof(RendezvousHasherId));
+  RendezvousHasherId *before = malloc(item_count * sizeof(RendezvousHasherId));
+  RendezvousHasherId *after = malloc(item_count * sizeof(RendezvousHasherId));
+  if (!items || !before || !after)
+  {
+    fprintf(stderr, "engine-bench: out of memory\n");
+    return 1;
+  }
+  for (size_t i = 0; i < item_count; ++i)
+    items[i] = (RendezvousHasherId) (i * 2654435761u);
+
+  const char *names[] = { "hrw", "jump", "anchor", "maglev" };
+  printf("%-8s %8s %10s %12s %9s %9s %9s %9s\n", "engine", "nodes",
+         "lookup ns", "memory", "add", "remove", "minimum", "imbalance");
+  for (size_t nodes = 10; nodes <= max_nodes; nodes *= 10)
+    for (int engine = RENDEZVOUS_HASHER_ENGINE_HRW;
+         engine <= RENDEZVOUS_HASHER_ENGINE_MAGLEV; ++engine)
+      bench(engine, names[engine], nodes, items, before, after);
+
+  free(items);
+  free(before);
+  free(after);
+  return 0;
+}
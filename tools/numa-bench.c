@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+//
+// numa-bench
+// ==========
+//
+// Measure the cost of reading the node table of rendezvous-hasher.h
+// across NUMA nodes. For every memory node a hasher is placed there
+// with RENDEZVOUS_HASHER_OPTION_NUMA and looked up from a CPU of every
+// NUMA node, then the same lookups go through a RendezvousHasherNuma,
+// whose local replica should match the diagonal of the matrix.
+//
+// Usage:
+//
+//   numa-bench [-n nodes] [-i items] [-H]
+//
+//   -n  number of nodes in the hasher (default: 8M), the table should
+//       be larger than the last level cache to measure the memory
+//   -i  number of lookups per measure (default: 32)
+//   -H  back the tables with huge pages, to compare the cost of the
+//       TLB misses
+//
+// The table reports the nanoseconds per scored node, rows are the
+// NUMA node of the CPU and columns the NUMA node of the table, as
+// reported by move_pages(2).
+//
+
+#define _GNU_SOURCE
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#define RENDEZVOUS_HASHER_NUMA
+#define RENDEZVOUS_HASHER_HUGE_PAGES
+#include "../rendezvous-hasher.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_NUMA_NODES 64
+
+static size_t node_count = 8u << 20;
+static size_t item_count = 32;
+static unsigned int flags = RENDEZVOUS_HASHER_OPTION_NUMA;
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// NUMA node holding the page of [p], or -1
+static int numa_node_of(void *p)
+{
+  int status = -1;
+  if (syscall(SYS_move_pages, 0, 1ul, &p, NULL, &status, 0) != 0) return -1;
+  return status;
+}
+
+// Find one CPU per NUMA node, [cpus][n] is -1 if node n has none
+static void find_cpus(int *cpus, size_t count)
+{
+  cpu_set_t saved, one;
+  sched_getaffinity(0, sizeof(saved), &saved);
+  for (size_t n = 0; n < count; ++n) cpus[n] = -1;
+
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+  {
+    if (!CPU_ISSET(cpu, &saved)) continue;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (sched_setaffinity(0, sizeof(one), &one) != 0) continue;
+    unsigned int c, node;
+    if (getcpu(&c, &node) == 0 && node < count && cpus[node] < 0)
+      cpus[node] = cpu;
+  }
+  sched_setaffinity(0, sizeof(saved), &saved);
+}
+
+static void pin(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0)
+  {
+    perror("sched_setaffinity");
+    exit(1);
+  }
+}
+
+// Nanoseconds per scored node, [numa] is used when [rh] is NULL
+static double measure(RendezvousHasher *rh, RendezvousHasherNuma *numa)
+{
+  RendezvousHasherId node_id = 0, sum = 0;
+  double start = now();
+  for (size_t i = 0; i < item_count; ++i)
+  {
+    if (rh) rendezvous_get_node_for(rh, (RendezvousHasherId) i, &node_id);
+    else rendezvous_numa_get_node_for(numa, (RendezvousHasherId) i, &node_id);
+    sum += node_id;
+  }
+  double elapsed = now() - start;
+  // Keep the lookups alive
+  if (sum == 1) printf(" ");
+  return elapsed * 1e9 / ((double) item_count * node_count);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:i:H")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n': node_count = strtoul(optarg, NULL, 10); break;
+    case 'i': item_count = strtoul(optarg, NULL, 10); break;
+    case 'H': flags |= RENDEZVOUS_HASHER_OPTION_HUGE_PAGES; break;
+    default:
+      fprintf(stderr, "usage: numa-bench [-n nodes] [-i items] [-H]\n");
+      return 2;
+    }
+  }
+  if (node_count == 0 || item_count == 0)
+  {
+    fprintf(stderr, "numa-bench: need nodes > 0 and items > 0\n");
+    return 2;
+  }
+
+  size_t count = rendezvous_numa_node_count();
+  if (count > MAX_NUMA_NODES) count = MAX_NUMA_NODES;
+  int cpus[MAX_NUMA_NODES];
+  find_cpus(cpus, count);
+
+  static RendezvousHasher tables[MAX_NUMA_NODES];
+  int table_node[MAX_NUMA_NODES];
+  for (size_t m = 0; m < count; ++m)
+  {
+    RendezvousHasherOptions options = { flags, (int) m };
+    table_node[m] = -1;
+    if (rendezvous_init_options(&tables[m], &options) != RENDEZVOUS_HASHER_OK)
+      continue;
+    for (size_t i = 0; i < node_count; ++i)
+      if (rendezvous_add_node(&tables[m], (RendezvousHasherId) i) != RENDEZVOUS_HASHER_OK)
+      {
+        fprintf(stderr, "numa-bench: out of memory\n");
+        return 1;
+      }
+    table_node[m] = numa_node_of(tables[m].chunks[node_count / 2 / RENDEZVOUS_HASHER_CHUNK_SIZE]);
+  }
+
+  RendezvousHasherNuma numa;
+  if (rendezvous_numa_init(&numa) != RENDEZVOUS_HASHER_OK)
+  {
+    fprintf(stderr, "numa-bench: can not create the replicas\n");
+    return 1;
+  }
+  for (size_t i = 0; i < node_count; ++i)
+    if (rendezvous_numa_add_node(&numa, (RendezvousHasherId) i) != RENDEZVOUS_HASHER_OK)
+    {
+      fprintf(stderr, "numa-bench: out of memory\n");
+      return 1;
+    }
+
+  printf("%zu nodes, %zu lookups, ns per scored node\n", node_count, item_count);
+  for (size_t m = 0; m < count; ++m)
+    if (table_node[m] >= 0)
+      printf("table on node %d: %zu byte pages\n", table_node[m],
+             rendezvous_page_size(&tables[m]));
+  printf("\n");
+  printf("%-10s", "cpu \\ mem");
+  for (size_t m = 0; m < count; ++m)
+    if (table_node[m] >= 0) printf("  node %-4d", table_node[m]);
+  printf("  %-10s\n", "replicas");
+
+  for (size_t c = 0; c < count; ++c)
+  {
+    if (cpus[c] < 0) continue;
+    pin(cpus[c]);
+    printf("node %-5zu", c);
+    for (size_t m = 0; m < count; ++m)
+    {
+      if (table_node[m] < 0) continue;
+      measure(&tables[m], NULL); // Warm up
+      printf("  %9.3f", measure(&tables[m], NULL));
+    }
+    measure(NULL, &numa);
+    printf("  %9.3f\n", measure(NULL, &numa));
+  }
+
+  for (size_t m = 0; m < count; ++m)
+    if (table_node[m] >= 0) rendezvous_free(&tables[m]);
+  rendezvous_numa_free(&numa);
+  return 0;
+}
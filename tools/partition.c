@@ -0,0 +1,505 @@
+// SPDX-License-Identifier: MIT
+// Author:  Giovanni Santini
+// Mail:    giovanni.santini@proton.me
+// Github:  @San7o
+//
+// partition
+// =========
+//
+// Split a (possibly huge) file of newline separated keys into one
+// output file per destination node, using rendezvous-hasher.h to
+// assign every key to a node.
+//
+// Usage:
+//
+//   partition [-t threads] [-c chunk_size] [-b block_size] [-d] [-n]
+//             [-p prefix] input node_id [node_id ...]
+//
+//   -t  number of worker threads (default: 4)
+//   -c  bytes of input assigned to a worker per round (default: 64M)
+//   -b  size of the writes to the output files (default: 1M)
+//   -d  open the output files with O_DIRECT
+//   -n  keys are decimal numbers and are used directly as item ids,
+//       otherwise the item id is the 32 bit FNV-1a hash of the key
+//   -p  prefix of the output files (default: "node-"), the node id
+//       is appended to it
+//
+// The input is mmap(2)-ed and processed in rounds of threads *
+// chunk_size bytes. In each round every worker assigns the keys of
+// its chunk to a node, then the workers emit the keys of the round,
+// each one taking care of a subset of the nodes. Keys are written
+// in chunk order, so every output file lists its keys in the same
+// order as the input and the result does not depend on the number
+// of threads. Memory usage depends on the round size and not on the
+// size of the input.
+//
+
+#define _GNU_SOURCE
+
+#define RENDEZVOUS_HASHER_IMPLEMENTATION
+#include "../rendezvous-hasher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PARTITION_LOOKUP_BATCH 256
+#define PARTITION_DIRECT_ALIGN 4096
+
+typedef struct {
+  size_t offset;  // From the start of the input
+  size_t len;     // Including the newline, if any
+} Span;
+
+typedef struct {
+  Span *items;
+  size_t len;
+  size_t cap;
+} SpanVec;
+
+typedef struct {
+  int fd;
+  char *buf;
+  size_t len;     // Bytes in buf
+  size_t written; // Bytes flushed to fd
+} Writer;
+
+typedef struct {
+  // Settings
+  size_t threads;
+  size_t chunk_size;
+  size_t block_size;
+  int direct;
+  int numeric;
+  const char *prefix;
+
+  // Input
+  const char *data;
+  size_t size;
+
+  // Nodes, sorted by id
+  RendezvousHasher rh;
+  RendezvousHasherId *node_ids;
+  size_t node_count;
+  Writer *writers;
+
+  // Per round state, spans[worker * node_count + node]
+  SpanVec *spans;
+  size_t *chunk_begin;
+  size_t *chunk_end;
+  int failed;
+} Partition;
+
+typedef struct {
+  Partition *p;
+  size_t worker;
+} Job;
+
+static void die(const char *what)
+{
+  perror(what);
+  exit(1);
+}
+
+static void usage(void)
+{
+  fprintf(stderr,
+          "usage: partition [-t threads] [-c chunk_size] [-b block_size]"
+          " [-d] [-n] [-p prefix] input node_id [node_id ...]\n");
+  exit(2);
+}
+
+static size_t parse_size(const char *s)
+{
+  char *end;
+  unsigned long long v = strtoull(s, &end, 10);
+  switch (*end)
+  {
+  case 'k': case 'K': v <<= 10; end++; break;
+  case 'm': case 'M': v <<= 20; end++; break;
+  case 'g': case 'G': v <<= 30; end++; break;
+  default: break;
+  }
+  if (*end != '\0' || v == 0) usage();
+  return (size_t) v;
+}
+
+static RendezvousHasherId key_to_id(const char *key, size_t len, int numeric)
+{
+  RendezvousHasherId id = 0;
+  if (numeric)
+  {
+    for (size_t i = 0; i < len && key[i] >= '0' && key[i] <= '9'; ++i)
+      id = id * 10 + (RendezvousHasherId)(key[i] - '0');
+    return id;
+  }
+
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; ++i)
+  {
+    h ^= (unsigned char) key[i];
+    h *= 16777619u;
+  }
+  return (RendezvousHasherId) h;
+}
+
+static size_t node_index(Partition *p, RendezvousHasherId id)
+{
+  size_t lo = 0, hi = p->node_count;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (p->node_ids[mid] < id) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static int span_push(SpanVec *v, size_t offset, size_t len)
+{
+  if (v->len == v->cap)
+  {
+    size_t cap = v->cap ? v->cap * 2 : 1024;
+    Span *items = realloc(v->items, cap * sizeof(Span));
+    if (!items) return -1;
+    v->items = items;
+    v->cap = cap;
+  }
+  v->items[v->len].offset = offset;
+  v->items[v->len].len = len;
+  v->len++;
+  return 0;
+}
+
+//
+// Output
+//
+
+static int writer_flush(Partition *p, Writer *w, int final)
+{
+  size_t len = w->len;
+  if (p->direct)
+  {
+    // O_DIRECT needs aligned sizes, the tail is padded here and
+    // truncated away by writer_close
+    if (final) len = (len + PARTITION_DIRECT_ALIGN - 1)
+                   / PARTITION_DIRECT_ALIGN * PARTITION_DIRECT_ALIGN;
+    else len -= len % PARTITION_DIRECT_ALIGN;
+    if (len > w->len) memset(w->buf + w->len, 0, len - w->len);
+  }
+
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = write(w->fd, w->buf + done, len - done);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += (size_t) n;
+  }
+
+  size_t payload = len < w->len ? len : w->len;
+  w->written += payload;
+  memmove(w->buf, w->buf + payload, w->len - payload);
+  w->len -= payload;
+  return 0;
+}
+
+static int writer_append(Partition *p, Writer *w, const char *src, size_t len)
+{
+  while (len > 0)
+  {
+    size_t room = p->block_size - w->len;
+    size_t n = len < room ? len : room;
+    memcpy(w->buf + w->len, src, n);
+    w->len += n;
+    src += n;
+    len -= n;
+    if (w->len == p->block_size && writer_flush(p, w, 0) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+static int writer_close(Partition *p, Writer *w)
+{
+  if (w->len > 0 && writer_flush(p, w, 1) < 0) return -1;
+  if (p->direct && ftruncate(w->fd, (off_t) w->written) < 0) return -1;
+  if (close(w->fd) < 0) return -1;
+  free(w->buf);
+  return 0;
+}
+
+static void writers_open(Partition *p)
+{
+  p->writers = calloc(p->node_count, sizeof(Writer));
+  if (!p->writers) die("calloc");
+
+  size_t path_len = strlen(p->prefix) + 32;
+  char *path = malloc(path_len);
+  if (!path) die("malloc");
+
+  for (size_t i = 0; i < p->node_count; ++i)
+  {
+    Writer *w = &p->writers[i];
+    snprintf(path, path_len, "%s%u", p->prefix, p->node_ids[i]);
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (p->direct) flags |= O_DIRECT;
+    w->fd = open(path, flags, 0644);
+    if (w->fd < 0) die(path);
+
+    if (posix_memalign((void **) &w->buf, PARTITION_DIRECT_ALIGN,
+                       p->block_size + PARTITION_DIRECT_ALIGN) != 0)
+      die("posix_memalign");
+  }
+  free(path);
+}
+
+//
+// Workers
+//
+
+static void *assign_worker(void *arg)
+{
+  Job *job = arg;
+  Partition *p = job->p;
+  SpanVec *spans = &p->spans[job->worker * p->node_count];
+
+  size_t pos = p->chunk_begin[job->worker];
+  size_t end = p->chunk_end[job->worker];
+
+  Span batch[PARTITION_LOOKUP_BATCH];
+  size_t batch_len = 0;
+
+  while (pos < end || batch_len > 0)
+  {
+    // Collect a batch of keys, then assign all of them
+    while (pos < end && batch_len < PARTITION_LOOKUP_BATCH)
+    {
+      const char *nl = memchr(p->data + pos, '\n', end - pos);
+      size_t line_end = nl ? (size_t)(nl - p->data) + 1 : end;
+      batch[batch_len].offset = pos;
+      batch[batch_len].len = line_end - pos;
+      batch_len++;
+      pos = line_end;
+    }
+
+    RendezvousHasherId item_ids[PARTITION_LOOKUP_BATCH];
+    RendezvousHasherId node_ids[PARTITION_LOOKUP_BATCH];
+    for (size_t i = 0; i < batch_len; ++i)
+    {
+      size_t key_len = batch[i].len;
+      if (p->data[batch[i].offset + key_len - 1] == '\n') key_len--;
+      item_ids[i] = key_to_id(p->data + batch[i].offset, key_len, p->numeric);
+    }
+
+    if (rendezvous_get_nodes_for(&p->rh, item_ids, node_ids, batch_len)
+        != RENDEZVOUS_HASHER_OK)
+    {
+      p->failed = 1;
+      return NULL;
+    }
+
+    for (size_t i = 0; i < batch_len; ++i)
+    {
+      if (span_push(&spans[node_index(p, node_ids[i])],
+                    batch[i].offset, batch[i].len) < 0)
+      {
+        p->failed = 1;
+        return NULL;
+      }
+    }
+    batch_len = 0;
+  }
+
+  return NULL;
+}
+
+static void *emit_worker(void *arg)
+{
+  Job *job = arg;
+  Partition *p = job->p;
+
+  for (size_t node = job->worker; node < p->node_count; node += p->threads)
+  {
+    Writer *w = &p->writers[node];
+    for (size_t chunk = 0; chunk < p->threads; ++chunk)
+    {
+      SpanVec *v = &p->spans[chunk * p->node_count + node];
+      for (size_t i = 0; i < v->len; ++i)
+      {
+        if (writer_append(p, w, p->data + v->items[i].offset,
+                          v->items[i].len) < 0)
+        {
+          p->failed = 1;
+          return NULL;
+        }
+      }
+      v->len = 0;
+    }
+  }
+
+  return NULL;
+}
+
+static void run_phase(Partition *p, void *(*fn)(void *))
+{
+  pthread_t *threads = malloc(p->threads * sizeof(pthread_t));
+  Job *jobs = malloc(p->threads * sizeof(Job));
+  if (!threads || !jobs) die("malloc");
+
+  for (size_t i = 0; i < p->threads; ++i)
+  {
+    jobs[i].p = p;
+    jobs[i].worker = i;
+    if (pthread_create(&threads[i], NULL, fn, &jobs[i]) != 0)
+      die("pthread_create");
+  }
+  for (size_t i = 0; i < p->threads; ++i)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+  free(jobs);
+  if (p->failed) die("partition");
+}
+
+// Split [pos, pos + threads * chunk_size) in per worker chunks that
+// end on a newline. Returns the end of the round.
+static size_t plan_round(Partition *p, size_t pos)
+{
+  for (size_t i = 0; i < p->threads; ++i)
+  {
+    size_t end = pos + p->chunk_size < p->size ? pos + p->chunk_size : p->size;
+    if (end < p->size)
+    {
+      const char *nl = memchr(p->data + end, '\n', p->size - end);
+      end = nl ? (size_t)(nl - p->data) + 1 : p->size;
+    }
+    p->chunk_begin[i] = pos;
+    p->chunk_end[i] = end;
+    pos = end;
+  }
+  return pos;
+}
+
+static int compare_ids(const void *a, const void *b)
+{
+  RendezvousHasherId x = *(const RendezvousHasherId *) a;
+  RendezvousHasherId y = *(const RendezvousHasherId *) b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv)
+{
+  Partition p = {0};
+  p.threads = 4;
+  p.chunk_size = (size_t) 64 << 20;
+  p.block_size = (size_t) 1 << 20;
+  p.prefix = "node-";
+
+  int opt;
+  while ((opt = getopt(argc, argv, "t:c:b:dnp:")) != -1)
+  {
+    switch (opt)
+    {
+    case 't': p.threads = parse_size(optarg); break;
+    case 'c': p.chunk_size = parse_size(optarg); break;
+    case 'b': p.block_size = parse_size(optarg); break;
+    case 'd': p.direct = 1; break;
+    case 'n': p.numeric = 1; break;
+    case 'p': p.prefix = optarg; break;
+    default: usage();
+    }
+  }
+  if (argc - optind < 2) usage();
+  if (p.direct && p.block_size % PARTITION_DIRECT_ALIGN != 0)
+  {
+    fprintf(stderr, "partition: -b must be a multiple of %d with -d\n",
+            PARTITION_DIRECT_ALIGN);
+    return 2;
+  }
+
+  // Nodes
+  p.node_count = (size_t)(argc - optind - 1);
+  p.node_ids = malloc(p.node_count * sizeof(RendezvousHasherId));
+  if (!p.node_ids) die("malloc");
+  for (size_t i = 0; i < p.node_count; ++i)
+    p.node_ids[i] = (RendezvousHasherId) strtoul(argv[optind + 1 + i], NULL, 10);
+  qsort(p.node_ids, p.node_count, sizeof(RendezvousHasherId), compare_ids);
+
+  rendezvous_init(&p.rh);
+  for (size_t i = 0; i < p.node_count; ++i)
+  {
+    if (i > 0 && p.node_ids[i] == p.node_ids[i - 1])
+    {
+      fprintf(stderr, "partition: duplicate node id %u\n", p.node_ids[i]);
+      return 2;
+    }
+    if (rendezvous_add_node(&p.rh, p.node_ids[i]) != RENDEZVOUS_HASHER_OK)
+      die("rendezvous_add_node");
+  }
+
+  // Input
+  int fd = open(argv[optind], O_RDONLY);
+  if (fd < 0) die(argv[optind]);
+  struct stat st;
+  if (fstat(fd, &st) < 0) die("fstat");
+  p.size = (size_t) st.st_size;
+  if (p.size > 0)
+  {
+    p.data = mmap(NULL, p.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p.data == MAP_FAILED) die("mmap");
+    madvise((void *) p.data, p.size, MADV_SEQUENTIAL);
+  }
+
+  p.spans = calloc(p.threads * p.node_count, sizeof(SpanVec));
+  p.chunk_begin = malloc(p.threads * sizeof(size_t));
+  p.chunk_end = malloc(p.threads * sizeof(size_t));
+  if (!p.spans || !p.chunk_begin || !p.chunk_end) die("malloc");
+
+  writers_open(&p);
+
+  size_t pos = 0;
+  long page = sysconf(_SC_PAGESIZE);
+  while (pos < p.size)
+  {
+    size_t end = plan_round(&p, pos);
+    run_phase(&p, assign_worker);
+    run_phase(&p, emit_worker);
+
+    // Drop the pages of the round from the mapping so that the
+    // resident set does not grow with the input
+    size_t drop_begin = pos - pos % (size_t) page;
+    size_t drop_end = end - end % (size_t) page;
+    if (drop_end > drop_begin)
+      madvise((void *)(p.data + drop_begin), drop_end - drop_begin,
+              MADV_DONTNEED);
+    pos = end;
+  }
+
+  for (size_t i = 0; i < p.node_count; ++i)
+    if (writer_close(&p, &p.writers[i]) < 0) die("write");
+
+  for (size_t i = 0; i < p.threads * p.node_count; ++i)
+    free(p.spans[i].items);
+  free(p.spans);
+  free(p.chunk_begin);
+  free(p.chunk_end);
+  free(p.writers);
+  free(p.node_ids);
+  rendezvous_free(&p.rh);
+  if (p.size > 0) munmap((void *) p.data, p.size);
+  close(fd);
+  return 0;
+}